@@ -1,73 +1,70 @@
 #include "crc16.h"
 
 namespace {
-    uint8_t crcHi[] = {
-        0x00, 0xc1, 0x81, 0x40, 0x01, 0xc0, 0x80, 0x41, 0x01, 0xc0,
-        0x80, 0x41, 0x00, 0xc1, 0x81, 0x40, 0x01, 0xc0, 0x80, 0x41,
-        0x00, 0xc1, 0x81, 0x40, 0x00, 0xc1, 0x81, 0x40, 0x01, 0xc0,
-        0x80, 0x41, 0x01, 0xc0, 0x80, 0x41, 0x00, 0xc1, 0x81, 0x40,
-        0x00, 0xc1, 0x81, 0x40, 0x01, 0xc0, 0x80, 0x41, 0x00, 0xc1,
-        0x81, 0x40, 0x01, 0xc0, 0x80, 0x41, 0x01, 0xc0, 0x80, 0x41,
-        0x00, 0xc1, 0x81, 0x40, 0x01, 0xc0, 0x80, 0x41, 0x00, 0xc1,
-        0x81, 0x40, 0x00, 0xc1, 0x81, 0x40, 0x01, 0xc0, 0x80, 0x41,
-        0x00, 0xc1, 0x81, 0x40, 0x01, 0xc0, 0x80, 0x41, 0x01, 0xc0,
-        0x80, 0x41, 0x00, 0xc1, 0x81, 0x40, 0x00, 0xc1, 0x81, 0x40,
-        0x01, 0xc0, 0x80, 0x41, 0x01, 0xc0, 0x80, 0x41, 0x00, 0xc1,
-        0x81, 0x40, 0x01, 0xc0, 0x80, 0x41, 0x00, 0xc1, 0x81, 0x40,
-        0x00, 0xc1, 0x81, 0x40, 0x01, 0xc0, 0x80, 0x41, 0x01, 0xc0,
-        0x80, 0x41, 0x00, 0xc1, 0x81, 0x40, 0x00, 0xc1, 0x81, 0x40,
-        0x01, 0xc0, 0x80, 0x41, 0x00, 0xc1, 0x81, 0x40, 0x01, 0xc0,
-        0x80, 0x41, 0x01, 0xc0, 0x80, 0x41, 0x00, 0xc1, 0x81, 0x40,
-        0x00, 0xc1, 0x81, 0x40, 0x01, 0xc0, 0x80, 0x41, 0x01, 0xc0,
-        0x80, 0x41, 0x00, 0xc1, 0x81, 0x40, 0x01, 0xc0, 0x80, 0x41,
-        0x00, 0xc1, 0x81, 0x40, 0x00, 0xc1, 0x81, 0x40, 0x01, 0xc0,
-        0x80, 0x41, 0x00, 0xc1, 0x81, 0x40, 0x01, 0xc0, 0x80, 0x41,
-        0x01, 0xc0, 0x80, 0x41, 0x00, 0xc1, 0x81, 0x40, 0x01, 0xc0,
-        0x80, 0x41, 0x00, 0xc1, 0x81, 0x40, 0x00, 0xc1, 0x81, 0x40,
-        0x01, 0xc0, 0x80, 0x41, 0x01, 0xc0, 0x80, 0x41, 0x00, 0xc1,
-        0x81, 0x40, 0x00, 0xc1, 0x81, 0x40, 0x01, 0xc0, 0x80, 0x41,
-        0x00, 0xc1, 0x81, 0x40, 0x01, 0xc0, 0x80, 0x41, 0x01, 0xc0,
-        0x80, 0x41, 0x00, 0xc1, 0x81, 0x40
-    };
+    const int SLICES = 8;
+
+    // Slice-by-8 tables: Table[0] is the usual byte at a time table,
+    // Table[k][b] is the CRC of byte b followed by k zero bytes, so
+    // eight bytes are processed with eight independent lookups
+    struct TTables {
+        uint16_t Table[SLICES][256];
 
-    uint8_t crcLo[] = {
-        0x00, 0xc0, 0xc1, 0x01, 0xc3, 0x03, 0x02, 0xc2, 0xc6, 0x06,
-        0x07, 0xc7, 0x05, 0xc5, 0xc4, 0x04, 0xcc, 0x0c, 0x0d, 0xcd,
-        0x0f, 0xcf, 0xce, 0x0e, 0x0a, 0xca, 0xcb, 0x0b, 0xc9, 0x09,
-        0x08, 0xc8, 0xd8, 0x18, 0x19, 0xd9, 0x1b, 0xdb, 0xda, 0x1a,
-        0x1e, 0xde, 0xdf, 0x1f, 0xdd, 0x1d, 0x1c, 0xdc, 0x14, 0xd4,
-        0xd5, 0x15, 0xd7, 0x17, 0x16, 0xd6, 0xd2, 0x12, 0x13, 0xd3,
-        0x11, 0xd1, 0xd0, 0x10, 0xf0, 0x30, 0x31, 0xf1, 0x33, 0xf3,
-        0xf2, 0x32, 0x36, 0xf6, 0xf7, 0x37, 0xf5, 0x35, 0x34, 0xf4,
-        0x3c, 0xfc, 0xfd, 0x3d, 0xff, 0x3f, 0x3e, 0xfe, 0xfa, 0x3a,
-        0x3b, 0xfb, 0x39, 0xf9, 0xf8, 0x38, 0x28, 0xe8, 0xe9, 0x29,
-        0xeb, 0x2b, 0x2a, 0xea, 0xee, 0x2e, 0x2f, 0xef, 0x2d, 0xed,
-        0xec, 0x2c, 0xe4, 0x24, 0x25, 0xe5, 0x27, 0xe7, 0xe6, 0x26,
-        0x22, 0xe2, 0xe3, 0x23, 0xe1, 0x21, 0x20, 0xe0, 0xa0, 0x60,
-        0x61, 0xa1, 0x63, 0xa3, 0xa2, 0x62, 0x66, 0xa6, 0xa7, 0x67,
-        0xa5, 0x65, 0x64, 0xa4, 0x6c, 0xac, 0xad, 0x6d, 0xaf, 0x6f,
-        0x6e, 0xae, 0xaa, 0x6a, 0x6b, 0xab, 0x69, 0xa9, 0xa8, 0x68,
-        0x78, 0xb8, 0xb9, 0x79, 0xbb, 0x7b, 0x7a, 0xba, 0xbe, 0x7e,
-        0x7f, 0xbf, 0x7d, 0xbd, 0xbc, 0x7c, 0xb4, 0x74, 0x75, 0xb5,
-        0x77, 0xb7, 0xb6, 0x76, 0x72, 0xb2, 0xb3, 0x73, 0xb1, 0x71,
-        0x70, 0xb0, 0x50, 0x90, 0x91, 0x51, 0x93, 0x53, 0x52, 0x92,
-        0x96, 0x56, 0x57, 0x97, 0x55, 0x95, 0x94, 0x54, 0x9c, 0x5c,
-        0x5d, 0x9d, 0x5f, 0x9f, 0x9e, 0x5e, 0x5a, 0x9a, 0x9b, 0x5b,
-        0x99, 0x59, 0x58, 0x98, 0x88, 0x48, 0x49, 0x89, 0x4b, 0x8b,
-        0x8a, 0x4a, 0x4e, 0x8e, 0x8f, 0x4f, 0x8d, 0x4d, 0x4c, 0x8c,
-        0x44, 0x84, 0x85, 0x45, 0x87, 0x47, 0x46, 0x86, 0x82, 0x42,
-        0x43, 0x83, 0x41, 0x81, 0x80, 0x40
+        TTables()
+        {
+            for (int b = 0; b < 256; ++b) {
+                uint16_t crc = b;
+                for (int bit = 0; bit < 8; ++bit)
+                    crc = crc & 1 ? (crc >> 1) ^ 0xA001 : crc >> 1;
+                Table[0][b] = crc;
+            }
+            for (int k = 1; k < SLICES; ++k) {
+                for (int b = 0; b < 256; ++b)
+                    Table[k][b] = (Table[k - 1][b] >> 8) ^ Table[0][Table[k - 1][b] & 0xFF];
+            }
+        }
     };
+
+    // CRCs aren't calculated during static initialization
+    const TTables Tables;
+
+    uint16_t Update(uint16_t crc, const uint8_t* data, size_t size)
+    {
+        const auto& t = Tables.Table;
+        for (; size >= SLICES; size -= SLICES, data += SLICES) {
+            crc = t[7][(crc ^ data[0]) & 0xFF] ^ t[6][(crc >> 8) ^ data[1]] ^
+                t[5][data[2]] ^ t[4][data[3]] ^ t[3][data[4]] ^
+                t[2][data[5]] ^ t[1][data[6]] ^ t[0][data[7]];
+        }
+        while (size--)
+            crc = (crc >> 8) ^ t[0][(crc ^ *data++) & 0xFF];
+        return crc;
+    }
 }
 
 uint16_t CRC16::CalculateCRC16(const uint8_t *buffer, uint16_t len)
 {
-    uint8_t crch = 0xff, crcl = 0xff;
-    while (len--) {
-        uint8_t i = crch ^ *buffer++;
-        crch = crcl ^ crcHi[i];
-        crcl = crcLo[i];
-    }
+    TCalculator crc;
+    crc.Update(buffer, len);
+    return crc.Value();
+}
+
+void CRC16::TCalculator::Update(const uint8_t* data, size_t size)
+{
+    Crc = ::Update(Crc, data, size);
+}
 
-    return crch << 8 | crcl;
+std::function<bool(uint8_t* buf, int size)> CRC16::ExpectValidFrame(int min_size)
+{
+    TCalculator crc;
+    int done = 0;
+    return [crc, done, min_size](uint8_t* buf, int size) mutable {
+        if (size < done) {
+            // a new frame in the same buffer
+            crc.Reset();
+            done = 0;
+        }
+        crc.Update(buf + done, size - done);
+        done = size;
+        return size >= min_size && crc.IsValidFrame();
+    };
 }
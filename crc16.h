@@ -1,7 +1,31 @@
 #pragma once
 
 #include <stdint.h>
+#include <stddef.h>
+#include <functional>
 
+// CRC-16/MODBUS (reflected polynomial 0xA001, initial value 0xFFFF),
+// also used by the energy meter protocols. Values are returned with the
+// byte that goes first on the wire in the high byte.
 namespace CRC16 {
     uint16_t CalculateCRC16(const uint8_t *buffer, uint16_t len);
+
+    // CRC of data that arrives in parts
+    class TCalculator {
+    public:
+        void Reset() { Crc = 0xFFFF; }
+        void Update(const uint8_t* data, size_t size);
+        uint16_t Value() const { return uint16_t(Crc << 8 | Crc >> 8); }
+        // true if the data passed so far ends with its own CRC
+        bool IsValidFrame() const { return !Crc; }
+
+    private:
+        uint16_t Crc = 0xFFFF;
+    };
+
+    // Frame completion predicate for TPort::ReadFrame(): the frame is
+    // complete when it's at least min_size bytes long and ends with its
+    // own CRC. Only the bytes received since the previous call are added
+    // to the CRC.
+    std::function<bool(uint8_t* buf, int size)> ExpectValidFrame(int min_size);
 }
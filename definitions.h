@@ -7,3 +7,12 @@ class TBinarySemaphore;
 
 using TTimePoint            = std::chrono::steady_clock::time_point;
 using PBinarySemaphore      = std::shared_ptr<TBinarySemaphore>;
+
+// Priority classes of polled registers, from the most to the least urgent
+enum class EPriorityClass {
+    Realtime,
+    Normal,
+    Background
+};
+
+const int PRIORITY_CLASS_COUNT = 3;
@@ -61,6 +61,8 @@ protected:
                                TPort::TFrameCompletePred frame_complete = 0)
     {
         uint8_t buf[MAX_LEN], *p = buf;
+        if (!frame_complete)
+            frame_complete = ExpectResponse(expectedByte1, len);
         int nread = this->Port()->ReadFrame(buf, MAX_LEN, this->DeviceConfig()->FrameTimeout, frame_complete);
         if (nread < 3 + SlaveIdWidth)
             throw TSerialDeviceTransientErrorException("frame too short");
@@ -99,6 +101,26 @@ protected:
         std::memcpy(payload, p, len);
         return true;
     }
+    // A response of known size is complete once it has that size. A
+    // shorter frame ends early only if it is an error response: it has
+    // a valid CRC and CheckForException() recognizes it, as any prefix
+    // of a normal response may happen to end with a valid CRC. Without
+    // the expected size the first frame with a valid CRC is taken.
+    TPort::TFrameCompletePred ExpectResponse(int expectedByte1, int len)
+    {
+        auto valid_frame = CRC16::ExpectValidFrame(3 + SlaveIdWidth);
+        if (len < 0)
+            return valid_frame;
+        int size = SlaveIdWidth + (expectedByte1 >= 0 ? 1 : 0) + len + 2;
+        return [this, valid_frame, size](uint8_t* buf, int n) mutable {
+            // the CRC is updated on every call
+            if (!valid_frame(buf, n) || n >= size)
+                return n >= size;
+            const char* msg;
+            return CheckForException(buf, n, &msg) != NO_ERROR;
+        };
+    }
+
     void Talk( uint8_t cmd, uint8_t* payload, int payload_len,
               int expected_byte1, uint8_t* resp_payload, int resp_payload_len,
               TPort::TFrameCompletePred frame_complete = 0)
@@ -3,6 +3,8 @@
 #include "binary_semaphore.h"
 
 #include <unistd.h>
+#include <time.h>
+#include <errno.h>
 #include <iomanip>
 #include <iostream>
 #include <sys/select.h>
@@ -11,8 +13,19 @@
 using namespace std;
 
 namespace {
+    // for the ports that don't know their line settings
     const chrono::milliseconds DefaultFrameTimeout(15);
     const chrono::milliseconds NoiseTimeout(10);
+    // Silence between frames on the bus, in characters (Modbus RTU value)
+    const double FrameSilenceChars = 3.5;
+    // for the ports that don't know their line settings, the pause
+    // they used to make after each complete frame
+    const chrono::microseconds DefaultFrameSilence(15);
+    // UARTs hand the received data over in FIFO sized chunks, so there
+    // may be no data for that long in the middle of a frame
+    const double ReceiveFifoChars = 16;
+    // the pause that ends a frame can't be shorter than scheduling delays
+    const chrono::microseconds MinFrameTimeout(1000);
 }
 
 TFileDescriptorPort::TFileDescriptorPort(const PPortSettings & settings)
@@ -48,9 +61,14 @@ void TFileDescriptorPort::CheckPortOpen() const
 }
 
 void TFileDescriptorPort::WriteBytes(const uint8_t * buf, int count) {
+    // make sure other devices see the end of the previous frame
+    SleepSinceLastInteraction(GetFrameSilence());
     if (write(Fd, buf, count) < count) {
         throw TSerialDeviceException("serial write failed");
     }
+    // write() returns as soon as the data is buffered,
+    // the last byte leaves the wire later
+    LastInteraction = CurrentTime() + GetSendTime(count);
 
     if (Debug()) {
         // TBD: move this to libwbmqtt (HexDump?)
@@ -105,6 +123,7 @@ uint8_t TFileDescriptorPort::ReadByte()
     if (read(Fd, &b, 1) < 1) {
         throw TSerialDeviceException("read() failed");
     }
+    LastInteraction = CurrentTime();
 
     if (Debug()) {
         ios::fmtflags f(cerr.flags());
@@ -115,7 +134,25 @@ uint8_t TFileDescriptorPort::ReadByte()
     return b;
 }
 
-// Reading becomes unstable when using timeout less than default because of bufferization
+chrono::milliseconds TFileDescriptorPort::GetResponseTimeout() const
+{
+    return Settings->ResponseTimeout;
+}
+
+chrono::microseconds TFileDescriptorPort::GetFrameSilence() const
+{
+    auto silence = GetSendTime(FrameSilenceChars);
+    return silence == chrono::microseconds::zero() ? DefaultFrameSilence : silence;
+}
+
+chrono::microseconds TFileDescriptorPort::GetFrameTimeout() const
+{
+    auto fifo_time = GetSendTime(ReceiveFifoChars + FrameSilenceChars);
+    if (fifo_time == chrono::microseconds::zero())
+        return DefaultFrameTimeout;
+    return max(fifo_time, MinFrameTimeout);
+}
+
 int TFileDescriptorPort::ReadFrame(uint8_t * buf, int size,
                            const chrono::microseconds& timeout,
                            TFrameCompletePred frame_complete)
@@ -123,25 +160,14 @@ int TFileDescriptorPort::ReadFrame(uint8_t * buf, int size,
     CheckPortOpen();
     int nread = 0;
     while (nread < size) {
-        if (frame_complete && frame_complete(buf, nread)) {
-            // XXX A hack.
-            // The problem is that if we don't pause here and the
-            // serial client switches to another device after
-            // processing this frame, that device may miss the frame
-            // boundary and consider the last response (from this
-            // device) and the query (from the master) to be single
-            // frame. On the other hand, we don't want to use
-            // device-specific frame timeout here as it can be quite
-            // long. The proper solution would be perhaps ensuring
-            // that there's a pause of at least
-            // DeviceConfig->FrameTimeoutMs before polling each
-            // device.
-            usleep(DefaultFrameTimeout.count());
+        // The next request waits for the silence between frames in
+        // WriteBytes(), so the devices don't take this response and
+        // the request for a single frame
+        if (frame_complete && frame_complete(buf, nread))
             break;
-        }
 
         if (!Select(!nread ? Settings->ResponseTimeout :
-                    timeout.count() < 0 ? DefaultFrameTimeout :
+                    timeout.count() < 0 ? GetFrameTimeout() :
                     timeout))
             break; // end of the frame
 
@@ -172,6 +198,7 @@ int TFileDescriptorPort::ReadFrame(uint8_t * buf, int size,
         if (n < nb) { // may happen only due to a kernel/driver bug
             throw TSerialDeviceException("short read()");
         }
+        LastInteraction = CurrentTime();
 
         nread += nb;
     }
@@ -201,6 +228,7 @@ void TFileDescriptorPort::SkipNoise()
         if (read(Fd, &b, 1) < 1) {
             throw TSerialDeviceException("read() failed");
         }
+        LastInteraction = CurrentTime();
         if (Debug()) {
             ios::fmtflags f(cerr.flags());
             cerr << "read noise: " << hex << setfill('0') << setw(2) << int(b) << endl;
@@ -209,9 +237,28 @@ void TFileDescriptorPort::SkipNoise()
     }
 }
 
+void TFileDescriptorPort::SleepUntil(const TTimePoint & deadline)
+{
+    // steady_clock is CLOCK_MONOTONIC on Linux. Sleeping until an
+    // absolute deadline doesn't accumulate error when interrupted
+    auto ns = chrono::duration_cast<chrono::nanoseconds>(deadline.time_since_epoch()).count();
+    struct timespec ts;
+    ts.tv_sec = ns / 1000000000;
+    ts.tv_nsec = ns % 1000000000;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+}
+
 void TFileDescriptorPort::Sleep(const chrono::microseconds & us)
 {
-    usleep(us.count());
+    SleepUntil(CurrentTime() + us);
+}
+
+void TFileDescriptorPort::SleepSinceLastInteraction(const chrono::microseconds & us)
+{
+    auto deadline = LastInteraction + us;
+    if (deadline > CurrentTime())
+        SleepUntil(deadline);
 }
 
 bool TFileDescriptorPort::Wait(const PBinarySemaphore & semaphore, const TTimePoint & until)
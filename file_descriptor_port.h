@@ -23,16 +23,26 @@ public:
     bool IsOpen() const override;
 
     void Sleep(const std::chrono::microseconds & us) override;
+    void SleepSinceLastInteraction(const std::chrono::microseconds & us) override;
     bool Wait(const PBinarySemaphore & semaphore, const TTimePoint & until) override;
     void SetDebug(bool debug) override;
     bool Debug() const override;
     TTimePoint CurrentTime() const override;
+    std::chrono::milliseconds GetResponseTimeout() const override;
+
+    // Silence between frames on the bus derived from the line settings,
+    // a short fixed pause if the port doesn't know them (TCP)
+    std::chrono::microseconds GetFrameSilence() const;
+    // Pause that ends a frame if the protocol doesn't set it
+    std::chrono::microseconds GetFrameTimeout() const;
 
 protected:
     bool Select(const std::chrono::microseconds& us);
+    void SleepUntil(const TTimePoint & deadline);
     virtual void OnReadyEmptyFd();
 
     int             Fd;
     bool            DebugEnabled;
     PPortSettings   Settings;
+    TTimePoint      LastInteraction;    // when the last byte was sent or received
 };
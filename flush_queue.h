@@ -0,0 +1,90 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <vector>
+#include <stdint.h>
+
+#include "definitions.h"
+#include "binary_semaphore.h"
+
+// Slots (TRegister::Slot) of the registers that have values waiting to
+// be written. Any thread may push, only the polling thread takes them,
+// so taking all the slots at once is enough and pushing is a single CAS without
+// locks. Pushing signals flush_needed.
+class TFlushQueue {
+public:
+    typedef std::function<TTimePoint()> TClockFunc;
+
+    // A register to flush and the time its value was set
+    struct TItem {
+        uint32_t Id;
+        TTimePoint Time;
+    };
+
+    TFlushQueue(PBinarySemaphore flush_needed, TClockFunc clock = std::chrono::steady_clock::now)
+        : FlushNeeded(flush_needed), Clock(clock) {}
+    TFlushQueue(const TFlushQueue&) = delete;
+    TFlushQueue& operator=(const TFlushQueue&) = delete;
+
+    ~TFlushQueue()
+    {
+        Free(Head.exchange(nullptr));
+    }
+
+    void Push(uint32_t id)
+    {
+        TNode* node = new TNode{ { id, Clock() }, Head.load(std::memory_order_relaxed) };
+        while (!Head.compare_exchange_weak(node->Next, node, std::memory_order_release,
+                                           std::memory_order_relaxed));
+        FlushNeeded->Signal();
+    }
+
+    // Move the items pushed so far to items in the order they were pushed
+    void TakeAll(std::vector<TItem>& items)
+    {
+        items.clear();
+        TNode* head = Head.exchange(nullptr, std::memory_order_acquire);
+        for (TNode* node = head; node; node = node->Next)
+            items.push_back(node->Item);
+        Free(head);
+        // the list is last in, first out
+        std::reverse(items.begin(), items.end());
+    }
+
+    // Get the time of the oldest item, false if there are no items.
+    // Only for the thread that takes the items, as it frees them.
+    bool OldestTime(TTimePoint& time) const
+    {
+        TNode* node = Head.load(std::memory_order_acquire);
+        if (!node)
+            return false;
+        while (node->Next)
+            node = node->Next;
+        time = node->Item.Time;
+        return true;
+    }
+
+private:
+    struct TNode {
+        TItem Item;
+        TNode* Next;
+    };
+
+    static void Free(TNode* node)
+    {
+        while (node) {
+            TNode* next = node->Next;
+            delete node;
+            node = next;
+        }
+    }
+
+    std::atomic<TNode*> Head{ nullptr };
+    PBinarySemaphore FlushNeeded;
+    TClockFunc Clock;
+};
+
+typedef std::shared_ptr<TFlushQueue> PFlushQueue;
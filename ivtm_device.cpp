@@ -85,10 +85,7 @@ void TIVTMDevice::ReadResponse(uint16_t addr, uint8_t* payload, uint16_t len)
     uint8_t buf[MAX_LEN];
 
     int nread = Port()->ReadFrame(
-        buf, MAX_LEN, std::chrono::milliseconds(FrameTimeoutMs),
-        [](uint8_t* buf, int size) {
-            return size > 0 && buf[size - 1] == '\r';
-        });
+        buf, MAX_LEN, std::chrono::milliseconds(FrameTimeoutMs), TPort::ExpectTerminator('\r'));
     if (nread < 10)
         throw TSerialDeviceTransientErrorException("frame too short");
 
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <chrono>
+#include <vector>
+#include <stdint.h>
+
+// Counts of latencies by ranges. Bucket i counts latencies up to
+// Bounds()[i], the last bucket counts the ones above all the bounds.
+class TLatencyHistogram {
+public:
+    static const std::vector<std::chrono::milliseconds>& Bounds()
+    {
+        static const std::vector<std::chrono::milliseconds> bounds = {
+            std::chrono::milliseconds(5), std::chrono::milliseconds(10), std::chrono::milliseconds(20),
+            std::chrono::milliseconds(50), std::chrono::milliseconds(100), std::chrono::milliseconds(200),
+            std::chrono::milliseconds(500), std::chrono::milliseconds(1000), std::chrono::milliseconds(2000),
+            std::chrono::milliseconds(5000)
+        };
+        return bounds;
+    }
+
+    void Add(std::chrono::microseconds latency)
+    {
+        const auto& bounds = Bounds();
+        size_t i = 0;
+        while (i < bounds.size() && latency > bounds[i])
+            ++i;
+        ++Counts[i];
+        ++Total;
+        if (latency > Max)
+            Max = latency;
+    }
+
+    const std::vector<uint64_t>& BucketCounts() const { return Counts; }
+    uint64_t Count() const { return Total; }
+    std::chrono::microseconds MaxLatency() const { return Max; }
+
+private:
+    std::vector<uint64_t> Counts = std::vector<uint64_t>(Bounds().size() + 1);
+    uint64_t Total = 0;
+    std::chrono::microseconds Max = std::chrono::microseconds::zero();
+};
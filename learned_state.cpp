@@ -0,0 +1,214 @@
+#include "learned_state.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+
+namespace {
+    Json::Value PairsToJson(const std::set<std::pair<int, int>>& pairs)
+    {
+        Json::Value array(Json::arrayValue);
+        for (const auto& p: pairs) {
+            Json::Value item(Json::arrayValue);
+            item.append(p.first);
+            item.append(p.second);
+            array.append(item);
+        }
+        return array;
+    }
+
+    bool PairsFromJson(const Json::Value& array, std::set<std::pair<int, int>>& pairs)
+    {
+        if (!array.isArray())
+            return false;
+        for (const auto& item: array) {
+            if (!item.isArray() || item.size() != 2 || !item[0].isInt() || !item[1].isInt())
+                return false;
+            pairs.insert(std::make_pair(item[0].asInt(), item[1].asInt()));
+        }
+        return true;
+    }
+
+    bool SameLimits(const TReadLimits& a, const TReadLimits& b)
+    {
+        return a.MaxReadRegisters == b.MaxReadRegisters && a.MaxRegHole == b.MaxRegHole &&
+            a.MaxBitHole == b.MaxBitHole && a.Boundaries == b.Boundaries && a.Unavailable == b.Unavailable;
+    }
+};
+
+TLearnedState::TLearnedState(const std::string& file_name)
+    : FileName(file_name)
+{}
+
+std::string TLearnedState::LayoutHash(PDeviceConfig config)
+{
+    // Everything that decides which requests go to the device: the
+    // registers come from the template and the config, the read limits
+    // are where learning starts from
+    std::ostringstream s;
+    s << config->Protocol << ";" << config->DeviceType << ";" << config->Stride << ";" << config->Shift << ";" <<
+        config->MaxReadRegisters << ";" << config->MaxRegHole << ";" << config->MaxBitHole << ";" <<
+        config->AutoReadLimits;
+    for (const auto& channel: config->DeviceChannelConfigs) {
+        for (const auto& reg: channel->RegisterConfigs)
+            s << ";" << reg->Type << ":" << reg->Address << ":" << reg->Format;
+    }
+
+    // FNV-1a, std::hash isn't guaranteed to be the same across builds
+    uint64_t hash = 14695981039346656037ULL;
+    for (unsigned char c: s.str()) {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+    std::ostringstream hex;
+    hex << std::hex << std::setw(16) << std::setfill('0') << hash;
+    return hex.str();
+}
+
+void TLearnedState::Load()
+{
+    std::lock_guard<std::mutex> lock(Mutex);
+    Devices.clear();
+    Dirty = false;
+
+    std::ifstream input(FileName);
+    if (!input.is_open())
+        return;
+
+    Json::Reader reader;
+    Json::Value root;
+    if (!reader.parse(input, root, false)) {
+        std::cerr << "Failed to parse learned state file " << FileName << ", ignoring it: " <<
+            reader.getFormattedErrorMessages() << std::endl;
+        return;
+    }
+    if (!root.isObject() || !root["version"].isInt() || root["version"].asInt() != VERSION ||
+        !root["devices"].isArray()) {
+        std::cerr << "Unsupported learned state file " << FileName << ", ignoring it" << std::endl;
+        return;
+    }
+
+    for (const auto& item: root["devices"]) {
+        TDeviceState state;
+        bool ok = item.isObject() && item["port"].isString() && item["slave_id"].isString() &&
+            item["layout_hash"].isString() && item["max_read_registers"].isInt() &&
+            item["max_reg_hole"].isInt() && item["max_bit_hole"].isInt() &&
+            PairsFromJson(item["boundaries"], state.Limits.Boundaries) &&
+            PairsFromJson(item["unavailable"], state.Limits.Unavailable) &&
+            item["unavailable_addresses"].isArray();
+        if (ok) {
+            for (const auto& address: item["unavailable_addresses"]) {
+                if (!address.isInt()) {
+                    ok = false;
+                    break;
+                }
+                state.UnavailableAddresses.insert(address.asInt());
+            }
+        }
+        if (!ok) {
+            std::cerr << "Malformed device entry in learned state file " << FileName << ", skipping it" << std::endl;
+            continue;
+        }
+        state.LayoutHash = item["layout_hash"].asString();
+        state.Limits.MaxReadRegisters = item["max_read_registers"].asInt();
+        state.Limits.MaxRegHole = item["max_reg_hole"].asInt();
+        state.Limits.MaxBitHole = item["max_bit_hole"].asInt();
+        Devices[std::make_pair(item["port"].asString(), item["slave_id"].asString())] = state;
+    }
+}
+
+void TLearnedState::Save()
+{
+    std::lock_guard<std::mutex> lock(Mutex);
+    if (!Dirty)
+        return;
+
+    Json::Value root(Json::objectValue);
+    root["version"] = VERSION;
+    root["devices"] = Json::Value(Json::arrayValue);
+    for (const auto& p: Devices) {
+        const auto& state = p.second;
+        Json::Value item(Json::objectValue);
+        item["port"] = p.first.first;
+        item["slave_id"] = p.first.second;
+        item["layout_hash"] = state.LayoutHash;
+        item["max_read_registers"] = state.Limits.MaxReadRegisters;
+        item["max_reg_hole"] = state.Limits.MaxRegHole;
+        item["max_bit_hole"] = state.Limits.MaxBitHole;
+        item["boundaries"] = PairsToJson(state.Limits.Boundaries);
+        item["unavailable"] = PairsToJson(state.Limits.Unavailable);
+        item["unavailable_addresses"] = Json::Value(Json::arrayValue);
+        for (int address: state.UnavailableAddresses)
+            item["unavailable_addresses"].append(address);
+        root["devices"].append(item);
+    }
+
+    // write a new file, flush it to the disk and replace the old one
+    // with it, so a crash or power loss never leaves a truncated file
+    std::string tmp_name = FileName + ".tmp";
+    std::string data = Json::FastWriter().write(root);
+    int fd = open(tmp_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    bool ok = fd >= 0;
+    for (size_t written = 0; ok && written < data.size();) {
+        ssize_t n = write(fd, data.data() + written, data.size() - written);
+        if (n < 0 && errno == EINTR)
+            continue;
+        ok = n > 0;
+        written += ok ? n : 0;
+    }
+    ok = ok && fsync(fd) == 0;
+    if (fd >= 0 && close(fd))
+        ok = false;
+    if (!ok) {
+        std::cerr << "Failed to write learned state file " << tmp_name << ": " << strerror(errno) << std::endl;
+        std::remove(tmp_name.c_str());
+        return;
+    }
+    if (std::rename(tmp_name.c_str(), FileName.c_str())) {
+        std::cerr << "Failed to replace learned state file " << FileName << std::endl;
+        std::remove(tmp_name.c_str());
+        return;
+    }
+    // the rename itself is only durable once the directory is flushed
+    auto slash = FileName.rfind('/');
+    std::string dir_name = slash == std::string::npos ? "." : slash == 0 ? "/" : FileName.substr(0, slash);
+    int dir_fd = open(dir_name.c_str(), O_RDONLY | O_DIRECTORY);
+    if (dir_fd < 0 || fsync(dir_fd))
+        std::cerr << "Failed to flush directory " << dir_name << ": " << strerror(errno) << std::endl;
+    if (dir_fd >= 0)
+        close(dir_fd);
+    Dirty = false;
+}
+
+bool TLearnedState::Restore(PSerialDevice dev, const std::string& port) const
+{
+    std::lock_guard<std::mutex> lock(Mutex);
+    auto it = Devices.find(std::make_pair(port, dev->DeviceConfig()->SlaveId));
+    if (it == Devices.end() || it->second.LayoutHash != LayoutHash(dev->DeviceConfig()))
+        return false;
+    dev->SetReadLimits(it->second.Limits);
+    dev->SetUnavailableAddresses(it->second.UnavailableAddresses);
+    return true;
+}
+
+void TLearnedState::Store(PSerialDevice dev, const std::string& port, const TReadLimits& limits)
+{
+    std::lock_guard<std::mutex> lock(Mutex);
+    TDeviceState state;
+    state.LayoutHash = LayoutHash(dev->DeviceConfig());
+    state.Limits = limits;
+    state.UnavailableAddresses = dev->GetUnavailableAddresses();
+
+    auto& saved = Devices[std::make_pair(port, dev->DeviceConfig()->SlaveId)];
+    if (saved.LayoutHash == state.LayoutHash && SameLimits(saved.Limits, state.Limits) &&
+        saved.UnavailableAddresses == state.UnavailableAddresses)
+        return;
+    saved = state;
+    Dirty = true;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+
+#include "serial_config.h"
+#include "serial_device.h"
+
+// Knowledge about the devices learned at runtime (read limits, boundaries
+// of ranges and registers the devices refuse to read) kept in a file, so
+// after a restart it doesn't have to be rediscovered with timeouts and
+// error responses. Devices are identified by port, slave id and a hash of
+// their register layout: the state of a device is dropped once its config
+// or template changes. Port threads share the same instance.
+class TLearnedState {
+public:
+    static const int VERSION = 1;
+
+    TLearnedState(const std::string& file_name);
+    TLearnedState(const TLearnedState&) = delete;
+    TLearnedState& operator=(const TLearnedState&) = delete;
+
+    // A missing or unusable file is the same as an empty one
+    void Load();
+    // Writes the file only if the state has changed since it was loaded or saved
+    void Save();
+    // Applies the saved state to a newly created device. Returns false if
+    // there's nothing saved for the device.
+    bool Restore(PSerialDevice dev, const std::string& port) const;
+    // Takes the current state of the device. limits are passed separately
+    // because the client may have temporary boundaries in them.
+    void Store(PSerialDevice dev, const std::string& port, const TReadLimits& limits);
+
+    static std::string LayoutHash(PDeviceConfig config);
+
+private:
+    struct TDeviceState {
+        std::string LayoutHash;
+        TReadLimits Limits;
+        std::set<int> UnavailableAddresses;
+    };
+
+    std::string FileName;
+    mutable std::mutex Mutex;
+    // (port, slave id) -> state
+    std::map<std::pair<std::string, std::string>, TDeviceState> Devices;
+    bool Dirty = false;
+};
+
+typedef std::shared_ptr<TLearnedState> PLearnedState;
@@ -1,6 +1,8 @@
 #include <iostream>
 #include <cstdio>
+#include <thread>
 #include <getopt.h>
+#include <signal.h>
 #include <unistd.h>
 #include <mosquittopp.h>
 
@@ -84,6 +86,14 @@ int main(int argc, char *argv[])
 
 	mosqpp::lib_init();
 
+    // SIGINT and SIGTERM are handled by a dedicated thread that stops
+    // the port loops, so they must be blocked in all the other threads
+    sigset_t stop_signals;
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGINT);
+    sigaddset(&stop_signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stop_signals, NULL);
+
     if (mqtt_config.Id.empty())
         mqtt_config.Id = "wb-modbus";
 
@@ -96,19 +106,22 @@ int main(int argc, char *argv[])
         if (observer->WriteInitValues() && handler_config->Debug)
             cerr << "Register-based setup performed." << endl;
         mqtt_client->StartLoop();
+        std::thread([observer, stop_signals]() {
+            int sig;
+            if (sigwait(&stop_signals, &sig) == 0) {
+                cerr << "Got signal " << sig << ", stopping" << endl;
+                observer->Stop();
+            }
+        }).detach();
+        // returns once the learned state is saved
         observer->Loop();
     } catch (const TSerialDeviceException& e) {
         cerr << "FATAL: " << e.what() << endl;
         return 1;
     }
 
-    for (;;) sleep(1);
-
-#if 0
-    // FIXME: handle Ctrl-C etc.
-    mqtt_handler->StopLoop();
+    mqtt_client->StopLoop();
 	mosqpp::lib_cleanup();
-#endif
 
 	return 0;
 }
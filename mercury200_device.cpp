@@ -1,5 +1,6 @@
 #include <cstdint>
 #include <chrono>
+#include <map>
 
 #include "crc16.h"
 #include "serial_device.h"
@@ -11,6 +12,14 @@ namespace
     const size_t RESPONSE_BUF_LEN = 100;
     const size_t REQUEST_LEN = 7;
     const ptrdiff_t HEADER_SZ = 5;
+    const ptrdiff_t CRC_SZ = 2;
+
+    // response data size of the commands by their codes
+    const std::map<uint8_t, int> RESPONSE_DATA_SZ = {
+        { 0x27, 16 }, // energy by tariffs
+        { 0x29, 2 },  // battery voltage
+        { 0x63, 7 }   // voltage, current and power
+    };
 }
 
 REGISTER_BASIC_INT_PROTOCOL("mercury200", TMercury200Device, TRegisterTypes(
@@ -110,7 +119,13 @@ int TMercury200Device::RequestResponse(uint32_t slave, uint8_t cmd, uint8_t* res
     uint8_t request[REQUEST_LEN];
     FillCommand(request, slave, cmd);
     Port()->WriteBytes(request, REQUEST_LEN);
-    return Port()->ReadFrame(response, RESPONSE_BUF_LEN, this->DeviceConfig()->FrameTimeout);
+    // responses of other commands end with a pause, as a prefix
+    // of a response may happen to end with a valid CRC
+    TPort::TFrameCompletePred frame_complete;
+    auto it = RESPONSE_DATA_SZ.find(cmd);
+    if (it != RESPONSE_DATA_SZ.end())
+        frame_complete = TPort::ExpectFixedLength(HEADER_SZ + it->second + CRC_SZ);
+    return Port()->ReadFrame(response, RESPONSE_BUF_LEN, this->DeviceConfig()->FrameTimeout, frame_complete);
 }
 
 void TMercury200Device::FillCommand(uint8_t* buf, uint32_t id, uint8_t cmd) const
@@ -6,7 +6,7 @@ namespace {
     TPort::TFrameCompletePred ExpectNBytes(int slave_id_width, int n)
     {
         return [slave_id_width, n](uint8_t* buf, int size) {
-            if (size < 2)
+            if (size <= slave_id_width)
                 return false;
             if (buf[slave_id_width] & 0x80)
                 return size >= 5 + slave_id_width; // exception response
@@ -54,7 +54,7 @@ bool TMilurDevice::ConnectionSetup()
     uint8_t buf[MAX_LEN];
     WriteCommand(0x08, setupCmd, 7);
     try {
-        if (!ReadResponse(0x08, buf, 1, ExpectNBytes(SlaveIdWidth, 5)))
+        if (!ReadResponse(0x08, buf, 1, ExpectNBytes(SlaveIdWidth, SlaveIdWidth + 4)))
             return false;
         if (buf[0] != uint8_t(DeviceConfig()->AccessLevel))
             throw TSerialDeviceException("invalid milur access level in response");
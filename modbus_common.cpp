@@ -5,6 +5,8 @@
 #include <cmath>
 #include <array>
 #include <cassert>
+#include <algorithm>
+#include <cstring>
 #include <unistd.h>
 
 
@@ -19,6 +21,8 @@ namespace Modbus    // modbus protocol declarations
 
     const size_t EXCEPTION_RESPONSE_PDU_SIZE = 2;
     const size_t WRITE_RESPONSE_PDU_SIZE = 5;
+    // function code, address, quantity, byte count and the data
+    const size_t MAX_WRITE_REQUEST_PDU_SIZE = 6 + MAX_WRITE_REGISTERS * 2;
 
     enum ModbusError: uint8_t {
         ERR_NONE                                    = 0x0,
@@ -36,15 +40,21 @@ namespace Modbus    // modbus protocol declarations
     class TModbusRegisterRange: public TRegisterRange {
     public:
         TModbusRegisterRange(const std::list<PRegister>& regs, bool hasHoles);
-        ~TModbusRegisterRange();
-        void MapRange(TValueCallback value_callback, TErrorCallback error_callback);
         EStatus GetStatus() const override;
         bool NeedsSplit() const override;
+        bool IsRejected() const override;
         int GetStart() const { return Start; }
         int GetCount() const { return Count; }
-        uint8_t* GetBits();
-        uint16_t* GetWords();
-        void SetError(bool error) { Error = error; }
+        // size of the data in a response to reading the range
+        size_t GetDataSize() const;
+        // Decodes the values of the registers from the response data,
+        // or marks them all failed if the range couldn't be read
+        void FinishRead(bool error);
+        // Keeps the data of a response. Returns false if it's the same
+        // as the data of the previous successful read, then it doesn't
+        // have to be decoded again.
+        bool UpdatePayload(const uint8_t* data, size_t size);
+        bool IsUnchanged() const override { return Unchanged; }
         bool GetError() const { return Error; }
         void ResetModbusError() { SetModbusError(ERR_NONE); }
         void SetModbusError(ModbusError error) { ModbusErrorCode = error; }
@@ -52,10 +62,22 @@ namespace Modbus    // modbus protocol declarations
     private:
         bool HasHoles = false;
         bool Error = false;
+        bool Unchanged = false;
         ModbusError ModbusErrorCode = ERR_NONE;
         int Start, Count;
-        uint8_t* Bits = 0;
-        uint16_t* Words = 0;
+        // position of each register of RegisterList() in the response
+        // data, so decoding walks this array instead of following the
+        // pointers: byte offset and number of words for word registers,
+        // byte offset and bit number for coils and discrete inputs
+        struct TSlot {
+            uint16_t Byte;
+            uint8_t Width;
+            uint8_t Bit;
+        };
+        std::vector<TSlot> Slots;
+        // data of the last successful response as it was received (big
+        // endian words or packed bits), empty if the last read failed
+        std::vector<uint8_t> Payload;
     };
 
     using PModbusRegisterRange = std::shared_ptr<TModbusRegisterRange>;
@@ -87,6 +109,58 @@ namespace   // general utilities
     {
         return (type == Modbus::REG_COIL) || (type == Modbus::REG_DISCRETE);
     }
+
+    // registers are sorted by address
+    bool HasHoles(const std::list<PRegister>& regs)
+    {
+        PRegister prev;
+        for (const auto& reg: regs) {
+            if (prev && reg->Address != prev->Address + prev->Width())
+                return true;
+            prev = reg;
+        }
+        return false;
+    }
+
+    inline uint16_t ByteSwap(uint16_t v) { return __builtin_bswap16(v); }
+    inline uint32_t ByteSwap(uint32_t v) { return __builtin_bswap32(v); }
+    inline uint64_t ByteSwap(uint64_t v) { return __builtin_bswap64(v); }
+
+    template<typename T> inline T LoadBigEndian(const uint8_t* data)
+    {
+        T value;
+        memcpy(&value, data, sizeof(T));
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        value = ByteSwap(value);
+#endif
+        return value;
+    }
+
+    // Value of width big endian words, the first word is the most
+    // significant one. Words in this order are a big endian integer,
+    // so it takes a single load and byte swap.
+    inline uint64_t LoadWords(const uint8_t* data, int width)
+    {
+        switch (width) {
+        case 1:
+            return LoadBigEndian<uint16_t>(data);
+        case 2:
+            return LoadBigEndian<uint32_t>(data);
+        case 3:
+            return (uint64_t(LoadBigEndian<uint32_t>(data)) << 16) | LoadBigEndian<uint16_t>(data + 4);
+        case 4:
+            return LoadBigEndian<uint64_t>(data);
+        default:
+            {
+                uint64_t r = 0;
+                while (width--) {
+                    r = (r << 16) + LoadBigEndian<uint16_t>(data);
+                    data += 2;
+                }
+                return r;
+            }
+        }
+    }
 }   // general utilities
 
 
@@ -112,43 +186,65 @@ namespace Modbus    // modbus protocol common utilities
         Count = end - Start;
         if (Count > (IsSingleBitType(Type()) ? MAX_READ_BITS : MAX_READ_REGISTERS))
             throw std::runtime_error("Modbus register range too large");
+
+        Slots.reserve(regs.size());
+        for (const auto& reg: regs) {
+            int offset = reg->Address - Start;
+            if (IsSingleBitType(Type()))
+                Slots.push_back(TSlot{ uint16_t(offset / 8), uint8_t(reg->Width()), uint8_t(offset % 8) });
+            else
+                Slots.push_back(TSlot{ uint16_t(offset * 2), uint8_t(reg->Width()), 0 });
+        }
+        Payload.reserve(GetDataSize());
     }
 
-    void TModbusRegisterRange::MapRange(TValueCallback value_callback, TErrorCallback error_callback)
+    size_t TModbusRegisterRange::GetDataSize() const
     {
+        return IsSingleBitType(Type()) ? (Count + 7) / 8 : Count * 2;
+    }
+
+    bool TModbusRegisterRange::UpdatePayload(const uint8_t* data, size_t size)
+    {
+        Unchanged = !Payload.empty() && Payload.size() == size && std::equal(data, data + size, Payload.begin());
+        if (!Unchanged)
+            Payload.assign(data, data + size);
+        return !Unchanged;
+    }
+
+    void TModbusRegisterRange::FinishRead(bool error)
+    {
+        Error = error;
         if (Error) {
-            for (auto reg: RegisterList())
-                error_callback(reg);
+            Unchanged = false;
+            Payload.clear();
+            Reset();
+            for (size_t i = 0; i < Slots.size(); ++i)
+                SetError(i);
             return;
         }
+
+        // the values decoded from the same data are still there
+        if (Unchanged)
+            return;
+
+        // every value is overwritten below, so only errors need resetting
+        if (ErrorCount())
+            Reset();
+        const uint8_t* data = Payload.data();
         if (IsSingleBitType(Type())) {
-            if (!Bits)
-                throw std::runtime_error("bits not loaded");
-            for (auto reg: RegisterList()) {
-                int w = reg->Width();
-                if (w != 1)
+            for (size_t i = 0; i < Slots.size(); ++i) {
+                const auto& slot = Slots[i];
+                if (slot.Width != 1)
                     throw TSerialDeviceException(
                         "width other than 1 is not currently supported for reg type" +
-                        reg->TypeName);
-                if (reg->Address - Start >= Count)
-                    throw std::runtime_error("address out of range");
-                value_callback(reg, Bits[reg->Address - Start]);
+                        RegisterList()[i]->TypeName);
+                SetValue(i, (data[slot.Byte] >> slot.Bit) & 1);
             }
             return;
         }
 
-        if (!Words)
-            throw std::runtime_error("words not loaded");
-        for (auto reg: RegisterList()) {
-            int w = reg->Width();
-            if (reg->Address - Start + w > Count)
-                throw std::runtime_error("address out of range");
-            uint64_t r = 0;
-            uint16_t* data = Words + (reg->Address - Start);
-            while (w--)
-                r = (r << 16) + *data++;
-            value_callback(reg, r);
-        }
+        for (size_t i = 0; i < Slots.size(); ++i)
+            SetValue(i, LoadWords(data + Slots[i].Byte, Slots[i].Width));
     }
 
     TRegisterRange::EStatus TModbusRegisterRange::GetStatus() const
@@ -168,27 +264,9 @@ namespace Modbus    // modbus protocol common utilities
         }
     }
 
-    TModbusRegisterRange::~TModbusRegisterRange() {
-        if (Bits)
-            delete[] Bits;
-        if (Words)
-            delete[] Words;
-    }
-
-    uint8_t* TModbusRegisterRange::GetBits() {
-        if (!IsSingleBitType(Type()))
-            throw std::runtime_error("GetBits() for non-bit register");
-        if (!Bits)
-            Bits = new uint8_t[Count];
-        return Bits;
-    }
-
-    uint16_t* TModbusRegisterRange::GetWords() {
-        if (IsSingleBitType(Type()))
-            throw std::runtime_error("GetWords() for non-word register");
-        if (!Words)
-            Words = new uint16_t[Count];
-        return Words;
+    bool TModbusRegisterRange::IsRejected() const
+    {
+        return ModbusErrorCode == ERR_ILLEGAL_DATA_ADDRESS || ModbusErrorCode == ERR_ILLEGAL_DATA_VALUE;
     }
 
     const uint8_t EXCEPTION_BIT = 1 << 7;
@@ -289,6 +367,17 @@ namespace Modbus    // modbus protocol common utilities
         return GetFunctionImpl(range->Type(), op, range->TypeName(), IsPacking(range));
     }
 
+    // exception response of the device
+    class TModbusExceptionError: public TSerialDeviceTransientErrorException
+    {
+    public:
+        TModbusExceptionError(const std::string & message, uint8_t code)
+            : TSerialDeviceTransientErrorException(message), Code(code)
+        {}
+
+        uint8_t Code;
+    };
+
     // throws C++ exception on modbus error code
     void ThrowIfModbusException(uint8_t code)
     {
@@ -329,7 +418,7 @@ namespace Modbus    // modbus protocol common utilities
             break;
         }
         if (is_transient) {
-            throw TSerialDeviceTransientErrorException(message);
+            throw TModbusExceptionError(message, code);
         } else {
             throw TSerialDevicePermanentRegisterException(message);
         }
@@ -449,6 +538,48 @@ namespace Modbus    // modbus protocol common utilities
         WriteAs2Bytes(pdu + 3, value);
     }
 
+    // coils and holding registers may be written together with the adjacent ones
+    inline bool IsBlockWritable(PRegister reg)
+    {
+        return reg->Type == REG_COIL || reg->Type == REG_HOLDING || reg->Type == REG_HOLDING_MULTI;
+    }
+
+    // fills pdu with a request that writes registers of the same type
+    // at adjacent addresses, returns the size of the pdu
+    size_t ComposeBlockWriteRequestPDU(uint8_t* pdu, const std::vector<TRegisterWrite*>& block, int shift)
+    {
+        const auto& first = block.front()->Register;
+        int count = 0;
+        for (auto write: block)
+            count += GetQuantity(write->Register);
+
+        pdu[0] = GetFunctionImpl(first->Type, OperationType::OP_WRITE, first->TypeName, true);
+        WriteAs2Bytes(pdu + 1, first->Address + shift);
+        WriteAs2Bytes(pdu + 3, count);
+
+        uint8_t* data = pdu + 6;
+        if (IsSingleBitType(first->Type)) {
+            pdu[5] = (count + 7) / 8;
+            std::fill(data, data + pdu[5], 0);
+            for (size_t i = 0; i < block.size(); ++i) {
+                if (block[i]->Value)
+                    data[i / 8] |= 1 << (i % 8);
+            }
+        } else {
+            pdu[5] = count * 2;
+            for (auto write: block) {
+                int w = write->Register->Width();
+                uint64_t value = write->Value;
+                for (int p = w - 1; p >= 0; --p) {
+                    WriteAs2Bytes(data + p * 2, value & 0xffff);
+                    value >>= 16;
+                }
+                data += w * 2;
+            }
+        }
+        return 6 + pdu[5];
+    }
+
     // parses modbus response and stores result
     void ParseReadResponse(const uint8_t* pdu, PModbusRegisterRange range)
     {
@@ -456,30 +587,11 @@ namespace Modbus    // modbus protocol common utilities
         range->SetModbusError(static_cast<ModbusError>(exception_code));
         ThrowIfModbusException(exception_code);
 
-        uint8_t byte_count = pdu[1];
-
-        auto start = pdu + 2;
-        auto end = start + byte_count;
-        if (IsSingleBitType(range->Type())) {
-            auto destination = range->GetBits();
-            auto coil_count = range->GetCount();
-            while (start != end) {
-                std::bitset<8> coils(*start++);
-                auto coils_in_byte = std::min(coil_count, 8);
-                for (int i = 0; i < coils_in_byte; ++i) {
-                    destination[i] = coils[i];
-                }
-
-                coil_count -= coils_in_byte;
-                destination += coils_in_byte;
-            }
-        } else {
-            auto destination = range->GetWords();
-            for (int i = 0; i < byte_count / 2; ++i) {
-                destination[i] = (*start << 8) | *(start + 1);
-                start += 2;
-            }
-        }
+        // the values are decoded from the kept data in FinishRead()
+        size_t byte_count = pdu[1];
+        if (byte_count < range->GetDataSize())
+            throw TSerialDeviceTransientErrorException("malformed response: not enough data");
+        range->UpdatePayload(pdu + 2, range->GetDataSize());
     }
 
     // checks modbus response on write
@@ -488,59 +600,102 @@ namespace Modbus    // modbus protocol common utilities
         ThrowIfModbusException(GetExceptionCode(pdu));
     }
 
-    std::list<PRegisterRange> SplitRegisterList(const std::list<PRegister> & reg_list, PDeviceConfig deviceConfig, bool debug, bool enableHoles)
+    // costs are in microseconds
+    const double COST_EPSILON = 1e-3;
+
+    // Predicted bus time of reading count registers (or bits) with a single request.
+    // per_byte is the time needed to send a byte, zero if it's unknown.
+    double ReadRequestCost(bool single_bit, int count, double per_byte, PDeviceConfig deviceConfig)
+    {
+        // RTU read request is 8 bytes long, response without data is 5 bytes long,
+        // both are preceded by 3.5 characters of silence
+        double bytes = 8 + 5 + 2 * 3.5 + (single_bit ? std::ceil(count / 8.0) : count * 2);
+        return bytes * per_byte + deviceConfig->GuardInterval.count();
+    }
+
+    double PerByteTime(PPort port)
+    {
+        return port ? port->GetSendTime(1000000).count() / 1000000.0 : 0;
+    }
+
+    // Limits of a single read request: the learned ones if the device
+    // learns them, the configured ones otherwise. Boundaries always apply.
+    TReadLimits EffectiveReadLimits(PDeviceConfig deviceConfig, const TReadLimits& learned)
+    {
+        TReadLimits limits = learned;
+        if (!deviceConfig->AutoReadLimits) {
+            limits.MaxReadRegisters = deviceConfig->MaxReadRegisters;
+            limits.MaxRegHole = deviceConfig->MaxRegHole;
+            limits.MaxBitHole = deviceConfig->MaxBitHole;
+        }
+        if (limits.MaxReadRegisters <= 0 || limits.MaxReadRegisters > MAX_READ_REGISTERS)
+            limits.MaxReadRegisters = MAX_READ_REGISTERS;
+        return limits;
+    }
+
+    std::list<PRegisterRange> SplitRegisterList(const std::list<PRegister> & reg_list, PDeviceConfig deviceConfig,
+                                                PPort port, bool debug, bool enableHoles,
+                                                const TReadLimits& learnedLimits)
     {
         std::list<PRegisterRange> r;
         if (reg_list.empty())
             return r;
 
-        std::list<PRegister> l;
-        int prev_start = -1, prev_type = -1, prev_end = -1;
-        std::chrono::milliseconds prev_interval;
-        int max_hole = enableHoles ? (IsSingleBitType(reg_list.front()->Type) ? deviceConfig->MaxBitHole : deviceConfig->MaxRegHole) : 0;
-        int max_regs;
-
-        if (IsSingleBitType(reg_list.front()->Type)) {
-            max_regs = MAX_READ_BITS;
-        } else {
-            if ((deviceConfig->MaxReadRegisters > 0) && (deviceConfig->MaxReadRegisters <= MAX_READ_REGISTERS)) {
-                max_regs = deviceConfig->MaxReadRegisters;
-            } else {
-                max_regs = MAX_READ_REGISTERS;
+        auto limits = EffectiveReadLimits(deviceConfig, learnedLimits);
+        double per_byte = PerByteTime(port);
+        int max_hole = enableHoles ? (IsSingleBitType(reg_list.front()->Type) ? limits.MaxBitHole : limits.MaxRegHole) : 0;
+        int max_regs = IsSingleBitType(reg_list.front()->Type) ? MAX_READ_BITS : limits.MaxReadRegisters;
+
+        // Registers that may go into the same range are merged only if
+        // reading the holes between them is cheaper than an extra request.
+        // best[i] is the cheapest partition of regs[i..n), it's found
+        // from the end of the list. On equal cost fewer requests win,
+        // then the longer first range, so without the bus model (e.g.
+        // for TCP ports) the registers are merged as much as possible.
+        struct TPartition {
+            double Cost = 0;
+            int Requests = -1;
+            size_t FirstRangeEnd = 0;
+        };
+        std::vector<PRegister> regs(reg_list.begin(), reg_list.end());
+        size_t n = regs.size();
+        std::vector<TPartition> best(n + 1);
+        best[n].Requests = 0;
+        for (size_t i = n; i-- > 0;) {
+            const auto& first = regs[i];
+            bool single_bit = IsSingleBitType(first->Type);
+            int end = first->Address + first->Width();
+            for (size_t j = i + 1;; ++j) {
+                // regs[i..j) as the first range
+                TPartition candidate;
+                candidate.Cost = best[j].Cost + ReadRequestCost(single_bit, end - first->Address, per_byte, deviceConfig);
+                candidate.Requests = best[j].Requests + 1;
+                candidate.FirstRangeEnd = j;
+                // costs are compared with a tolerance as equal partitions
+                // may get slightly different sums
+                if (best[i].Requests < 0 || candidate.Cost < best[i].Cost - COST_EPSILON ||
+                    (candidate.Cost <= best[i].Cost + COST_EPSILON && candidate.Requests <= best[i].Requests))
+                    best[i] = candidate;
+
+                if (j == n)
+                    break;
+                const auto& next = regs[j];
+                int new_end = next->Address + next->Width();
+                if (next->Type != first->Type ||
+                    next->Address < end ||
+                    next->Address > end + max_hole ||
+                    next->PollInterval != first->PollInterval ||
+                    next->Priority != first->Priority ||
+                    new_end - first->Address > max_regs ||
+                    limits.Separates(first->Type, regs[j - 1]->Address, next->Address))
+                    break;
+                end = new_end;
             }
         }
 
-        bool hasHoles = false;
-        for (auto reg: reg_list) {
-            int new_end = reg->Address + reg->Width();
-            if (!(prev_end >= 0 &&
-                reg->Type == prev_type &&
-                reg->Address >= prev_end &&
-                reg->Address <= prev_end + max_hole &&
-                reg->PollInterval == prev_interval &&
-                new_end - prev_start <= max_regs)) {
-                if (!l.empty()) {
-                    auto range = std::make_shared<TModbusRegisterRange>(l, hasHoles);
-                    hasHoles = false;
-                    if (debug)
-                        std::cerr << "Adding range: " << range->GetCount() << " " <<
-                            range->TypeName() << "(s) @ " << range->GetStart() <<
-                            " of device " << range->Device()->ToString() << std::endl;
-                    r.push_back(range);
-                    l.clear();
-                }
-                prev_start = reg->Address;
-                prev_type = reg->Type;
-                prev_interval = reg->PollInterval;
-            }
-            if (!l.empty()) {
-                hasHoles |= (reg->Address != prev_end);
-            }
-            l.push_back(reg);
-            prev_end = new_end;
-        }
-        if (!l.empty()) {
-            auto range = std::make_shared<TModbusRegisterRange>(l, hasHoles);
+        for (size_t i = 0; i < n; i = best[i].FirstRangeEnd) {
+            std::list<PRegister> l(regs.begin() + i, regs.begin() + best[i].FirstRangeEnd);
+            auto range = std::make_shared<TModbusRegisterRange>(l, HasHoles(l));
             if (debug)
                 std::cerr << "Adding range: " << range->GetCount() << " " <<
                     range->TypeName() << "(s) @ " << range->GetStart() <<
@@ -550,9 +705,71 @@ namespace Modbus    // modbus protocol common utilities
         return r;
     }
 
-    std::chrono::microseconds GetFrameTimeout(int baudRate)
+    PReadLimitsProbe NextReadLimitsProbe(const std::list<PRegisterRange>& ranges, PDeviceConfig deviceConfig,
+                                         PPort port, const TReadLimits& learnedLimits)
     {
-        return std::chrono::microseconds(static_cast<int64_t>(std::ceil(static_cast<double>(35000000)/baudRate)));
+        auto limits = EffectiveReadLimits(deviceConfig, learnedLimits);
+        double per_byte = PerByteTime(port);
+
+        std::vector<PModbusRegisterRange> sorted;
+        for (const auto& range: ranges) {
+            auto modbus_range = std::dynamic_pointer_cast<TModbusRegisterRange>(range);
+            if (!modbus_range)
+                throw std::runtime_error("modbus range expected");
+            sorted.push_back(modbus_range);
+        }
+        std::sort(sorted.begin(), sorted.end(), [](const PModbusRegisterRange& a, const PModbusRegisterRange& b) {
+                return a->Type() < b->Type() || (a->Type() == b->Type() && a->GetStart() < b->GetStart());
+            });
+
+        // Try to join adjacent ranges that the current limits keep apart,
+        // the smallest holes first so that the read size is learned before
+        // the hole tolerance, then the smallest ranges. Joining ranges that
+        // wouldn't be read together anyway because of the bus cost of holes
+        // would teach nothing useful.
+        PModbusRegisterRange first, second;
+        int best_hole = 0, best_count = 0;
+        for (size_t i = 1; i < sorted.size(); ++i) {
+            const auto& a = sorted[i - 1];
+            const auto& b = sorted[i];
+            if (a->Type() != b->Type())
+                continue;
+            bool single_bit = IsSingleBitType(a->Type());
+            int hole = b->GetStart() - (a->GetStart() + a->GetCount());
+            int count = b->GetStart() + b->GetCount() - a->GetStart();
+            if (hole < 0 || count > (single_bit ? MAX_READ_BITS : MAX_READ_REGISTERS) ||
+                limits.Separates(a->Type(), a->RegisterList().back()->Address, b->GetStart()))
+                continue;
+            if (hole <= (single_bit ? limits.MaxBitHole : limits.MaxRegHole) &&
+                (single_bit || count <= limits.MaxReadRegisters))
+                continue;
+            if (ReadRequestCost(single_bit, count, per_byte, deviceConfig) >
+                ReadRequestCost(single_bit, a->GetCount(), per_byte, deviceConfig) +
+                ReadRequestCost(single_bit, b->GetCount(), per_byte, deviceConfig) + COST_EPSILON)
+                continue;
+            if (first && std::make_pair(hole, count) >= std::make_pair(best_hole, best_count))
+                continue;
+            first = a;
+            second = b;
+            best_hole = hole;
+            best_count = count;
+        }
+        if (!first)
+            return nullptr;
+
+        std::list<PRegister> regs(first->RegisterList().begin(), first->RegisterList().end());
+        regs.insert(regs.end(), second->RegisterList().begin(), second->RegisterList().end());
+        auto probe = std::make_shared<TReadLimitsProbe>();
+        probe->Range = std::make_shared<TModbusRegisterRange>(regs, HasHoles(regs));
+        probe->Supported = limits;
+        if (IsSingleBitType(first->Type())) {
+            probe->Supported.MaxBitHole = std::max(limits.MaxBitHole, best_hole);
+        } else {
+            probe->Supported.MaxRegHole = std::max(limits.MaxRegHole, best_hole);
+            probe->Supported.MaxReadRegisters = std::max(limits.MaxReadRegisters, best_count);
+        }
+        probe->SplitAddress = second->GetStart();
+        return probe;
     }
 };  // modbus protocol common utilities
 
@@ -581,6 +798,18 @@ namespace ModbusRTU // modbus rtu protocol utilities
     const size_t DATA_SIZE = 3;  // number of bytes in ADU that is not in PDU (slaveID (1b) + crc value (2b))
     const std::chrono::milliseconds FrameTimeout(500);   // libmodbus default
 
+    // The frame timeout of the device if it's set. Otherwise serial ports
+    // derive it from their line settings, the ports that don't know them
+    // use the libmodbus default.
+    std::chrono::microseconds GetFrameTimeout(PPort port, PDeviceConfig config)
+    {
+        if (config->FrameTimeout.count() >= 0)
+            return config->FrameTimeout;
+        if (port->GetSendTime(1) == std::chrono::microseconds::zero())
+            return FrameTimeout;
+        return std::chrono::microseconds(-1);
+    }
+
     // get pointer to PDU in message
     template <class T>
     inline const uint8_t* PDU(const T& msg)
@@ -681,6 +910,40 @@ namespace ModbusRTU // modbus rtu protocol utilities
         }
     }
 
+    // sends the write request and checks the response, returns false if there's none
+    bool SendWriteRequest(PPort port, PDeviceConfig config, const TWriteRequest & request)
+    {
+        if (config->GuardInterval.count()) {
+            port->SleepSinceLastInteraction(config->GuardInterval);
+        }
+        port->WriteBytes(request.data(), request.size());
+
+        TWriteResponse response;
+        auto frame_timeout = GetFrameTimeout(port, config);
+        if (port->ReadFrame(response.data(), response.size(), frame_timeout, ExpectNBytes(response.size())) <= 0)
+            return false;
+
+        try {
+            ModbusRTU::CheckResponse(request, response);
+            Modbus::ParseWriteResponse(PDU(response));
+        } catch (const TInvalidCRCError &) {
+            try {
+                port->SkipNoise();
+            } catch (const std::exception & e) {
+                std::cerr << "SkipNoise failed: " << e.what() << std::endl;
+            }
+            throw;
+        } catch (const TMalformedResponseError &) {
+            try {
+                port->SkipNoise();
+            } catch (const std::exception & e) {
+                std::cerr << "SkipNoise failed: " << e.what() << std::endl;
+            }
+            throw;
+        }
+        return true;
+    }
+
     void WriteRegister(PPort port, uint8_t slaveId, PRegister reg, uint64_t value, int shift)
     {
         int w = reg->Width();
@@ -697,39 +960,8 @@ namespace ModbusRTU // modbus rtu protocol utilities
             ComposeWriteRequests(requests, reg, slaveId, value, shift);
 
             for (const auto & request: requests) {
-                // Send request
-                if (config->GuardInterval.count()) {
-                    port->Sleep(config->GuardInterval);
-                }
-                port->WriteBytes(request.data(), request.size());
-
-                {   // Receive response
-                    TWriteResponse response;
-                    auto frame_timeout = config->FrameTimeout.count() < 0 ? FrameTimeout: config->FrameTimeout;
-
-                    if (port->ReadFrame(response.data(), response.size(), frame_timeout, ExpectNBytes(response.size())) > 0) {
-                        try {
-                            ModbusRTU::CheckResponse(request, response);
-                            Modbus::ParseWriteResponse(PDU(response));
-                        } catch (const TInvalidCRCError &) {
-                            try {
-                                port->SkipNoise();
-                            } catch (const std::exception & e) {
-                                std::cerr << "SkipNoise failed: " << e.what() << std::endl;
-                            }
-                            throw;
-                        } catch (const TMalformedResponseError &) {
-                            try {
-                                port->SkipNoise();
-                            } catch (const std::exception & e) {
-                                std::cerr << "SkipNoise failed: " << e.what() << std::endl;
-                            }
-                            throw;
-                        }
-                    } else {
-                        break;
-                    }
-                }
+                if (!SendWriteRequest(port, config, request))
+                    break;
             }
             return;
         } catch (TSerialDeviceTransientErrorException& e) {
@@ -742,6 +974,116 @@ namespace ModbusRTU // modbus rtu protocol utilities
             " @ " + std::to_string(reg->Address) + exception_message);
     }
 
+    enum EBlockWriteResult {
+        BLOCK_WRITTEN,
+        // the device has answered with an exception, e.g. it's busy
+        BLOCK_REJECTED,
+        // the device doesn't support multiple write requests
+        BLOCK_UNSUPPORTED
+    };
+
+    // Writes registers of the same type at adjacent addresses with a
+    // single request. Errors other than exception responses are stored
+    // in the writes.
+    EBlockWriteResult WriteBlock(PPort port, uint8_t slaveId, const std::vector<TRegisterWrite*>& block, int shift)
+    {
+        const auto& first = block.front()->Register;
+        auto config = first->Device()->DeviceConfig();
+
+        TWriteRequest request(Modbus::MAX_WRITE_REQUEST_PDU_SIZE + DATA_SIZE);
+        request[0] = slaveId;
+        auto pdu_size = Modbus::ComposeBlockWriteRequestPDU(PDU(request), block, shift);
+        request.resize(pdu_size + DATA_SIZE);
+        WriteAs2Bytes(&request[pdu_size + 1], CRC16::CalculateCRC16(request.data(), pdu_size + 1));
+
+        if (port->Debug())
+            std::cerr << "modbus: write " << block.size() << " " << first->TypeName << "(s) @ " << first->Address <<
+                " of device " << first->Device()->ToString() << std::endl;
+
+        try {
+            SendWriteRequest(port, config, request);
+        } catch (const Modbus::TModbusExceptionError& e) {
+            bool unsupported = e.Code == Modbus::ERR_ILLEGAL_FUNCTION;
+            std::cerr << "ModbusRTU::WriteBlock(): device " << first->Device()->ToString() <<
+                " rejected writing multiple " << first->TypeName << "s (" << e.what() <<
+                "), writing them one by one" << (unsupported ? "" : " this time") << std::endl;
+            return unsupported ? BLOCK_UNSUPPORTED : BLOCK_REJECTED;
+        } catch (const TSerialDeviceTransientErrorException& e) {
+            std::string error = "failed to write " + std::to_string(block.size()) + " " + first->TypeName +
+                "(s) @ " + std::to_string(first->Address) + ": " + e.what();
+            for (auto write: block)
+                write->Error = error;
+        }
+        return BLOCK_WRITTEN;
+    }
+
+    void WriteRegisters(PPort port, uint8_t slaveId, std::vector<TRegisterWrite>& writes, bool& writeBlocks, int shift)
+    {
+        std::vector<TRegisterWrite*> sorted;
+        for (auto& write: writes)
+            sorted.push_back(&write);
+        std::stable_sort(sorted.begin(), sorted.end(), [](const TRegisterWrite* a, const TRegisterWrite* b) {
+                return a->Register->Type < b->Register->Type ||
+                    (a->Register->Type == b->Register->Type && a->Register->Address < b->Register->Address);
+            });
+
+        // blocks of adjacent registers, written in the order of
+        // their first values
+        std::vector<std::vector<TRegisterWrite*>> blocks;
+        for (size_t start = 0, end; start < sorted.size(); start = end) {
+            const auto& first = sorted[start]->Register;
+            end = start + 1;
+            if (writeBlocks && Modbus::IsBlockWritable(first)) {
+                int max_count = IsSingleBitType(first->Type) ? Modbus::MAX_WRITE_BITS : Modbus::MAX_WRITE_REGISTERS;
+                int count = Modbus::GetQuantity(first);
+                for (; end < sorted.size(); ++end) {
+                    const auto& prev = sorted[end - 1]->Register;
+                    const auto& reg = sorted[end]->Register;
+                    int quantity = Modbus::GetQuantity(reg);
+                    if (reg->Type != first->Type || reg->Address != prev->Address + Modbus::GetQuantity(prev) ||
+                        count + quantity > max_count)
+                        break;
+                    count += quantity;
+                }
+            }
+
+            blocks.emplace_back(sorted.begin() + start, sorted.begin() + end);
+        }
+        std::sort(blocks.begin(), blocks.end(), [](const std::vector<TRegisterWrite*>& a, const std::vector<TRegisterWrite*>& b) {
+                return *std::min_element(a.begin(), a.end()) < *std::min_element(b.begin(), b.end());
+            });
+
+        for (const auto& block: blocks) {
+            if (block.size() > 1 && writeBlocks) {
+                auto result = WriteBlock(port, slaveId, block, shift);
+                if (result == BLOCK_WRITTEN)
+                    continue;
+                if (result == BLOCK_UNSUPPORTED)
+                    writeBlocks = false;
+            }
+            for (auto write: block) {
+                try {
+                    WriteRegister(port, slaveId, write->Register, write->Value, shift);
+                } catch (const TSerialDeviceTransientErrorException& e) {
+                    write->Error = e.what();
+                }
+            }
+        }
+    }
+
+    std::chrono::microseconds EstimateReadDuration(PPort port, PRegisterRange range)
+    {
+        auto modbus_range = std::dynamic_pointer_cast<Modbus::TModbusRegisterRange>(range);
+        if (!modbus_range) {
+            throw std::runtime_error("modbus range expected");
+        }
+
+        auto send_time = port->GetSendTime(std::tuple_size<TReadRequest>::value + InferReadResponseSize(modbus_range));
+        if (send_time == std::chrono::microseconds::zero())
+            return send_time;
+        return send_time + modbus_range->Device()->DeviceConfig()->GuardInterval;
+    }
+
     void ReadRegisterRange(PPort port, uint8_t slaveId, PRegisterRange range, int shift)
     {
         auto modbus_range = std::dynamic_pointer_cast<Modbus::TModbusRegisterRange>(range);
@@ -761,7 +1103,7 @@ namespace ModbusRTU // modbus rtu protocol utilities
                 " of device " << modbus_range->Device()->ToString() << std::endl;
 
         if (config->GuardInterval.count()){
-            port->Sleep(config->GuardInterval);
+            port->SleepSinceLastInteraction(config->GuardInterval);
         }
 
         std::string exception_message;
@@ -776,7 +1118,7 @@ namespace ModbusRTU // modbus rtu protocol utilities
             {   // Receive response
                 auto byte_count = InferReadResponseSize(modbus_range);
                 TReadResponse response(byte_count);
-                auto frame_timeout = config->FrameTimeout.count() < 0 ? FrameTimeout: config->FrameTimeout;
+                auto frame_timeout = GetFrameTimeout(port, config);
 
                 auto rc = port->ReadFrame(response.data(), response.size(), frame_timeout, ExpectNBytes(response.size()));
                 if (rc > 0) {
@@ -798,7 +1140,7 @@ namespace ModbusRTU // modbus rtu protocol utilities
                         }
                         throw;
                     }
-                    modbus_range->SetError(false);
+                    modbus_range->FinishRead(false);
                     return;
                 }
             }
@@ -806,7 +1148,7 @@ namespace ModbusRTU // modbus rtu protocol utilities
             exception_message = e.what();
         }
 
-        modbus_range->SetError(true);
+        modbus_range->FinishRead(true);
         std::ios::fmtflags f(std::cerr.flags());
         std::cerr << "ModbusRTU::ReadRegisterRange(): failed to read " << modbus_range->GetCount() << " " <<
             modbus_range->TypeName() << "(s) @ " << modbus_range->GetStart() <<
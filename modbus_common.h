@@ -3,8 +3,8 @@
 #include "port.h"
 #include "serial_config.h"
 #include "register.h"
+#include "serial_device.h"
 #include <ostream>
-#include <bitset>
 #include <array>
 
 
@@ -19,12 +19,31 @@ namespace Modbus  // modbus protocol common utilities
         REG_HOLDING_MULTI,
     };
 
-    std::list<PRegisterRange> SplitRegisterList(const std::list<PRegister> & reg_list, PDeviceConfig deviceConfig, bool debug, bool enableHoles);
+    // Split registers into ranges minimizing predicted bus time of reading
+    // them, according to the line settings of the port (may be null).
+    // learnedLimits are used instead of the configured ones if the device
+    // learns its read limits.
+    std::list<PRegisterRange> SplitRegisterList(const std::list<PRegister> & reg_list, PDeviceConfig deviceConfig,
+                                                PPort port, bool debug, bool enableHoles,
+                                                const TReadLimits& learnedLimits = TReadLimits());
+
+    // see TSerialDevice::NextReadLimitsProbe()
+    PReadLimitsProbe NextReadLimitsProbe(const std::list<PRegisterRange>& ranges, PDeviceConfig deviceConfig,
+                                         PPort port, const TReadLimits& learnedLimits);
 };  // modbus protocol common utilities
 
 namespace ModbusRTU // modbus rtu protocol utilities
 {
     void WriteRegister(PPort port, uint8_t slaveId, PRegister reg, uint64_t value, int shift = 0);
 
+    // Write coils and holding registers at adjacent addresses with
+    // multiple write requests while writeBlocks is set. If the device
+    // answers such a request with an exception, the registers are
+    // written one by one, and writeBlocks is reset if the exception is
+    // illegal function.
+    void WriteRegisters(PPort port, uint8_t slaveId, std::vector<TRegisterWrite>& writes, bool& writeBlocks, int shift = 0);
+
     void ReadRegisterRange(PPort port, uint8_t slaveId, PRegisterRange range, int shift = 0);
+
+    std::chrono::microseconds EstimateReadDuration(PPort port, PRegisterRange range);
 };  // modbus rtu protocol utilities
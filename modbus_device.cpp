@@ -20,7 +20,12 @@ TModbusDevice::TModbusDevice(PDeviceConfig config, PPort port, PProtocol protoco
 
 std::list<PRegisterRange> TModbusDevice::SplitRegisterList(const std::list<PRegister> & reg_list, bool enableHoles) const
 {
-    return Modbus::SplitRegisterList(reg_list, DeviceConfig(), Port()->Debug(), enableHoles);
+    return Modbus::SplitRegisterList(reg_list, DeviceConfig(), Port(), Port()->Debug(), enableHoles, ReadLimits());
+}
+
+PReadLimitsProbe TModbusDevice::NextReadLimitsProbe(const std::list<PRegisterRange>& ranges) const
+{
+    return Modbus::NextReadLimitsProbe(ranges, DeviceConfig(), Port(), ReadLimits());
 }
 
 uint64_t TModbusDevice::ReadRegister(PRegister reg)
@@ -33,7 +38,17 @@ void TModbusDevice::WriteRegister(PRegister reg, uint64_t value)
     ModbusRTU::WriteRegister(Port(), SlaveId, reg, value);
 }
 
+void TModbusDevice::WriteRegisters(std::vector<TRegisterWrite>& writes)
+{
+    ModbusRTU::WriteRegisters(Port(), SlaveId, writes, WriteBlocks);
+}
+
 void TModbusDevice::ReadRegisterRange(PRegisterRange range)
 {
     ModbusRTU::ReadRegisterRange(Port(), SlaveId, range);
 }
+
+std::chrono::microseconds TModbusDevice::EstimateReadDuration(PRegisterRange range) const
+{
+    return ModbusRTU::EstimateReadDuration(Port(), range);
+}
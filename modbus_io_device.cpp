@@ -20,7 +20,12 @@ TModbusIODevice::TModbusIODevice(PDeviceConfig config, PPort port, PProtocol pro
 
 std::list<PRegisterRange> TModbusIODevice::SplitRegisterList(const std::list<PRegister> & reg_list, bool enableHoles) const
 {
-    return Modbus::SplitRegisterList(reg_list, DeviceConfig(), Port()->Debug(), enableHoles);
+    return Modbus::SplitRegisterList(reg_list, DeviceConfig(), Port(), Port()->Debug(), enableHoles, ReadLimits());
+}
+
+PReadLimitsProbe TModbusIODevice::NextReadLimitsProbe(const std::list<PRegisterRange>& ranges) const
+{
+    return Modbus::NextReadLimitsProbe(ranges, DeviceConfig(), Port(), ReadLimits());
 }
 
 uint64_t TModbusIODevice::ReadRegister(PRegister reg)
@@ -33,7 +38,17 @@ void TModbusIODevice::WriteRegister(PRegister reg, uint64_t value)
     ModbusRTU::WriteRegister(Port(), SlaveId.Primary, reg, value, Shift);
 }
 
+void TModbusIODevice::WriteRegisters(std::vector<TRegisterWrite>& writes)
+{
+    ModbusRTU::WriteRegisters(Port(), SlaveId.Primary, writes, WriteBlocks, Shift);
+}
+
 void TModbusIODevice::ReadRegisterRange(PRegisterRange range)
 {
     ModbusRTU::ReadRegisterRange(Port(), SlaveId.Primary, range, Shift);
 }
+
+std::chrono::microseconds TModbusIODevice::EstimateReadDuration(PRegisterRange range) const
+{
+    return ModbusRTU::EstimateReadDuration(Port(), range);
+}
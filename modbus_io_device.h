@@ -6,10 +6,15 @@ class TModbusIODevice : public TBasicProtocolSerialDevice<TBasicProtocol<TModbus
 public:
     TModbusIODevice(PDeviceConfig config, PPort port, PProtocol protocol);
     std::list<PRegisterRange> SplitRegisterList(const std::list<PRegister> & reg_list, bool enableHoles = true) const override;
+    PReadLimitsProbe NextReadLimitsProbe(const std::list<PRegisterRange>& ranges) const override;
     uint64_t ReadRegister(PRegister reg) override;
     void WriteRegister(PRegister reg, uint64_t value) override;
+    void WriteRegisters(std::vector<TRegisterWrite>& writes) override;
     void ReadRegisterRange(PRegisterRange range) override;
+    std::chrono::microseconds EstimateReadDuration(PRegisterRange range) const override;
 
 private:
     int Shift;
+    // cleared when the device rejects writing multiple registers at once
+    bool WriteBlocks = true;
 };
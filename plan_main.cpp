@@ -0,0 +1,166 @@
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <climits>
+#include <limits>
+#include <cstdio>
+#include <cstdlib>
+#include <getopt.h>
+
+#include "poll_simulator.h"
+
+using namespace std;
+
+namespace {
+    // parses "value" or "device_id:value", the value must be in [0, max]
+    bool ParseModelArg(const string& arg, double max, string& device_id, double& value)
+    {
+        auto pos = arg.rfind(':');
+        device_id = pos == string::npos ? "" : arg.substr(0, pos);
+        try {
+            value = stod(pos == string::npos ? arg : arg.substr(pos + 1));
+        } catch (const exception&) {
+            return false;
+        }
+        return value >= 0 && value <= max;
+    }
+
+    // parses a non-negative integer up to max
+    bool ParseCountArg(const string& arg, unsigned long max, unsigned long& value)
+    {
+        // stoul() takes negative numbers, wrapping them around
+        if (arg.find('-') != string::npos)
+            return false;
+        size_t end;
+        try {
+            value = stoul(arg, &end);
+        } catch (const exception&) {
+            return false;
+        }
+        return end == arg.size() && value <= max;
+    }
+
+    void PrintReport(const TPollSimulator::TReport& report)
+    {
+        cout << "Port " << report.Port << endl;
+        cout << "  simulated time: " << report.Duration.count() / 1000000.0 << " s" << endl;
+        cout << "  predicted bus load: " << lround(report.PredictedLoad * 100) << "%" << endl;
+        if (report.IntervalScale != 1)
+            cout << "  poll intervals stretched by " << lround(report.IntervalScale * 100) / 100.0 << " times" << endl;
+        cout << "  bus utilization: " << lround(report.Utilization * 100) << "%" << endl;
+        cout << "  " << left << setw(40) << "channel" << right << setw(12) << "desired ms" <<
+            setw(12) << "achieved ms" << setw(10) << "polls" << setw(18) << "max staleness ms" << endl;
+        for (const auto& channel: report.Channels) {
+            cout << "  " << left << setw(40) << channel.Name << right <<
+                setw(12) << channel.DesiredInterval.count() << setw(12);
+            if (channel.Polls) {
+                // formatted separately, so the precision doesn't stick to cout
+                ostringstream achieved;
+                achieved << fixed << setprecision(1) << channel.AchievedInterval.count() / 1000.0;
+                cout << achieved.str();
+            } else
+                cout << "-";
+            cout << setw(10) << channel.Polls << setw(18) << channel.MaxStaleness.count() / 1000 << endl;
+        }
+    }
+};
+
+int main(int argc, char *argv[])
+{
+    string templates_folder = "/usr/share/wb-mqtt-serial/templates";
+    string config_fname;
+    int duration_s = 60;
+    unsigned seed = 0;
+    // device id -> value, empty id is for all devices
+    map<string, double> latencies, error_rates;
+
+    int c;
+    while ( (c = getopt(argc, argv, "c:T:t:l:e:s:")) != -1) {
+        string device_id;
+        double value;
+        unsigned long count;
+        switch (c) {
+        case 'c':
+            config_fname = optarg;
+            break;
+        case 'T':
+            templates_folder = optarg;
+            break;
+        case 't':
+        case 's':
+            if (!ParseCountArg(optarg, c == 't' ? INT_MAX : UINT_MAX, count)) {
+                cerr << "invalid value: " << optarg << endl;
+                return 1;
+            }
+            if (c == 't')
+                duration_s = count;
+            else
+                seed = count;
+            break;
+        case 'l':
+        case 'e':
+            // -e is a percentage, -l is only bounded by the type
+            if (!ParseModelArg(optarg, c == 'e' ? 100 : numeric_limits<double>::max(), device_id, value)) {
+                cerr << "invalid value: " << optarg << endl;
+                return 1;
+            }
+            (c == 'l' ? latencies : error_rates)[device_id] = value;
+            break;
+        case '?':
+        default:
+            printf("Usage:\n wb-mqtt-serial-plan [options] -c config\n");
+            printf("Options:\n");
+            printf("\t-c config          \t\t config file\n");
+            printf("\t-T dir             \t\t device templates directory (default: %s)\n", templates_folder.c_str());
+            printf("\t-t SECONDS         \t\t time to simulate (default: %d)\n", duration_s);
+            printf("\t-l [DEVICE_ID:]MS  \t\t response latency of all devices or of the given one (default: 0)\n");
+            printf("\t-e [DEVICE_ID:]PCT \t\t percentage of failed requests (default: 0)\n");
+            printf("\t-s SEED            \t\t random seed for the error model\n");
+            return 1;
+        }
+    }
+
+    // per device options override the default ones
+    // only for the parameters that were given
+    map<string, TSimulatedDeviceModel> models;
+    models[""];
+    for (const auto& p: latencies)
+        models[p.first];
+    for (const auto& p: error_rates)
+        models[p.first];
+    for (auto& p: models) {
+        for (const auto& id: { string(), p.first }) {
+            if (latencies.count(id))
+                p.second.Latency = chrono::microseconds(llround(latencies[id] * 1000));
+            if (error_rates.count(id))
+                p.second.ErrorRate = error_rates[id] / 100;
+        }
+    }
+
+    PHandlerConfig handler_config;
+    try {
+        TConfigTemplateParser device_parser(templates_folder, false);
+        TConfigParser parser(config_fname, false, TSerialDeviceFactory::GetRegisterTypes,
+                             device_parser.Parse());
+        handler_config = parser.Parse();
+    } catch (const TConfigParserException& e) {
+        cerr << "FATAL: " << e.what() << endl;
+        return 1;
+    }
+
+    try {
+        for (const auto& port_config: handler_config->PortConfigs) {
+            TPollSimulator simulator(port_config, seed);
+            simulator.SetDefaultModel(models[""]);
+            for (const auto& p: models) {
+                if (!p.first.empty())
+                    simulator.SetDeviceModel(p.first, p.second);
+            }
+            PrintReport(simulator.Run(chrono::seconds(duration_s)));
+        }
+    } catch (const TSerialDeviceException& e) {
+        cerr << "FATAL: " << e.what() << endl;
+        return 1;
+    }
+    return 0;
+}
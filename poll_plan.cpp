@@ -1,13 +1,97 @@
 #include "poll_plan.h"
 
+#include <algorithm>
+#include <map>
+
 #undef POLL_PLAN_DEBUG
 
 #ifdef POLL_PLAN_DEBUG
 #include <iostream>
 #endif
 
-void TPollPlan::TQueueItem::Update(const std::chrono::milliseconds& new_interval,
-                                   const std::chrono::milliseconds& request_duration)
+// Compare follows std::priority_queue convention: Compare(a, b) is
+// true when a must be placed below b, so the top is the 'greatest' item.
+template<class Compare, size_t TPollPlan::TQueueItem::*Pos>
+void TPollPlan::THeap<Compare, Pos>::Place(TQueueItem* item, size_t pos)
+{
+    Items[pos] = item;
+    item->*Pos = pos;
+}
+
+template<class Compare, size_t TPollPlan::TQueueItem::*Pos>
+void TPollPlan::THeap<Compare, Pos>::SiftUp(size_t pos)
+{
+    TQueueItem* item = Items[pos];
+    while (pos > 0) {
+        size_t parent = (pos - 1) / 2;
+        if (!Compare()(Items[parent], item))
+            break;
+        Place(Items[parent], pos);
+        pos = parent;
+    }
+    Place(item, pos);
+}
+
+template<class Compare, size_t TPollPlan::TQueueItem::*Pos>
+void TPollPlan::THeap<Compare, Pos>::SiftDown(size_t pos)
+{
+    TQueueItem* item = Items[pos];
+    size_t n = Items.size();
+    for (;;) {
+        size_t child = pos * 2 + 1;
+        if (child >= n)
+            break;
+        if (child + 1 < n && Compare()(Items[child], Items[child + 1]))
+            ++child;
+        if (!Compare()(item, Items[child]))
+            break;
+        Place(Items[child], pos);
+        pos = child;
+    }
+    Place(item, pos);
+}
+
+template<class Compare, size_t TPollPlan::TQueueItem::*Pos>
+void TPollPlan::THeap<Compare, Pos>::Push(TQueueItem* item)
+{
+    Items.push_back(item);
+    SiftUp(Items.size() - 1);
+}
+
+template<class Compare, size_t TPollPlan::TQueueItem::*Pos>
+TPollPlan::TQueueItem* TPollPlan::THeap<Compare, Pos>::Pop()
+{
+    TQueueItem* top = Items.front();
+    Remove(top);
+    return top;
+}
+
+template<class Compare, size_t TPollPlan::TQueueItem::*Pos>
+void TPollPlan::THeap<Compare, Pos>::Remove(TQueueItem* item)
+{
+    size_t pos = item->*Pos;
+    TQueueItem* last = Items.back();
+    Items.pop_back();
+    if (last == item)
+        return;
+    Place(last, pos);
+    Update(last);
+}
+
+template<class Compare, size_t TPollPlan::TQueueItem::*Pos>
+void TPollPlan::THeap<Compare, Pos>::Update(TQueueItem* item)
+{
+    size_t pos = item->*Pos;
+    if (pos > 0 && Compare()(Items[(pos - 1) / 2], item))
+        SiftUp(pos);
+    else
+        SiftDown(pos);
+}
+
+void TPollPlan::TQueueItem::Update(const TTimePoint& current_time,
+                                   const std::chrono::milliseconds& new_interval,
+                                   const std::chrono::milliseconds& request_duration,
+                                   bool grid)
 {
     // http://www.daycounter.com/LabBook/Moving-Average.phtml
     PollCountAtLeast++;
@@ -20,22 +104,35 @@ void TPollPlan::TQueueItem::Update(const std::chrono::milliseconds& new_interval
         AvgPollInterval = PollIntervalSum / PollCountAtLeast;
     }
     RequestDuration = request_duration;
+    MissedIntervals = 0;
 
 #ifdef POLL_PLAN_DEBUG
     std::cout << "Poll interval " << PollInterval.count() << ": CurrentTime is " <<
-        std::chrono::duration_cast<std::chrono::milliseconds>(CurrentTime->time_since_epoch()).count() <<
+        std::chrono::duration_cast<std::chrono::milliseconds>(current_time.time_since_epoch()).count() <<
         ". Was scheduled at " <<
         std::chrono::duration_cast<std::chrono::milliseconds>(DueAt.time_since_epoch()).count() <<
         ". Rescheduling to " <<
-        std::chrono::duration_cast<std::chrono::milliseconds>((*CurrentTime + PollInterval).time_since_epoch()).count() <<
+        std::chrono::duration_cast<std::chrono::milliseconds>((current_time + PollInterval).time_since_epoch()).count() <<
         std::endl;
 #endif
-    DueAt = *CurrentTime + PollInterval;
+    if (!grid || PollInterval == std::chrono::milliseconds::zero()) {
+        DueAt = current_time + PollInterval;
+        return;
+    }
+
+    DueAt += PollInterval;
+    if (DueAt <= current_time) {
+        // More than a whole period late. The poll that was just done
+        // catches up for the missed slots, skip them instead of
+        // bursting through.
+        DueAt += ((current_time - DueAt) / PollInterval + 1) * PollInterval;
+    }
 }
 
-int TPollPlan::TQueueItem::Importance() const
+long long TPollPlan::TQueueItem::Importance(const TTimePoint& current_time,
+                                           const std::chrono::milliseconds& avg_request_duration) const
 {
-    long long v = std::chrono::duration_cast<std::chrono::milliseconds>(*CurrentTime - DueAt).count() * 1000;
+    long long v = std::chrono::duration_cast<std::chrono::milliseconds>(current_time - DueAt).count() * 1000;
     if (PollInterval != std::chrono::milliseconds::zero()) {
         // the longer is poll interval, the lower is priority
         v /= PollInterval.count();
@@ -46,11 +143,14 @@ int TPollPlan::TQueueItem::Importance() const
             v /= PollInterval.count();
         }
     }
-    if (RequestDuration != std::chrono::milliseconds::zero() &&
-        *AvgRequestDuration != std::chrono::milliseconds::zero()) {
+    // until the entry is polled for the first time, rely on the bus model
+    auto request_duration = PollCountAtLeast ? RequestDuration :
+        std::chrono::duration_cast<std::chrono::milliseconds>(PredictedDuration);
+    if (request_duration != std::chrono::milliseconds::zero() &&
+        avg_request_duration != std::chrono::milliseconds::zero()) {
         // requests that require more time have lower priority
-        v *= AvgRequestDuration->count();
-        v /= RequestDuration.count();
+        v *= avg_request_duration.count();
+        v /= request_duration.count();
     }
     return v;
 }
@@ -60,43 +160,311 @@ TPollPlan::TPollPlan(TClockFunc clock_func): ClockFunc(clock_func)
     CurrentTime = ClockFunc();
 }
 
-void TPollPlan::AddEntry(const PPollEntry& entry)
+void TPollPlan::LoadEntryProperties(TQueueItem* item)
+{
+    const auto& entry = item->Entry;
+    item->PollInterval = std::chrono::milliseconds(
+        static_cast<long long>(entry->PollInterval().count() * IntervalScale));
+    item->PredictedDuration = entry->PredictedDuration();
+    item->Group = entry->Group();
+    item->SwitchCost = entry->SwitchCost();
+    item->Class = static_cast<int>(entry->PriorityClass());
+}
+
+TPollPlan::THandle TPollPlan::AddEntry(const PPollEntry& entry)
+{
+    auto item = new TQueueItem(entry, CurrentTime, NextIndex++);
+    LoadEntryProperties(item);
+    item->ItemPos = Items.size();
+    Items.emplace_back(item);
+    Queue.Reserve(Items.size());
+    for (auto& heap: PendingItems)
+        heap.Reserve(Items.size());
+    Parked.Reserve(Items.size());
+    Baseline.Reserve(Items.size());
+    AddToGroup(item->Group);
+    Queue.Push(item);
+    NeedsStagger = Grid;
+    return item;
+}
+
+void TPollPlan::RemoveEntry(THandle item)
+{
+    if (item->IsParked)
+        Parked.Remove(item);
+    else if (item->IsPending)
+        RemovePending(item);
+    else
+        Queue.Remove(item);
+
+    RemoveFromGroup(item->Group);
+    if (LastGroup == item->Group)
+        LastGroup = nullptr;
+
+    // the last item takes the place of the removed one
+    size_t pos = item->ItemPos;
+    Items[pos] = std::move(Items.back());
+    Items[pos]->ItemPos = pos;
+    Items.pop_back();
+}
+
+void TPollPlan::UpdateEntry(THandle item)
 {
-    Queue.emplace(std::make_shared<TQueueItem>(&CurrentTime, &AvgRequestDuration, entry, Queue.size()));
+    if (item->IsPending) {
+        RemovePending(item);
+        Queue.Push(item);
+    }
+
+    auto old_interval = item->PollInterval;
+    auto old_group = item->Group;
+    LoadEntryProperties(item);
+    if (item->Group != old_group) {
+        AddToGroup(item->Group);
+        RemoveFromGroup(old_group);
+    }
+    if (item->PollInterval != old_interval) {
+        if (item->PollCountAtLeast) {
+            // DueAt is based on the previous poll (or grid point),
+            // so just move it by the difference
+            item->DueAt += item->PollInterval - old_interval;
+        }
+        item->PollIntervalSum = std::chrono::milliseconds::zero();
+        item->AvgPollInterval = std::chrono::milliseconds::zero();
+        item->PollCountAtLeast = std::min(item->PollCountAtLeast, 1);
+    }
+
+    if (item->IsParked)
+        Parked.Update(item);
+    else
+        Queue.Update(item);
+}
+
+void TPollPlan::RestorePending()
+{
+    // Items are left pending if the callback has thrown or the pass
+    // was preempted. Put them back so they get new priorities.
+    for (auto& heap: PendingItems) {
+        while (!heap.Empty()) {
+            auto item = heap.Top();
+            RemovePending(item);
+            Queue.Push(item);
+        }
+    }
+}
+
+bool TPollPlan::HasPending() const
+{
+    for (const auto& heap: PendingItems) {
+        if (!heap.Empty())
+            return true;
+    }
+    return false;
+}
+
+void TPollPlan::PushPending(TQueueItem* item)
+{
+    auto& heap = PendingItems[item->Class];
+    if (heap.Empty()) {
+        // A class that was idle doesn't get credit for the time
+        // it didn't use, otherwise it would monopolize the bus
+        auto& state = Classes[item->Class];
+        state.VirtualTime = std::max(state.VirtualTime, SystemVirtualTime);
+    }
+    heap.Push(item);
+    item->IsPending = true;
+    if (item->Group)
+        Groups.at(item->Group).Pending.Push(item);
+}
+
+void TPollPlan::RemovePending(TQueueItem* item)
+{
+    PendingItems[item->Class].Remove(item);
+    item->IsPending = false;
+    if (item->Group)
+        Groups.at(item->Group).Pending.Remove(item);
+}
+
+void TPollPlan::AddToGroup(const void* group)
+{
+    if (!group)
+        return;
+    auto& state = Groups[group];
+    state.Pending.Reserve(++state.EntryCount);
+}
+
+void TPollPlan::RemoveFromGroup(const void* group)
+{
+    if (!group)
+        return;
+    auto it = Groups.find(group);
+    if (!--it->second.EntryCount)
+        Groups.erase(it);
+}
+
+int TPollPlan::PickClass() const
+{
+    int best = -1;
+    for (int cls = 0; cls < PRIORITY_CLASS_COUNT; ++cls) {
+        if (PendingItems[cls].Empty())
+            continue;
+        if (cls == static_cast<int>(EPriorityClass::Background) &&
+            !PendingItems[static_cast<int>(EPriorityClass::Realtime)].Empty())
+            continue;
+        // On equal virtual time (e.g. if requests take no measurable
+        // time) fall back to importance of the entries
+        if (best < 0 || Classes[cls].VirtualTime < Classes[best].VirtualTime ||
+            (Classes[cls].VirtualTime == Classes[best].VirtualTime &&
+             LessImportantThan()(PendingItems[best].Top(), PendingItems[cls].Top())))
+            best = cls;
+    }
+    return best;
+}
+
+bool TPollPlan::PreemptedByDueEntry() const
+{
+    if (Queue.Empty() || Queue.Top()->DueAt > ClockFunc())
+        return false;
+    // Only the entry that became due first is checked, which is
+    // good enough and doesn't require popping entries from the queue
+    int cls = Queue.Top()->Class, next = PickClass();
+    if (cls == next)
+        return false;
+    if (cls == static_cast<int>(EPriorityClass::Realtime) &&
+        next == static_cast<int>(EPriorityClass::Background))
+        return true;
+    return std::max(Classes[cls].VirtualTime, SystemVirtualTime) <= Classes[next].VirtualTime;
+}
+
+TPollPlan::TQueueItem* TPollPlan::PickPending()
+{
+    auto top = PendingItems[PickClass()].Top();
+    if (!LastGroup || top->Group == LastGroup || top->SwitchCost == std::chrono::microseconds::zero())
+        return top;
+    auto it = Groups.find(LastGroup);
+    if (it == Groups.end() || it->second.Pending.Empty())
+        return top;
+    // Stay with the current group if its best item is almost as
+    // important. The deferred item can't be deferred forever, as
+    // each pending item is polled only once per pass.
+    auto candidate = it->second.Pending.Top();
+    return candidate->Class == top->Class &&
+        top->Priority - candidate->Priority <= GroupingTolerance ? candidate : top;
+}
+
+void TPollPlan::CountBaselineSwitch()
+{
+    // Priorities don't change during the pass, so the item that
+    // would be polled at this step in the strict order is on top
+    auto item = Baseline.Pop();
+    if (!item->Group || item->Group == BaselineGroup)
+        return;
+    if (BaselineGroup) {
+        LastPassStats.SwitchesAvoided++;
+        LastPassStats.SwitchTimeSaved += item->SwitchCost;
+    }
+    BaselineGroup = item->Group;
+}
+
+void TPollPlan::StaggerEntries()
+{
+    if (!NeedsStagger)
+        return;
+    NeedsStagger = false;
+    RestorePending();
+
+    // Only entries that weren't polled yet are moved, the rest
+    // already have their place on the grid
+    std::map<long long, std::vector<TQueueItem*>> groups;
+    for (const auto& item: Items) {
+        if (!item->PollCountAtLeast && !item->IsParked &&
+            item->PollInterval != std::chrono::milliseconds::zero())
+            groups[item->PollInterval.count()].push_back(item.get());
+    }
+    for (const auto& group: groups) {
+        long long n = group.second.size();
+        for (long long k = 0; k < n; ++k) {
+            auto item = group.second[k];
+            item->DueAt = CurrentTime + item->PollInterval * k / n;
+            Queue.Update(item);
+        }
+    }
+}
+
+void TPollPlan::UnparkDue()
+{
+    while (!Parked.Empty() && Parked.Top()->DueAt <= CurrentTime) {
+        auto item = Parked.Pop();
+        item->IsParked = false;
+        Queue.Push(item);
+    }
 }
 
 void TPollPlan::ProcessPending(const TCallback& callback)
 {
     CurrentTime = ClockFunc();
-    while (!PendingItems.empty())
-        PendingItems.pop();
+    StaggerEntries();
+    UnparkDue();
+    RestorePending();
 #ifdef POLL_PLAN_DEBUG
-    if (!Queue.empty())
+    if (!Queue.Empty())
         std::cout << "top due at " <<
-            std::chrono::duration_cast<std::chrono::milliseconds>(Queue.top()->DueAt.time_since_epoch()).count() <<
+            std::chrono::duration_cast<std::chrono::milliseconds>(Queue.Top()->DueAt.time_since_epoch()).count() <<
             "; now is " <<
             std::chrono::duration_cast<std::chrono::milliseconds>(CurrentTime.time_since_epoch()).count() <<
             std::endl;
 #endif
-    while (!Queue.empty() && Queue.top()->DueAt <= CurrentTime) {
-        PendingItems.push(Queue.top());
-        Queue.pop();
+    Baseline.Clear();
+    while (!Queue.Empty() && Queue.Top()->DueAt <= CurrentTime) {
+        auto item = Queue.Pop();
+        item->Priority = item->Importance(CurrentTime, AvgRequestDuration);
+        if (item->PollInterval != std::chrono::milliseconds::zero()) {
+            long long missed = (CurrentTime - item->DueAt) / item->PollInterval;
+            if (missed > item->MissedIntervals) {
+                Classes[item->Class].StarvationCount += missed - item->MissedIntervals;
+                item->MissedIntervals = missed;
+            }
+        }
+        PushPending(item);
+        Baseline.Push(item);
     }
+    // Devices may be accessed between passes (e.g. for writes), so
+    // entries are only grouped within a single pass
+    LastGroup = BaselineGroup = nullptr;
+    LastPassStats = TStats();
     int n = 0;
     std::chrono::milliseconds avg_duration = std::chrono::milliseconds::zero();
-    while (!PendingItems.empty()) {
-        auto item = PendingItems.top();
+    while (HasPending()) {
+        auto item = PickPending();
+        CountBaselineSwitch();
+        if (item->Group && item->Group != LastGroup) {
+            if (LastGroup) {
+                // actual switches are subtracted from the baseline ones
+                LastPassStats.SwitchesAvoided--;
+                LastPassStats.SwitchTimeSaved -= item->SwitchCost;
+            }
+            LastGroup = item->Group;
+        }
+        auto& state = Classes[item->Class];
+        SystemVirtualTime = state.VirtualTime;
         auto start = ClockFunc();
         callback(item->Entry);
-        auto request_duration = std::chrono::duration_cast<std::chrono::milliseconds>(ClockFunc() - start);
-        item->Update(item->PollCountAtLeast > 1 ?
+        auto end = ClockFunc();
+        state.VirtualTime += std::chrono::duration<double>(end - start).count() / state.Weight;
+        auto request_duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
+        item->Update(CurrentTime,
+                     item->PollCountAtLeast > 1 ?
                      std::chrono::duration_cast<std::chrono::milliseconds>(start - item->LastPollAt) :
                      std::chrono::milliseconds(0),
-                     request_duration);
+                     request_duration,
+                     Grid);
         avg_duration += request_duration;
         ++n;
-        Queue.push(item);
-        PendingItems.pop();
+        RemovePending(item);
+        Queue.Push(item);
+        if (HasPending() && PreemptedByDueEntry()) {
+            LastPassStats.Preempted = true;
+            break;
+        }
     }
 
     if (n > 0)
@@ -106,41 +474,109 @@ void TPollPlan::ProcessPending(const TCallback& callback)
 bool TPollPlan::PollIsDue()
 {
     CurrentTime = ClockFunc();
-    return Queue.top()->DueAt <= CurrentTime;
+    StaggerEntries();
+    UnparkDue();
+    return HasPending() || (!Queue.Empty() && Queue.Top()->DueAt <= CurrentTime);
 }
 
 TPollPlan::TTimePoint TPollPlan::GetNextPollTimePoint()
 {
-    if (Queue.empty())
-        return TTimePoint::max();
     if (PollIsDue())
         return TTimePoint(CurrentTime);
-    return Queue.top()->DueAt;
+    auto next = Queue.Empty() ? TTimePoint::max() : Queue.Top()->DueAt;
+    if (!Parked.Empty() && Parked.Top()->DueAt < next)
+        next = Parked.Top()->DueAt;
+    return next;
 }
 
 void TPollPlan::Reset()
 {
     AvgRequestDuration = std::chrono::milliseconds::zero();
-    while (!PendingItems.empty())
-        PendingItems.pop();
-    while (!Queue.empty())
-        Queue.pop();
+    NeedsStagger = false;
+    LastGroup = nullptr;
+    LastPassStats = TStats();
+    for (auto& heap: PendingItems)
+        heap.Clear();
+    Groups.clear();
+    Baseline.Clear();
+    BaselineGroup = nullptr;
+    Parked.Clear();
+    Queue.Clear();
+    Items.clear();
+    IntervalScale = 1;
+    // class weights are configuration, keep them
+    for (auto& state: Classes) {
+        state.VirtualTime = 0;
+        state.StarvationCount = 0;
+    }
+    SystemVirtualTime = 0;
 }
 
-void TPollPlan::Modify(std::function<bool(const PPollEntry & entry)> && thunk)
+double TPollPlan::GetPredictedLoad() const
 {
-    std::queue<PQueueItem> items;
-    while (!Queue.empty()) {
-        auto item = Queue.top();
-        if (!thunk(item->Entry)) {
-            items.push(item);
-            Queue.pop();
-        } else {
-            break;
-        }
+    double load = 0;
+    for (const auto& item: Items) {
+        auto interval = item->Entry->PollInterval();
+        if (interval != std::chrono::milliseconds::zero())
+            load += std::chrono::duration<double>(item->PredictedDuration).count() /
+                std::chrono::duration<double>(interval).count();
     }
-    while (!items.empty()) {
-        Queue.push(items.front());
-        items.pop();
+    return load;
+}
+
+void TPollPlan::SetIntervalScale(double scale)
+{
+    if (scale == IntervalScale)
+        return;
+    IntervalScale = scale;
+    for (const auto& item: Items) {
+        item->PollInterval = std::chrono::milliseconds(
+            static_cast<long long>(item->Entry->PollInterval().count() * IntervalScale));
+        item->PollIntervalSum = std::chrono::milliseconds::zero();
+        item->AvgPollInterval = std::chrono::milliseconds::zero();
+        item->PollCountAtLeast = std::min(item->PollCountAtLeast, 1);
+    }
+    NeedsStagger = Grid;
+}
+
+double TPollPlan::GetIntervalScale() const
+{
+    return IntervalScale;
+}
+
+const TPollPlan::TStats& TPollPlan::GetLastPassStats() const
+{
+    return LastPassStats;
+}
+
+void TPollPlan::ParkGroup(const void* group, TTimePoint until)
+{
+    RestorePending();
+    for (const auto& item: Items) {
+        if (item->Group != group)
+            continue;
+        if (item->IsParked)
+            Parked.Remove(item.get());
+        else
+            Queue.Remove(item.get());
+        item->IsParked = true;
+        item->DueAt = until;
+        Parked.Push(item.get());
     }
 }
+
+void TPollPlan::SetClassWeight(EPriorityClass cls, double weight)
+{
+    Classes[static_cast<int>(cls)].Weight = weight;
+}
+
+long long TPollPlan::GetStarvationCount(EPriorityClass cls) const
+{
+    return Classes[static_cast<int>(cls)].StarvationCount;
+}
+
+void TPollPlan::SetGridScheduling(bool grid)
+{
+    Grid = grid;
+    NeedsStagger = Grid;
+}
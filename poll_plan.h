@@ -1,56 +1,139 @@
 #pragma once
-#include <queue>
+#include <array>
+#include <vector>
 #include <chrono>
 #include <memory>
 #include <functional>
+#include <unordered_map>
+
+#include "definitions.h"
 
 class TPollEntry {
 public:
     virtual ~TPollEntry() {}
     virtual std::chrono::milliseconds PollInterval() const = 0;
+    // Expected bus time needed to poll the entry, zero if unknown
+    virtual std::chrono::microseconds PredictedDuration() const { return std::chrono::microseconds::zero(); }
+    // Entries of the same group (e.g. ranges of the same device) can be polled
+    // one after another for free, while switching to the group of this entry
+    // from another one costs SwitchCost() of bus time. nullptr means no group.
+    virtual const void* Group() const { return nullptr; }
+    virtual std::chrono::microseconds SwitchCost() const { return std::chrono::microseconds::zero(); }
+    virtual EPriorityClass PriorityClass() const { return EPriorityClass::Normal; }
 };
 
 typedef std::shared_ptr<TPollEntry> PPollEntry;
 
 class TPollPlan {
+    struct TQueueItem;
 public:
+    // Identifies an entry inside the plan, valid until the entry is removed
+    typedef TQueueItem* THandle;
     typedef std::chrono::steady_clock::time_point TTimePoint;
     typedef std::function<TTimePoint()> TClockFunc;
     typedef std::function<void(const PPollEntry& entry)> TCallback;
+    // Statistics of a single ProcessPending() pass compared to polling
+    // pending entries strictly in the order of their importance
+    struct TStats {
+        int SwitchesAvoided = 0;
+        std::chrono::microseconds SwitchTimeSaved = std::chrono::microseconds::zero();
+        // The pass stopped early for a more important entry that became
+        // due, the entries left pending are polled by the next pass
+        bool Preempted = false;
+    };
     TPollPlan(TClockFunc clock_func = std::chrono::steady_clock::now);
-    void AddEntry(const PPollEntry& entry);
+    THandle AddEntry(const PPollEntry& entry);
+    // Remove the entry from the plan in O(log n). May not be called
+    // from ProcessPending() callback.
+    void RemoveEntry(THandle handle);
+    // Pick up changes of poll interval, predicted duration, group or
+    // priority class of the entry in O(log n). If the poll interval has
+    // changed, the next poll of the entry is moved accordingly. May not
+    // be called from ProcessPending() callback.
+    void UpdateEntry(THandle handle);
     void ProcessPending(const TCallback& callback);
     bool PollIsDue();
     TTimePoint GetNextPollTimePoint();
     void Reset();
-    void Modify(std::function<bool(const PPollEntry & entry)> && thunk);
+    // Share of bus time required to poll all entries with non-zero
+    // poll interval at their configured intervals (regardless of
+    // the interval scale), according to PredictedDuration()
+    double GetPredictedLoad() const;
+    // Poll current and future entries at their configured intervals
+    // multiplied by scale, 1 by default
+    void SetIntervalScale(double scale);
+    double GetIntervalScale() const;
+    // In grid mode entries are polled at fixed time points (phase + N * interval)
+    // instead of being rescheduled relative to the time of their last poll,
+    // so late polls don't shift the phase. Entries with the same poll interval
+    // are spread evenly across their period to avoid bursts.
+    void SetGridScheduling(bool grid);
+    // Take entries of the group out of the queue until the given time
+    // point (e.g. while the device is disconnected). When the time
+    // comes, the entries become due at once.
+    void ParkGroup(const void* group, TTimePoint until);
+    // Bus time is shared between priority classes that have pending
+    // entries in proportion to their weights (1 by default). Regardless
+    // of weights, background entries are never polled while there are
+    // pending realtime ones. ProcessPending() may return before all
+    // pending entries are polled if an entry of a class that should go
+    // first becomes due, the rest are left pending for the next call.
+    void SetClassWeight(EPriorityClass cls, double weight);
+    // Number of whole poll intervals missed by entries of the class
+    // because they weren't polled in time
+    long long GetStarvationCount(EPriorityClass cls) const;
+    const TStats& GetLastPassStats() const;
 private:
     struct TQueueItem {
-        TQueueItem(TTimePoint* current_time, std::chrono::milliseconds* avg_request_duration,
-                   const PPollEntry& entry, int index):
-            CurrentTime(current_time), AvgRequestDuration(avg_request_duration),
-            Entry(entry), PollInterval(entry->PollInterval()), DueAt(*current_time), Index(index) {}
-        TTimePoint* CurrentTime;
-        std::chrono::milliseconds* AvgRequestDuration;
+        TQueueItem(const PPollEntry& entry, TTimePoint due_at, long long index):
+            Entry(entry), DueAt(due_at), Index(index) {}
         PPollEntry Entry;
-        std::chrono::milliseconds PollInterval,
+        std::chrono::milliseconds PollInterval;
+        std::chrono::microseconds PredictedDuration;
+        const void* Group;
+        std::chrono::microseconds SwitchCost;
+        int Class;
+        std::chrono::milliseconds
             PollIntervalSum = std::chrono::milliseconds::zero(),
             AvgPollInterval = std::chrono::milliseconds::zero(),
             RequestDuration = std::chrono::milliseconds::zero();
         TTimePoint DueAt, LastPollAt;
-        int Index;
+        // Sequence number of the entry, unique within the plan
+        long long Index;
+        // Position of the item in TPollPlan::Items
+        size_t ItemPos = 0;
         int PollCountAtLeast = 0;
+        // Importance() snapshot taken when the item becomes pending.
+        // CurrentTime and AvgRequestDuration don't change while pending
+        // items are processed, so the key stays valid for the whole pass.
+        long long Priority = 0;
+        // Position of the item inside the heap it currently belongs to.
+        // An item is either in Queue or in PendingItems, never in both.
+        size_t HeapPos = 0;
+        // Poll intervals missed since the last poll that are already
+        // counted in TClassState::StarvationCount
+        long long MissedIntervals = 0;
+        // Position of the pending item inside its group heap (see Groups)
+        size_t GroupHeapPos = 0;
+        // Position of the pending item inside Baseline
+        size_t BaselineHeapPos = 0;
+        // The item is in Parked instead of Queue, DueAt is the wake up time
+        bool IsParked = false;
+        // The item is in PendingItems instead of Queue
+        bool IsPending = false;
         // NOTE: PollIntervalAveragingWindow of 1 is not supported!
         // (must alter TPollPlan::TQueueItem::Update() to support it)
         static const int PollIntervalAveragingWindow = 10;
 
-        void Update(const std::chrono::milliseconds& new_interval,
-                    const std::chrono::milliseconds& request_duration);
-        int Importance() const;
+        void Update(const TTimePoint& current_time,
+                    const std::chrono::milliseconds& new_interval,
+                    const std::chrono::milliseconds& request_duration,
+                    bool grid);
+        long long Importance(const TTimePoint& current_time,
+                             const std::chrono::milliseconds& avg_request_duration) const;
     };
-    typedef std::shared_ptr<TQueueItem> PQueueItem;
     struct LaterThan {
-        bool operator () (const PQueueItem& a, const PQueueItem& b) const {
+        bool operator () (const TQueueItem* a, const TQueueItem* b) const {
             // Take Index into account to try to make sorting
             // stable for more predictability (useful for testing)
             return a->DueAt > b->DueAt ||
@@ -58,19 +141,98 @@ private:
         }
     };
     struct LessImportantThan {
-        bool operator () (const PQueueItem& a, const PQueueItem& b) const {
+        bool operator () (const TQueueItem* a, const TQueueItem* b) const {
             // Take Index into account to try to make sorting
             // stable for more predictability (useful for testing)
-            return a->Importance() < b->Importance() ||
-                (a->Importance() == b->Importance() && a->Index > b->Index);
+            return a->Priority < b->Priority ||
+                (a->Priority == b->Priority && a->Index > b->Index);
         }
     };
 
+    // Binary heap of items that keeps item position (TQueueItem::HeapPos
+    // by default) up to date, so any item can be resifted or removed in
+    // O(log n). The storage is reserved in advance and never shrinks,
+    // so pushing and popping doesn't allocate.
+    template<class Compare, size_t TQueueItem::*Pos = &TQueueItem::HeapPos>
+    class THeap {
+    public:
+        bool Empty() const { return Items.empty(); }
+        size_t Size() const { return Items.size(); }
+        TQueueItem* Top() const { return Items.front(); }
+        void Reserve(size_t n) { Items.reserve(n); }
+        void Clear() { Items.clear(); }
+        void Push(TQueueItem* item);
+        TQueueItem* Pop();
+        void Remove(TQueueItem* item);
+        void Update(TQueueItem* item);
+        const std::vector<TQueueItem*>& Data() const { return Items; }
+    private:
+        void Place(TQueueItem* item, size_t pos);
+        void SiftUp(size_t pos);
+        void SiftDown(size_t pos);
+        std::vector<TQueueItem*> Items;
+    };
+
+    typedef THeap<LessImportantThan, &TQueueItem::GroupHeapPos> TGroupHeap;
+    struct TGroupState {
+        TGroupHeap Pending;
+        size_t EntryCount = 0;
+    };
+
+    void LoadEntryProperties(TQueueItem* item);
+    void RestorePending();
+    void StaggerEntries();
+    void UnparkDue();
+    void PushPending(TQueueItem* item);
+    void RemovePending(TQueueItem* item);
+    bool HasPending() const;
+    int PickClass() const;
+    bool PreemptedByDueEntry() const;
+    TQueueItem* PickPending();
+    void AddToGroup(const void* group);
+    void RemoveFromGroup(const void* group);
+    void CountBaselineSwitch();
+
+    // Pending item of the group that was polled last may be picked
+    // instead of the most important one to avoid switching between
+    // groups, if their priorities differ by no more than this
+    // (in Importance() units, i.e. roughly 1/1000 of poll interval
+    // of lateness)
+    static const long long GroupingTolerance = 500;
+
     TClockFunc ClockFunc;
     TTimePoint CurrentTime;
     std::chrono::milliseconds AvgRequestDuration = std::chrono::milliseconds::zero();
-    std::priority_queue<PQueueItem, std::vector<PQueueItem>, LessImportantThan> PendingItems;
-    std::priority_queue<PQueueItem, std::vector<PQueueItem>, LaterThan> Queue;
+    double IntervalScale = 1;
+    long long NextIndex = 0;
+    bool Grid = false, NeedsStagger = false;
+    std::vector<std::unique_ptr<TQueueItem>> Items;
+    struct TClassState {
+        double Weight = 1;
+        // Bus time (in seconds) used by the class divided by its weight.
+        // The class with the least virtual time goes first.
+        double VirtualTime = 0;
+        long long StarvationCount = 0;
+    };
+
+    std::array<TClassState, PRIORITY_CLASS_COUNT> Classes;
+    // virtual time of the class that was picked last
+    double SystemVirtualTime = 0;
+    std::array<THeap<LessImportantThan>, PRIORITY_CLASS_COUNT> PendingItems;
+    // Entries by TQueueItem::Group, for entries that have one. A group
+    // is added with its first entry and removed with the last one, so
+    // making items pending doesn't allocate.
+    std::unordered_map<const void*, TGroupState> Groups;
+    // Items of the current pass in the strict order of importance. One
+    // is popped per polled item to count the switches that polling in
+    // this order would take (see TStats).
+    THeap<LessImportantThan, &TQueueItem::BaselineHeapPos> Baseline;
+    const void* BaselineGroup = nullptr;
+    THeap<LaterThan> Queue;
+    THeap<LaterThan> Parked;
+    // group of the item that was polled last during current pass
+    const void* LastGroup = nullptr;
+    TStats LastPassStats;
 };
 
 typedef std::shared_ptr<TPollPlan> PPollPlan;
@@ -0,0 +1,160 @@
+#include "poll_simulator.h"
+#include "poll_plan.h"
+#include "serial_client.h"
+#include "serial_port.h"
+#include "tcp_port.h"
+
+#include <algorithm>
+#include <unordered_map>
+
+TPollSimulator::TPollSimulator(PPortConfig config, unsigned seed)
+    : Config(config), Random(seed)
+{
+    // The port is only needed for its line settings, it's never opened
+    if (auto serial_port_settings = std::dynamic_pointer_cast<TSerialPortSettings>(config->ConnSettings)) {
+        Port = std::make_shared<TSerialPort>(serial_port_settings);
+    } else if (auto tcp_port_settings = std::dynamic_pointer_cast<TTcpPortSettings>(config->ConnSettings)) {
+        Port = std::make_shared<TTcpPort>(tcp_port_settings);
+    } else {
+        throw TSerialDeviceException("invalid connection settings");
+    }
+
+    for (const auto& device_config: Config->DeviceConfigs) {
+        auto device = TSerialDeviceFactory::CreateDevice(device_config, Port);
+        Devices.push_back(device);
+        for (const auto& channel_config: device_config->DeviceChannelConfigs) {
+            TChannel channel;
+            channel.Name = device_config->Id + "/" + channel_config->Name;
+            for (const auto& reg_config: channel_config->RegisterConfigs)
+                channel.Registers.push_back(TRegister::Intern(device, reg_config));
+            if (channel.Registers.empty())
+                continue;
+            channel.PollInterval = channel.Registers.front()->PollInterval;
+            Channels.push_back(channel);
+        }
+    }
+}
+
+TPollSimulator::~TPollSimulator()
+{
+    for (const auto& dev: Devices)
+        TSerialDeviceFactory::RemoveDevice(dev);
+}
+
+void TPollSimulator::SetDefaultModel(const TSimulatedDeviceModel& model)
+{
+    DefaultModel = model;
+}
+
+void TPollSimulator::SetDeviceModel(const std::string& device_id, const TSimulatedDeviceModel& model)
+{
+    DeviceModels[device_id] = model;
+}
+
+const TSimulatedDeviceModel& TPollSimulator::GetModel(PSerialDevice dev) const
+{
+    auto it = DeviceModels.find(dev->DeviceConfig()->Id);
+    return it == DeviceModels.end() ? DefaultModel : it->second;
+}
+
+TPollSimulator::TReport TPollSimulator::Run(const std::chrono::milliseconds& duration)
+{
+    TPollPlan::TTimePoint start, now = start;
+    TPollPlan plan([&now]() { return now; });
+    plan.SetGridScheduling(Config->GridPolling);
+    for (int i = 0; i < PRIORITY_CLASS_COUNT && i < (int)Config->PriorityWeights.size(); ++i)
+        plan.SetClassWeight(static_cast<EPriorityClass>(i), Config->PriorityWeights[i]);
+
+    // same as TSerialClient does it, registers of each device go together
+    std::map<PSerialDevice, std::list<PRegister>> device_regs;
+    for (const auto& channel: Channels) {
+        for (const auto& reg: channel.Registers)
+            device_regs[reg->Device()].push_back(reg);
+    }
+    for (const auto& dev: Devices) {
+        for (const auto& entry: TSerialPollEntry::Create(dev, device_regs[dev], Devices.size() > 1))
+            plan.AddEntry(entry);
+    }
+
+    TReport report;
+    report.Port = Config->ConnSettings->ToString();
+    report.PredictedLoad = plan.GetPredictedLoad();
+    if (report.PredictedLoad > TSerialClient::MAX_BUS_LOAD) {
+        report.IntervalScale = report.PredictedLoad / TSerialClient::MAX_BUS_LOAD;
+        plan.SetIntervalScale(report.IntervalScale);
+    }
+
+    struct TRegisterState {
+        int Polls = 0;
+        TPollPlan::TTimePoint LastRead;
+        std::chrono::microseconds MaxStaleness = std::chrono::microseconds::zero();
+    };
+    std::unordered_map<PRegister, TRegisterState> states;
+    for (const auto& channel: Channels) {
+        for (const auto& reg: channel.Registers)
+            states[reg].LastRead = start;
+    }
+
+    std::uniform_real_distribution<double> error_dist(0, 1);
+    PSerialDevice last_device;
+    std::chrono::microseconds busy = std::chrono::microseconds::zero();
+    auto end = start + duration;
+    for (;;) {
+        auto next = plan.GetNextPollTimePoint();
+        if (next >= end)
+            break;
+        now = std::max(now, next);
+        plan.ProcessPending([&](const PPollEntry& entry) {
+                auto poll_start = now;
+                for (const auto& range: std::static_pointer_cast<TSerialPollEntry>(entry)->Ranges) {
+                    auto dev = range->Device();
+                    if (dev != last_device) {
+                        now += dev->DeviceConfig()->Delay;
+                        last_device = dev;
+                    }
+                    const auto& model = GetModel(dev);
+                    // generic devices read their registers one at a time
+                    int requests = std::dynamic_pointer_cast<TSimpleRegisterRange>(range) ?
+                        range->RegisterList().size() : 1;
+                    now += dev->EstimateReadDuration(range) + model.Latency * requests;
+                    if (error_dist(Random) < model.ErrorRate) {
+                        now += Config->ConnSettings->ResponseTimeout;
+                        continue;
+                    }
+                    for (const auto& reg: range->RegisterList()) {
+                        auto& state = states[reg];
+                        state.MaxStaleness = std::max(state.MaxStaleness,
+                            std::chrono::duration_cast<std::chrono::microseconds>(now - state.LastRead));
+                        state.LastRead = now;
+                        state.Polls++;
+                    }
+                }
+                // without bus model (e.g. TCP ports) and latency polls would
+                // take no time at all and the simulation would never end
+                if (now == poll_start)
+                    now += std::chrono::milliseconds(1);
+                busy += std::chrono::duration_cast<std::chrono::microseconds>(now - poll_start);
+            });
+    }
+
+    auto finish = std::max(now, end);
+    report.Duration = std::chrono::duration_cast<std::chrono::microseconds>(finish - start);
+    report.Utilization = double(busy.count()) / report.Duration.count();
+    for (const auto& channel: Channels) {
+        TChannelStats stats;
+        stats.Name = channel.Name;
+        stats.DesiredInterval = channel.PollInterval;
+        stats.Polls = -1;
+        for (const auto& reg: channel.Registers) {
+            auto& state = states[reg];
+            state.MaxStaleness = std::max(state.MaxStaleness,
+                std::chrono::duration_cast<std::chrono::microseconds>(finish - state.LastRead));
+            stats.MaxStaleness = std::max(stats.MaxStaleness, state.MaxStaleness);
+            stats.Polls = stats.Polls < 0 ? state.Polls : std::min(stats.Polls, state.Polls);
+        }
+        if (stats.Polls > 0)
+            stats.AchievedInterval = report.Duration / stats.Polls;
+        report.Channels.push_back(stats);
+    }
+    return report;
+}
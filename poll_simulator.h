@@ -0,0 +1,72 @@
+#pragma once
+
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+#include <chrono>
+
+#include "serial_config.h"
+#include "serial_device.h"
+
+// Bus behaviour of a device that can't be derived from the config
+struct TSimulatedDeviceModel {
+    // Time the device takes to start responding, per request
+    std::chrono::microseconds Latency = std::chrono::microseconds::zero();
+    // Share of requests that get no response, each failed request
+    // additionally costs the response timeout of the port
+    double ErrorRate = 0;
+};
+
+// Runs the poll plan of a port in virtual time without accessing the bus.
+// Requests take the time predicted by the devices' bus model plus the
+// latency and errors of TSimulatedDeviceModel. Disconnects, writes and
+// retries are not simulated.
+class TPollSimulator {
+public:
+    struct TChannelStats {
+        std::string Name;
+        std::chrono::milliseconds DesiredInterval;
+        int Polls = 0;
+        // zero if the channel wasn't polled at all
+        std::chrono::microseconds AchievedInterval = std::chrono::microseconds::zero();
+        // the longest time the channel went without a successful read
+        std::chrono::microseconds MaxStaleness = std::chrono::microseconds::zero();
+    };
+    struct TReport {
+        std::string Port;
+        std::chrono::microseconds Duration = std::chrono::microseconds::zero();
+        double PredictedLoad = 0;
+        // poll intervals are stretched by this factor if the bus
+        // can't keep up with them (see TSerialClient::MAX_BUS_LOAD)
+        double IntervalScale = 1;
+        // share of the time the bus was busy
+        double Utilization = 0;
+        std::vector<TChannelStats> Channels;
+    };
+
+    TPollSimulator(PPortConfig config, unsigned seed = 0);
+    TPollSimulator(const TPollSimulator&) = delete;
+    TPollSimulator& operator=(const TPollSimulator&) = delete;
+    ~TPollSimulator();
+
+    void SetDefaultModel(const TSimulatedDeviceModel& model);
+    void SetDeviceModel(const std::string& device_id, const TSimulatedDeviceModel& model);
+    TReport Run(const std::chrono::milliseconds& duration);
+
+private:
+    struct TChannel {
+        std::string Name;
+        std::chrono::milliseconds PollInterval;
+        std::vector<PRegister> Registers;
+    };
+    const TSimulatedDeviceModel& GetModel(PSerialDevice dev) const;
+
+    PPortConfig Config;
+    PPort Port;
+    std::list<PSerialDevice> Devices;
+    std::vector<TChannel> Channels;
+    TSimulatedDeviceModel DefaultModel;
+    std::map<std::string, TSimulatedDeviceModel> DeviceModels;
+    std::minstd_rand Random;
+};
@@ -32,8 +32,47 @@ public:
     virtual void SetDebug(bool debug) = 0;
     virtual bool Debug() const = 0;
     virtual void Sleep(const std::chrono::microseconds& us) = 0;
+    // Make sure the bus has been silent for at least given time
+    // since the last byte was sent or received
+    virtual void SleepSinceLastInteraction(const std::chrono::microseconds& us)
+    {
+        Sleep(us);
+    }
     virtual bool Wait(const PBinarySemaphore & semaphore, const TTimePoint & until) = 0;
     virtual TTimePoint CurrentTime() const = 0;
+
+    // How long a request waits for the start of the response
+    // (zero if the port doesn't know it)
+    virtual std::chrono::milliseconds GetResponseTimeout() const
+    {
+        return std::chrono::milliseconds::zero();
+    }
+
+    // Time needed to transmit given number of bytes over the bus
+    // (zero if the port doesn't know its line settings)
+    virtual std::chrono::microseconds GetSendTime(double bytesNumber) const
+    {
+        return std::chrono::microseconds::zero();
+    }
+
+    // Frame completion predicates for ReadFrame() for the usual ways
+    // protocols mark the end of a frame, so it returns as soon as the
+    // last byte arrives instead of waiting for a pause on the bus
+    static TFrameCompletePred ExpectFixedLength(int size)
+    {
+        return [size](uint8_t* buf, int n) { return n >= size; };
+    }
+
+    // the frame is buf[offset] + extra bytes long
+    static TFrameCompletePred ExpectLengthByte(int offset, int extra)
+    {
+        return [offset, extra](uint8_t* buf, int n) { return n > offset && n >= buf[offset] + extra; };
+    }
+
+    static TFrameCompletePred ExpectTerminator(uint8_t terminator)
+    {
+        return [terminator](uint8_t* buf, int n) { return n > 0 && buf[n - 1] == terminator; };
+    }
 };
 
 using PPort = std::shared_ptr<TPort>;
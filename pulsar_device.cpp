@@ -4,6 +4,7 @@
 #include <cstdlib>
 
 #include "pulsar_device.h"
+#include "crc16.h"
 
 /* FIXME: move this to configuration file! */
 namespace {
@@ -20,29 +21,6 @@ TPulsarDevice::TPulsarDevice(PDeviceConfig device_config, PPort port, PProtocol
     , RequestID(0)
 {}
 
-uint16_t TPulsarDevice::CalculateCRC16(const uint8_t *buffer, size_t size)
-{
-    uint16_t w;
-    uint16_t shift_cnt, f;
-    const uint8_t *ptrByte;
-
-    uint16_t byte_cnt = size;
-    ptrByte = buffer;
-    w = (uint16_t) 0xFFFF;
-
-    for (; byte_cnt > 0; byte_cnt--) {
-        w = (uint16_t) (w ^ (uint16_t) (*ptrByte++));
-        for (shift_cnt = 0; shift_cnt < 8; shift_cnt++) {
-            f = (uint8_t) ((w) & 0x01);
-            w >>= 1;
-            if (f)
-                w = (uint16_t) (w ^ 0xa001);
-        }
-    }
-
-    return w;
-}
-
 void TPulsarDevice::WriteBCD(uint64_t value, uint8_t *buffer, size_t size, bool big_endian)
 {
     for (size_t i = 0; i < size; i++) {
@@ -112,8 +90,8 @@ void TPulsarDevice::WriteDataRequest(uint32_t addr, uint32_t mask, uint16_t id)
     WriteHex(id, &buf[10], sizeof (uint16_t), false);
 
     /* CRC16 */
-    uint16_t crc = CalculateCRC16(buf, 12);
-    WriteHex(crc, &buf[12], sizeof (uint16_t), false);
+    uint16_t crc = CRC16::CalculateCRC16(buf, 12);
+    WriteHex(crc, &buf[12], sizeof (uint16_t));
 
     Port()->WriteBytes(buf, 14);
 }
@@ -135,8 +113,8 @@ void TPulsarDevice::WriteSysTimeRequest(uint32_t addr, uint16_t id)
     WriteHex(id, &buf[6], sizeof (uint16_t), false);
 
     /* CRC16 */
-    uint16_t crc = CalculateCRC16(buf, 8);
-    WriteHex(crc, &buf[8], sizeof (uint16_t), false);
+    uint16_t crc = CRC16::CalculateCRC16(buf, 8);
+    WriteHex(crc, &buf[8], sizeof (uint16_t));
 
     Port()->WriteBytes(buf, 10);
 }
@@ -146,10 +124,9 @@ void TPulsarDevice::ReadResponse(uint32_t addr, uint8_t *payload, size_t size, u
     const int exp_size = size + 10; /* payload size + service bytes */
     uint8_t response[exp_size];
 
+    /* frame length is in the header */
     int nread = Port()->ReadFrame(response, exp_size, std::chrono::milliseconds(FrameTimeout),
-            [] (uint8_t *buf, int size) {
-                    return size >= 6 && size == buf[5];
-            });
+            TPort::ExpectLengthByte(5, 0));
 
     /* check size */
     if (nread < 6)
@@ -162,8 +139,8 @@ void TPulsarDevice::ReadResponse(uint32_t addr, uint8_t *payload, size_t size, u
         throw TSerialDeviceTransientErrorException("unexpected frame length");
 
     /* check CRC16 */
-    uint16_t crc_recv = ReadHex(&response[nread - 2], sizeof (uint16_t), false);
-    if (crc_recv != CalculateCRC16(response, nread - 2))
+    uint16_t crc_recv = ReadHex(&response[nread - 2], sizeof (uint16_t));
+    if (crc_recv != CRC16::CalculateCRC16(response, nread - 2))
         throw TSerialDeviceTransientErrorException("CRC mismatch");
 
     /* check address */
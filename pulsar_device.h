@@ -26,8 +26,6 @@ private:
     uint64_t ReadBCD(const uint8_t *data, size_t size, bool big_endian = true);
     uint64_t ReadHex(const uint8_t *data, size_t size, bool big_endian = true);
 
-    uint16_t CalculateCRC16(const uint8_t *buffer, size_t size);
-
     void WriteDataRequest(uint32_t addr, uint32_t mask, uint16_t id);
     void WriteSysTimeRequest(uint32_t addr, uint16_t id);
 
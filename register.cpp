@@ -1,7 +1,12 @@
 #include "register.h"
 #include "serial_device.h"
 
-TRegisterRange::TRegisterRange(const std::list<PRegister>& regs): RegList(regs)
+#include <algorithm>
+
+TRegisterRange::TRegisterRange(const std::list<PRegister>& regs)
+    : RegList(regs.begin(), regs.end())
+    , Values(RegList.size())
+    , Errors(RegList.size())
 {
     if (RegList.empty())
         throw std::runtime_error("cannot construct empty register range");
@@ -10,51 +15,53 @@ TRegisterRange::TRegisterRange(const std::list<PRegister>& regs): RegList(regs)
     RegType = first->Type;
     RegTypeName = first->TypeName;
     RegPollInterval = first->PollInterval;
+    RegPriority = first->Priority;
 }
 
-TRegisterRange::TRegisterRange(PRegister reg): RegList(1, reg)
+TRegisterRange::TRegisterRange(PRegister reg)
+    : RegList(1, reg)
+    , Values(1)
+    , Errors(1)
 {
     RegDevice = reg->Device();
     RegType = reg->Type;
     RegTypeName = reg->TypeName;
     RegPollInterval = reg->PollInterval;
+    RegPriority = reg->Priority;
 }
 
 TRegisterRange::~TRegisterRange() {}
 
-TSimpleRegisterRange::TSimpleRegisterRange(const std::list<PRegister>& regs): TRegisterRange(regs) {}
-
-TSimpleRegisterRange::TSimpleRegisterRange(PRegister reg): TRegisterRange(reg) {}
-
-void TSimpleRegisterRange::Reset()
+void TRegisterRange::MapRange(TValueCallback value_callback, TErrorCallback error_callback)
 {
-    Values.clear();
-    Errors.clear();
+    ForEachValue([&](size_t i, uint64_t value) { value_callback(RegList[i], value); },
+                 [&](size_t i) { error_callback(RegList[i]); });
 }
 
-void TSimpleRegisterRange::SetValue(PRegister reg, uint64_t value)
+void TRegisterRange::Reset()
 {
-    Values[reg] = value;
-}
-
-void TSimpleRegisterRange::SetError(PRegister reg)
-{
-    Errors.insert(reg);
+    std::fill(Values.begin(), Values.end(), 0);
+    if (FailedCount) {
+        std::fill(Errors.begin(), Errors.end(), false);
+        FailedCount = 0;
+    }
 }
 
-void TSimpleRegisterRange::MapRange(TValueCallback value_callback, TErrorCallback error_callback)
+void TRegisterRange::SetError(size_t index)
 {
-    for (auto reg: RegisterList()) {
-        if (Errors.find(reg) == Errors.end())
-            value_callback(reg, Values[reg]);
-        else
-            error_callback(reg);
+    if (!Errors[index]) {
+        Errors[index] = true;
+        ++FailedCount;
     }
 }
 
+TSimpleRegisterRange::TSimpleRegisterRange(const std::list<PRegister>& regs): TRegisterRange(regs) {}
+
+TSimpleRegisterRange::TSimpleRegisterRange(PRegister reg): TRegisterRange(reg) {}
+
 TRegisterRange::EStatus TSimpleRegisterRange::GetStatus() const
 {
-    return Errors.size() == RegisterList().size() ? ST_UNKNOWN_ERROR: ST_OK;
+    return ErrorCount() == RegisterList().size() ? ST_UNKNOWN_ERROR: ST_OK;
 }
 
 bool TSimpleRegisterRange::NeedsSplit() const
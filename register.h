@@ -15,6 +15,7 @@
 
 #include "registry.h"
 #include "serial_exc.h"
+#include "definitions.h"
 
 enum RegisterFormat {
     AUTO,
@@ -147,6 +148,12 @@ struct TRegisterConfig : public std::enable_shared_from_this<TRegisterConfig>
     bool ReadOnly;
     std::string TypeName;
     std::chrono::milliseconds PollInterval = std::chrono::milliseconds(-1);
+    EPriorityClass Priority = EPriorityClass::Normal;
+    // after a write, values set within this time are conflated
+    // and only the last one is written when it ends
+    std::chrono::milliseconds WriteConflation = std::chrono::milliseconds::zero();
+    // read the register right after writing it
+    bool ReadBack = false;
 
     bool HasErrorValue;
     uint64_t ErrorValue;
@@ -184,6 +191,11 @@ struct TRegister : public TRegisterConfig
         return _Device.lock();
     }
 
+    // Index of the register in the flat tables of the client it's added
+    // to. Slots are dense within the client, the slots of registers of
+    // removed devices are taken by the registers added after them.
+    uint32_t Slot = 0;
+
     /* PSerialDevice Device; */
 private:
     std::weak_ptr<TSerialDevice> _Device;
@@ -319,6 +331,31 @@ inline EWordOrder WordOrderFromName(const std::string& name) {
         return EWordOrder::BigEndian;
 }
 
+inline const char* PriorityClassName(EPriorityClass priority) {
+    switch (priority) {
+    case EPriorityClass::Realtime:
+        return "realtime";
+    case EPriorityClass::Normal:
+        return "normal";
+    case EPriorityClass::Background:
+        return "background";
+    default:
+        return "<unknown priority>";
+    }
+}
+
+inline EPriorityClass PriorityClassFromName(const std::string& name) {
+    if (name == "realtime")
+        return EPriorityClass::Realtime;
+    else if (name == "background")
+        return EPriorityClass::Background;
+    else
+        return EPriorityClass::Normal;
+}
+
+
+class TRegisterHandler;
+typedef std::shared_ptr<TRegisterHandler> PRegisterHandler;
 
 class TRegisterRange {
 public:
@@ -331,27 +368,76 @@ public:
     };
 
     virtual ~TRegisterRange();
-    const std::list<PRegister>& RegisterList() const { return RegList; }
+    const TRegistersList& RegisterList() const { return RegList; }
     PSerialDevice Device() const { return RegDevice.lock(); }
     int Type() const { return RegType; }
     std::string TypeName() const  { return RegTypeName; }
     std::chrono::milliseconds PollInterval() const { return RegPollInterval; }
-    virtual void MapRange(TValueCallback value_callback, TErrorCallback error_callback) = 0;
+    EPriorityClass Priority() const { return RegPriority; }
+    void MapRange(TValueCallback value_callback, TErrorCallback error_callback);
+    // Same as MapRange() for the polling hot path: the callbacks get the
+    // index of the register in RegisterList() and are inlined
+    template<typename TValueFn, typename TErrorFn>
+    void ForEachValue(TValueFn value_fn, TErrorFn error_fn) const
+    {
+        if (!FailedCount) {
+            for (size_t i = 0; i < Values.size(); ++i)
+                value_fn(i, Values[i]);
+            return;
+        }
+        for (size_t i = 0; i < Values.size(); ++i) {
+            if (Errors[i])
+                error_fn(i);
+            else
+                value_fn(i, Values[i]);
+        }
+    }
     virtual EStatus GetStatus() const = 0;
 
+    // Handlers of the registers indexed the same way as RegisterList(),
+    // bound by the client that polls the range
+    const std::vector<PRegisterHandler>& Handlers() const { return RegHandlers; }
+    void SetHandlers(const std::vector<PRegisterHandler>& handlers) { RegHandlers = handlers; }
+
     // returns true when occured error is likely caused by hole registers
     virtual bool NeedsSplit() const = 0;
 
+    // returns true if the device refused to read the registers
+    // of the range, e.g. because some of them don't exist
+    virtual bool IsRejected() const { return false; }
+
+    // returns true if the last read got exactly the same data from the
+    // device as the read before it, so the values are left as they were
+    virtual bool IsUnchanged() const { return false; }
+
+    // Write count of the client at the moment the values of the range
+    // were last passed to the handlers, see TSerialClient::PollRange()
+    uint64_t MappedWriteCount() const { return WriteCount; }
+    void SetMappedWriteCount(uint64_t count) { WriteCount = count; }
+
 protected:
     TRegisterRange(const std::list<PRegister>& regs);
     TRegisterRange(PRegister reg);
 
+    // Results of the last read, index is the position of the register
+    // in RegisterList(). Reset() clears them before reading.
+    void Reset();
+    void SetValue(size_t index, uint64_t value) { Values[index] = value; }
+    void SetError(size_t index);
+    size_t ErrorCount() const { return FailedCount; }
+
 private:
     std::weak_ptr<TSerialDevice> RegDevice;
     int RegType;
     std::string RegTypeName;
     std::chrono::milliseconds RegPollInterval = std::chrono::milliseconds(-1);
-    std::list<PRegister> RegList;
+    EPriorityClass RegPriority = EPriorityClass::Normal;
+    TRegistersList RegList;
+    std::vector<PRegisterHandler> RegHandlers;
+    std::vector<uint64_t> Values;
+    std::vector<bool> Errors;
+    size_t FailedCount = 0;
+    uint64_t WriteCount = 0;
 };
 
 typedef std::shared_ptr<TRegisterRange> PRegisterRange;
@@ -360,16 +446,11 @@ class TSimpleRegisterRange: public TRegisterRange {
 public:
     TSimpleRegisterRange(const std::list<PRegister>& regs);
     TSimpleRegisterRange(PRegister reg);
-    void Reset();
-    void SetValue(PRegister reg, uint64_t value);
-    void SetError(PRegister reg);
-    void MapRange(TValueCallback value_callback, TErrorCallback error_callback);
+    using TRegisterRange::Reset;
+    using TRegisterRange::SetValue;
+    using TRegisterRange::SetError;
     EStatus GetStatus() const override;
     bool NeedsSplit() const override;
-
-private:
-    std::unordered_map<PRegister, uint64_t> Values;
-    std::unordered_set<PRegister> Errors;
 };
 
 typedef std::shared_ptr<TSimpleRegisterRange> PSimpleRegisterRange;
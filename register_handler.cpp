@@ -3,8 +3,8 @@
 
 #include "register_handler.h"
 
-TRegisterHandler::TRegisterHandler(PSerialDevice dev, PRegister reg, PBinarySemaphore flush_needed, bool debug)
-    : Dev(dev), Reg(reg), FlushNeeded(flush_needed), Debug(debug) {}
+TRegisterHandler::TRegisterHandler(PSerialDevice dev, PRegister reg, PFlushQueue flush_queue, bool debug)
+    : Dev(dev), Reg(reg), Dirty(false), FlushQueue(flush_queue), Debug(debug) {}
 
 TRegisterHandler::TErrorState TRegisterHandler::UpdateReadError(bool error) {
     TErrorState newState;
@@ -44,7 +44,6 @@ TRegisterHandler::TErrorState TRegisterHandler::UpdateWriteError(bool error) {
 
 bool TRegisterHandler::NeedToPoll()
 {
-    std::lock_guard<std::mutex> lock(SetValueMutex);
     return Reg->Poll && !Dirty;
 }
 
@@ -70,6 +69,11 @@ TRegisterHandler::TErrorState TRegisterHandler::AcceptDeviceValue(uint64_t new_v
         return UpdateReadError(true);
     }
 
+    if (DeviceValue == new_value) {
+        *changed = first_poll;
+        return UpdateReadError(false);
+    }
+
     SetValueMutex.lock();
     if (Value != new_value) {
         if (Dirty) {
@@ -77,7 +81,7 @@ TRegisterHandler::TErrorState TRegisterHandler::AcceptDeviceValue(uint64_t new_v
             return UpdateReadError(false);
         }
 
-        Value = new_value;
+        Value = DeviceValue = new_value;
         SetValueMutex.unlock();
 
         if (Debug) {
@@ -87,8 +91,10 @@ TRegisterHandler::TErrorState TRegisterHandler::AcceptDeviceValue(uint64_t new_v
         }
         *changed = true;
         return UpdateReadError(false);
-    } else
+    } else {
+        DeviceValue = new_value;
         SetValueMutex.unlock();
+    }
 
     *changed = first_poll;
     return UpdateReadError(false);
@@ -96,7 +102,6 @@ TRegisterHandler::TErrorState TRegisterHandler::AcceptDeviceValue(uint64_t new_v
 
 bool TRegisterHandler::NeedToFlush()
 {
-    std::lock_guard<std::mutex> lock(SetValueMutex);
     return Dirty;
 }
 
@@ -105,21 +110,33 @@ TRegisterHandler::TErrorState TRegisterHandler::Flush()
     if (!NeedToFlush())
         return ErrorStateUnchanged;
 
-    {
-        std::lock_guard<std::mutex> lock(SetValueMutex);
-        Dirty = false;
-    }
-
+    uint64_t value = PrepareFlush();
     try {
-        Device()->WriteRegister(Reg, Value);
+        Device()->WriteRegister(Reg, value);
     } catch (const TSerialDeviceTransientErrorException& e) {
-        std::ios::fmtflags f(std::cerr.flags());
-        std::cerr << "TRegisterHandler::Flush(): warning: " << e.what() << " for device " <<
-            Reg->Device()->ToString() <<  std::endl;
-        std::cerr.flags(f);
-        return UpdateWriteError(true);
+        return FinishFlush(e.what());
     }
-    return UpdateWriteError(false);
+    return FinishFlush("");
+}
+
+uint64_t TRegisterHandler::PrepareFlush()
+{
+    std::lock_guard<std::mutex> lock(SetValueMutex);
+    Dirty = false;
+    DeviceValue = Value;
+    return DeviceValue;
+}
+
+TRegisterHandler::TErrorState TRegisterHandler::FinishFlush(const std::string& error)
+{
+    if (error.empty())
+        return UpdateWriteError(false);
+
+    std::ios::fmtflags f(std::cerr.flags());
+    std::cerr << "TRegisterHandler::Flush(): warning: " << error << " for device " <<
+        Reg->Device()->ToString() <<  std::endl;
+    std::cerr.flags(f);
+    return UpdateWriteError(true);
 }
 
 uint64_t TRegisterHandler::InvertWordOrderIfNeeded(const uint64_t value) const
@@ -198,13 +215,19 @@ std::string TRegisterHandler::ConvertSlaveValue(uint64_t value) const
 
 void TRegisterHandler::SetTextValue(const std::string& v)
 {
+    bool was_dirty;
     {
         // don't hold the lock while notifying the client below
         std::lock_guard<std::mutex> lock(SetValueMutex);
-        Dirty = true;
+        was_dirty = Dirty.exchange(true);
         Value = InvertWordOrderIfNeeded(ConvertMasterValue(v));
     }
-    FlushNeeded->Signal();
+    // the register is queued once until it's flushed, values set
+    // meanwhile replace the pending one
+    if (!was_dirty)
+        FlushQueue->Push(Reg->Slot);
+    else
+        DroppedValues.fetch_add(1, std::memory_order_relaxed);
 }
 
 uint64_t TRegisterHandler::ConvertMasterValue(const std::string& str) const
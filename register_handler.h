@@ -1,12 +1,13 @@
 #pragma once
 #include <cmath>
 #include <mutex>
+#include <atomic>
 #include <memory>
 #include <string>
 #include <wbmqtt/utils.h>
 #include "register.h"
 #include "serial_device.h"
-#include "binary_semaphore.h"
+#include "flush_queue.h"
 #include "bcd_utils.h"
 
 class TRegisterHandler
@@ -20,15 +21,25 @@ public:
         UnknownErrorState,
         ErrorStateUnchanged
     };
-    TRegisterHandler(PSerialDevice dev, PRegister reg, PBinarySemaphore flush_needed, bool debug = false);
-    PRegister Register() const { return Reg; }
+    TRegisterHandler(PSerialDevice dev, PRegister reg, PFlushQueue flush_queue, bool debug = false);
+    const PRegister& Register() const { return Reg; }
     bool NeedToPoll();
     TErrorState AcceptDeviceValue(uint64_t new_value, bool ok, bool* changed);
     bool NeedToFlush();
     TErrorState Flush();
+    // Flush() in two steps for the writes made by the client: take the
+    // value to write, then accept the result (error is empty on success)
+    uint64_t PrepareFlush();
+    TErrorState FinishFlush(const std::string& error);
     std::string TextValue() const;
 
     void SetTextValue(const std::string& v);
+    // Values replaced by newer ones before being written
+    uint64_t DroppedValueCount() const { return DroppedValues; }
+    // Values set until this time after the last write are conflated, see
+    // TRegisterConfig::WriteConflation. Only for the polling thread.
+    TTimePoint ConflationEnd() const { return LastWriteTime + Reg->WriteConflation; }
+    void SetWriteTime(const TTimePoint& time) { LastWriteTime = time; }
     bool DidRead() const { return DidReadReg; }
     TErrorState CurrentErrorState() const { return ErrorState; }
     PSerialDevice Device() const { return Dev.lock(); }
@@ -46,12 +57,18 @@ private:
 
     std::weak_ptr<TSerialDevice> Dev;
     uint64_t Value = 0;
+    // Value as last read from or written to the device. Only the
+    // polling thread uses it, so unchanged values are recognized
+    // without taking SetValueMutex.
+    uint64_t DeviceValue = 0;
     PRegister Reg;
-    volatile bool Dirty = false;
+    std::atomic<bool> Dirty;
+    std::atomic<uint64_t> DroppedValues{ 0 };
+    TTimePoint LastWriteTime = TTimePoint::min();
     bool DidReadReg = false;
     std::mutex SetValueMutex;
     TErrorState ErrorState = UnknownErrorState;
-    PBinarySemaphore FlushNeeded;
+    PFlushQueue FlushQueue;
     bool Debug;
 };
 
@@ -1,29 +1,66 @@
+#include <cmath>
+#include <algorithm>
 #include <unistd.h>
 #include <unordered_map>
 #include <iostream>
 
 #include "serial_client.h"
 
-namespace {
-    struct TSerialPollEntry: public TPollEntry {
-        TSerialPollEntry(PRegisterRange range) {
-            Ranges.push_back(range);
-        }
-        std::chrono::milliseconds PollInterval() const {
-            return Ranges.front()->PollInterval();
+std::list<PSerialPollEntry> TSerialPollEntry::Create(PSerialDevice dev, std::list<PRegister> regs,
+                                                     bool shared_bus)
+{
+    regs.sort([](const PRegister& a, const PRegister& b) {
+            return a->Type < b->Type || (a->Type == b->Type && a->Address < b->Address);
+        });
+
+    // Join multiple ranges with same poll period and
+    // priority into a single scheduling entry. This is necessary because
+    // switching between devices may require extra
+    // delays. This is far from being an ideal solution
+    // though.
+    std::list<PSerialPollEntry> entries;
+    std::map<std::pair<long long, EPriorityClass>, PSerialPollEntry> interval_map;
+    for (auto range: dev->SplitRegisterList(regs)) {
+        PSerialPollEntry entry;
+        auto key = std::make_pair(range->PollInterval().count(), range->Priority());
+        auto it = interval_map.find(key);
+        if (it == interval_map.end()) {
+            entry = std::make_shared<TSerialPollEntry>(range);
+            interval_map[key] = entry;
+            entries.push_back(entry);
+        } else {
+            entry = it->second;
+            entry->Ranges.push_back(range);
         }
-        std::list<PRegisterRange> Ranges;
-    };
-    typedef std::shared_ptr<TSerialPollEntry> PSerialPollEntry;
-};
+    }
+
+    for (const auto& entry: entries)
+        entry->UpdateDuration(shared_bus);
+    return entries;
+}
+
+void TSerialPollEntry::UpdateDuration(bool shared_bus)
+{
+    auto dev = Ranges.front()->Device();
+    Duration = std::chrono::microseconds::zero();
+    for (const auto& range: Ranges)
+        Duration += dev->EstimateReadDuration(range);
+    // Each entry holds ranges of a single device, so polling it
+    // costs a device switch if there are other devices on the port
+    if (Duration.count() && shared_bus)
+        Duration += dev->DeviceConfig()->Delay;
+}
 
 TSerialClient::TSerialClient(PPort port)
     : Port(port),
       Active(false),
+      Stopping(false),
       ReadCallback([](PRegister, bool){}),
       ErrorCallback([](PRegister, bool){}),
       FlushNeeded(new TBinarySemaphore),
-      Plan(std::make_shared<TPollPlan>([this]() { return Port->CurrentTime(); })) {}
+      FlushQueue(std::make_shared<TFlushQueue>(FlushNeeded, [this]() { return Port->CurrentTime(); })),
+      Plan(std::make_shared<TPollPlan>([this]() { return Port->CurrentTime(); })),
+      Random(std::random_device()()) {}
 
 TSerialClient::~TSerialClient()
 {
@@ -31,46 +68,125 @@ TSerialClient::~TSerialClient()
         Disconnect();
 
     // remove all registered devices
+    ApplyPendingChanges();
     for (auto &dev : DevicesList)
         TSerialDeviceFactory::RemoveDevice(dev);
 }
 
 PSerialDevice TSerialClient::CreateDevice(PDeviceConfig device_config)
 {
-    if (Active)
-        throw TSerialDeviceException("can't add registers to the active client");
     if (Debug)
         std::cerr << "CreateDevice: " << device_config->Id <<
             (device_config->DeviceType.empty() ? "" : " (" + device_config->DeviceType + ")") <<
             " @ " << device_config->SlaveId << " -- protocol: " << device_config->Protocol << std::endl;
 
     try {
+        std::lock_guard<std::mutex> lock(ChangesMutex);
         PSerialDevice dev = TSerialDeviceFactory::CreateDevice(device_config, Port);
-        DevicesList.push_back(dev);
+        PendingChanges.push_back({TDeviceChange::DEVICE_CREATED, dev, nullptr});
         return dev;
     } catch (const TSerialDeviceException& e) {
-        Disconnect();
+        if (!Active)
+            Disconnect();
         throw;
     }
 }
 
 void TSerialClient::AddRegister(PRegister reg)
 {
-    if (Active)
-        throw TSerialDeviceException("can't add registers to the active client");
-    if (Handlers.find(reg) != Handlers.end())
-        throw TSerialDeviceException("duplicate register");
-    auto handler = Handlers[reg] = std::make_shared<TRegisterHandler>(reg->Device(), reg, FlushNeeded, Debug);
-    RegList.push_back(reg);
+    {
+        std::lock_guard<std::mutex> lock(HandlersMutex);
+        if (reg->Slot < Handlers.size() && Handlers[reg->Slot] && Handlers[reg->Slot]->Register() == reg)
+            throw TSerialDeviceException("duplicate register");
+        if (FreeSlots.empty()) {
+            reg->Slot = Handlers.size();
+            Handlers.emplace_back();
+        } else {
+            reg->Slot = FreeSlots.back();
+            FreeSlots.pop_back();
+        }
+        Handlers[reg->Slot] = std::make_shared<TRegisterHandler>(reg->Device(), reg, FlushQueue, Debug);
+    }
+    {
+        std::lock_guard<std::mutex> lock(ChangesMutex);
+        PendingChanges.push_back({TDeviceChange::REGISTER_ADDED, reg->Device(), reg});
+    }
     if (Debug)
         std::cerr << "AddRegister: " << reg << std::endl;
 }
 
+void TSerialClient::RemoveDevice(PSerialDevice dev)
+{
+    if (Debug)
+        std::cerr << "RemoveDevice: " << dev->ToString() << std::endl;
+    // the values of the device can't be set or read from now on,
+    // its entries are left in the poll plan until the next Cycle()
+    {
+        std::lock_guard<std::mutex> lock(HandlersMutex);
+        for (auto& handler: Handlers) {
+            if (handler && handler->Device() == dev)
+                handler.reset();
+        }
+    }
+    std::lock_guard<std::mutex> lock(ChangesMutex);
+    PendingChanges.push_back({TDeviceChange::DEVICE_REMOVED, dev, nullptr});
+    TSerialDeviceFactory::RemoveDevice(dev);
+}
+
+bool TSerialClient::ApplyPendingChanges()
+{
+    std::vector<TDeviceChange> changes;
+    {
+        std::lock_guard<std::mutex> lock(ChangesMutex);
+        changes.swap(PendingChanges);
+    }
+
+    bool removed = false;
+    for (const auto& change: changes) {
+        const auto& dev = change.Device;
+        switch (change.Kind) {
+        case TDeviceChange::DEVICE_CREATED:
+            DevicesList.push_back(dev);
+            break;
+        case TDeviceChange::REGISTER_ADDED:
+            RegList.push_back(change.Register);
+            if (Active)
+                ChangedDevices.insert(dev);
+            break;
+        case TDeviceChange::DEVICE_REMOVED:
+            RemoveDeviceEntries(dev);
+            ChangedDevices.erase(dev);
+            {
+                // the handlers were reset by RemoveDevice(), so the
+                // slots may be taken by the registers added later
+                std::lock_guard<std::mutex> lock(HandlersMutex);
+                for (const auto& reg: RegList) {
+                    if (reg->Device() == dev)
+                        FreeSlots.push_back(reg->Slot);
+                }
+            }
+            RegList.remove_if([&dev](const PRegister& reg) { return reg->Device() == dev; });
+            DevicesList.remove(dev);
+            ReconnectBackoffs.erase(dev);
+            DeadBusTimes.erase(dev);
+            CycleStatuses.erase(dev);
+            ProbeFailures.erase(dev);
+            Bisections.erase(dev);
+            if (LastAccessedDevice == dev)
+                LastAccessedDevice = 0;
+            removed = true;
+            break;
+        }
+    }
+    return removed;
+}
+
 void TSerialClient::Connect()
 {
     if (Active)
         return;
-    if (!Handlers.size())
+    ApplyPendingChanges();
+    if (RegList.empty())
         throw TSerialDeviceException("no registers defined");
     if (!Port->IsOpen())
         Port->Open();
@@ -89,35 +205,17 @@ void TSerialClient::PrepareRegisterRanges()
 {
     // all of this is seemingly slow but it's actually only done once
     Plan->Reset();
+    DeviceEntries.clear();
+    CycleStatuses.clear();
+    PreemptedPasses = 0;
+    ChangedDevices.clear();
     PSerialDevice last_device(0);
     std::list<PRegister> cur_regs;
     auto it = RegList.begin();
-    std::list<PSerialPollEntry> entries;
-    std::unordered_map<long long, PSerialPollEntry> interval_map;
     for (;;) {
         bool at_end = it == RegList.end();
         if ((at_end || (*it)->Device() != last_device) && !cur_regs.empty()) {
-            cur_regs.sort([](const PRegister& a, const PRegister& b) {
-                    return a->Type < b->Type || (a->Type == b->Type && a->Address < b->Address);
-                });
-            interval_map.clear();
-
-            // Join multiple ranges with same poll period into a
-            // single scheduling entry. This is necessary because
-            // switching between devices may require extra
-            // delays. This is far from being an ideal solution
-            // though.
-            for (auto range: last_device->SplitRegisterList(cur_regs)) {
-                PSerialPollEntry entry;
-                long long interval = range->PollInterval().count();
-                auto it = interval_map.find(interval);
-                if (it == interval_map.end()) {
-                    entry = std::make_shared<TSerialPollEntry>(range);
-                    interval_map[interval] = entry;
-                    Plan->AddEntry(entry);
-                } else
-                    it->second->Ranges.push_back(range);
-            }
+            AddDeviceEntries(last_device, std::move(cur_regs));
             cur_regs.clear();
         }
         if (at_end)
@@ -125,35 +223,346 @@ void TSerialClient::PrepareRegisterRanges()
         last_device = (*it)->Device();
         cur_regs.push_back(*it++);
     }
+
+    AdmitPollIntervals();
 }
 
-void TSerialClient::SplitRegisterRanges(std::set<PRegisterRange> && ranges)
+void TSerialClient::AddDeviceEntries(PSerialDevice dev, std::list<PRegister> regs)
 {
-    if (ranges.empty()) {
+    auto& device_entries = DeviceEntries[dev];
+    for (const auto& entry: TSerialPollEntry::Create(dev, std::move(regs), DevicesList.size() > 1)) {
+        for (const auto& range: entry->Ranges)
+            BindHandlers(range);
+        entry->Handle = Plan->AddEntry(entry);
+        device_entries.push_back(entry);
+    }
+}
+
+void TSerialClient::BindHandlers(PRegisterRange range) const
+{
+    std::vector<PRegisterHandler> handlers;
+    handlers.reserve(range->RegisterList().size());
+    std::lock_guard<std::mutex> lock(HandlersMutex);
+    for (const auto& reg: range->RegisterList())
+        handlers.push_back(Handlers[reg->Slot]);
+    range->SetHandlers(handlers);
+}
+
+void TSerialClient::RemoveDeviceEntries(PSerialDevice dev)
+{
+    auto it = DeviceEntries.find(dev);
+    if (it == DeviceEntries.end())
         return;
+    for (const auto& entry: it->second)
+        Plan->RemoveEntry(entry->Handle);
+    DeviceEntries.erase(it);
+}
+
+void TSerialClient::UpdateEntryDurations()
+{
+    for (const auto& p: DeviceEntries) {
+        for (const auto& entry: p.second) {
+            entry->UpdateDuration(DevicesList.size() > 1);
+            Plan->UpdateEntry(entry->Handle);
+        }
     }
+}
 
-    Plan->Modify([&](const PPollEntry & entry){
-        if (auto serial_entry = std::dynamic_pointer_cast<TSerialPollEntry>(entry)) {
-            for (auto itRange = serial_entry->Ranges.begin(); itRange != serial_entry->Ranges.end();) {
-                if (ranges.count(*itRange)) {
-                    auto device = (*itRange)->Device();
+void TSerialClient::UpdateChangedDevices()
+{
+    bool shared_bus = DevicesList.size() > 1;
+    bool removed = ApplyPendingChanges();
+    // entries include a device switch only if the bus is shared
+    bool shared_bus_changed = shared_bus != (DevicesList.size() > 1);
+    if (shared_bus_changed)
+        UpdateEntryDurations();
+    if (ChangedDevices.empty()) {
+        // removing devices frees bus time for the rest
+        if (removed || shared_bus_changed)
+            AdmitPollIntervals();
+        return;
+    }
+
+    // Only entries of the changed devices are rebuilt, the rest
+    // of the plan keeps its schedule
+    std::unordered_map<PSerialDevice, std::list<PRegister>> regs;
+    for (const auto& reg: RegList) {
+        if (ChangedDevices.count(reg->Device()))
+            regs[reg->Device()].push_back(reg);
+    }
+    for (const auto& dev: ChangedDevices) {
+        RemoveDeviceEntries(dev);
+        AddDeviceEntries(dev, std::move(regs[dev]));
+    }
+    ChangedDevices.clear();
+
+    AdmitPollIntervals();
+}
+
+void TSerialClient::AdmitPollIntervals()
+{
+    double load = Plan->GetPredictedLoad();
+    if (Debug)
+        std::cerr << "Predicted bus load: " << std::lround(load * 100) << "%" << std::endl;
+
+    // The bus can't keep up with configured poll intervals. Without
+    // this they would all be stretched anyway, but unevenly and
+    // without any notice, so slow them down proportionally instead.
+    // The scale is chosen anew after every change of the devices,
+    // so the intervals shrink back once the load goes down.
+    double scale = load > MAX_BUS_LOAD ? load / MAX_BUS_LOAD : 1;
+    if (scale == Plan->GetIntervalScale())
+        return;
+    if (scale > 1)
+        std::cerr << "Warning: configured poll intervals require " << std::lround(load * 100) <<
+            "% of bus time, which is not possible; stretching all poll intervals by " <<
+            std::lround(scale * 100) / 100.0 << " times" << std::endl;
+    else
+        std::cerr << "Predicted bus load is " << std::lround(load * 100) <<
+            "%, polling at configured intervals again" << std::endl;
+    Plan->SetIntervalScale(scale);
+}
+
+namespace {
+    // Address to cut the sorted registers at: in the middle of the holes
+    // if there are any, as they are the likely cause of the error, in the
+    // middle of the registers otherwise
+    int ChooseCut(const std::vector<PRegister>& regs)
+    {
+        int total_hole = 0;
+        for (size_t i = 1; i < regs.size(); ++i)
+            total_hole += std::max(0, regs[i]->Address - (regs[i - 1]->Address + regs[i - 1]->Width()));
+
+        int double_middle = regs.front()->Address + regs.back()->Address + regs.back()->Width();
+        int cut = regs[1]->Address, best_score = -1, hole_before = 0;
+        for (size_t i = 1; i < regs.size(); ++i) {
+            int hole = std::max(0, regs[i]->Address - (regs[i - 1]->Address + regs[i - 1]->Width()));
+            hole_before += hole;
+            if (total_hole && !hole)
+                continue;
+            int score = total_hole ? std::abs(2 * hole_before - total_hole) :
+                std::abs(2 * regs[i]->Address - double_middle);
+            if (best_score < 0 || score < best_score) {
+                best_score = score;
+                cut = regs[i]->Address;
+            }
+        }
+        return cut;
+    }
+
+    // Ranges with holes are bisected if the device rejects them (see
+    // TRegisterRange::NeedsSplit()), devices that learn their read limits
+    // get any rejected range bisected
+    bool ShouldBisect(PRegisterRange range)
+    {
+        return range->NeedsSplit() || (range->Device()->DeviceConfig()->AutoReadLimits &&
+                                       range->IsRejected() && range->RegisterList().size() > 1);
+    }
+
+    bool IsSingleUnavailable(PRegisterRange range)
+    {
+        if (range->RegisterList().size() != 1)
+            return false;
+        const auto& reg = range->RegisterList().front();
+        return range->Device()->ReadLimits().Unavailable.count(std::make_pair(reg->Type, reg->Address)) > 0;
+    }
+};
+
+void TSerialClient::BisectRejectedRanges(const std::list<PRegisterRange>& polled)
+{
+    std::map<PSerialDevice, std::list<PRegisterRange>> device_ranges;
+    for (const auto& range: polled) {
+        auto device = range->Device();
+        if (ShouldBisect(range) || Bisections.count(device))
+            device_ranges[device].push_back(range);
+    }
+
+    for (const auto& p: device_ranges) {
+        const auto& device = p.first;
+        auto limits = device->ReadLimits();
+        auto& bisections = Bisections[device];
+        bool changed = false;
+
+        auto add_boundary = [&](TRangeBisection& bisection, int address) {
+            if (limits.Boundaries.insert(std::make_pair(bisection.Type, address)).second) {
+                bisection.Added.insert(address);
+                changed = true;
+            }
+        };
+        auto cut = [&](TRangeBisection& bisection, const std::vector<PRegister>& regs) {
+            int address = ChooseCut(regs);
+            bisection.Cuts[address] = std::make_pair(0, 0);
+            add_boundary(bisection, address);
+        };
 
-                    std::cerr << "Disabling holes feature for register range" << std::endl;
+        // Parts of ranges being bisected
+        std::set<PRegisterRange> handled;
+        for (auto& bisection: bisections) {
+            std::vector<int> points(1, bisection.Start);
+            for (const auto& c: bisection.Cuts)
+                points.push_back(c.first);
+            points.push_back(bisection.End);
 
-                    auto newRanges = device->SplitRegisterList((*itRange)->RegisterList(), false);
-                    serial_entry->Ranges.insert(itRange, newRanges.begin(), newRanges.end());
+            for (size_t i = 1; i < points.size(); ++i) {
+                // the part is read fine as a whole if all of its ranges are
+                std::vector<PRegister> regs;
+                int result = 1;
+                for (const auto& range: p.second) {
+                    const auto& first = range->RegisterList().front();
+                    if (!bisection.Registers.count(first) || first->Address < points[i - 1] || first->Address >= points[i])
+                        continue;
+                    handled.insert(range);
+                    regs.insert(regs.end(), range->RegisterList().begin(), range->RegisterList().end());
+                    if (range->IsRejected())
+                        result = -1;
+                    else if (result > 0 && range->GetStatus() != TRegisterRange::ST_OK)
+                        result = 0;
+                }
+                if (regs.empty() || !result)
+                    continue;
 
-                    ranges.erase(*itRange);
-                    itRange = serial_entry->Ranges.erase(itRange);
-                } else {
-                    ++itRange;
+                auto left = bisection.Cuts.find(points[i - 1]);
+                if (left != bisection.Cuts.end() && !left->second.second)
+                    left->second.second = result;
+                auto right = bisection.Cuts.find(points[i]);
+                if (right != bisection.Cuts.end() && !right->second.first)
+                    right->second.first = result;
+                if (result > 0)
+                    continue;
+
+                if (regs.size() > 1) {
+                    cut(bisection, regs);
+                    continue;
+                }
+                // the offending address is found
+                const auto& reg = regs.front();
+                std::cerr << "Device " << device->ToString() << ": " << reg->TypeName << " " <<
+                    reg->Address << " is unavailable, it won't be polled anymore" << std::endl;
+                limits.Unavailable.insert(std::make_pair(reg->Type, reg->Address));
+                for (int address: { reg->Address, reg->Address + reg->Width() }) {
+                    add_boundary(bisection, address);
+                    bisection.Permanent.insert(address);
                 }
+                changed = true;
             }
         }
 
-        return ranges.empty();
-    });
+        // New rejected ranges
+        for (const auto& range: p.second) {
+            if (handled.count(range) || !ShouldBisect(range))
+                continue;
+            std::cerr << "Device " << device->ToString() << " rejected reading " <<
+                range->RegisterList().size() << " " << range->TypeName() <<
+                "(s) at once, bisecting the range" << std::endl;
+            TRangeBisection bisection;
+            bisection.Type = range->Type();
+            bisection.Start = range->RegisterList().front()->Address;
+            bisection.End = range->RegisterList().back()->Address + range->RegisterList().back()->Width();
+            bisection.Registers.insert(range->RegisterList().begin(), range->RegisterList().end());
+            // keep the parts away from other registers until it's done
+            add_boundary(bisection, bisection.Start);
+            add_boundary(bisection, bisection.End);
+            cut(bisection, std::vector<PRegister>(range->RegisterList().begin(), range->RegisterList().end()));
+            bisections.push_back(bisection);
+        }
+
+        // Finished bisections only leave the boundaries between
+        // the parts that are readable apart but not together
+        for (auto it = bisections.begin(); it != bisections.end();) {
+            bool done = std::all_of(it->Cuts.begin(), it->Cuts.end(),
+                [](const std::pair<const int, std::pair<int, int>>& c) {
+                    return c.second.first && c.second.second;
+                });
+            if (!done) {
+                ++it;
+                continue;
+            }
+            for (int address: it->Added) {
+                auto c = it->Cuts.find(address);
+                bool needed = c != it->Cuts.end() && c->second.first > 0 && c->second.second > 0;
+                if (!needed && !it->Permanent.count(address))
+                    limits.Boundaries.erase(std::make_pair(it->Type, address));
+            }
+            if (Debug)
+                std::cerr << "Device " << device->ToString() << ": done bisecting " << it->End - it->Start <<
+                    " address(es) from " << it->Start << std::endl;
+            it = bisections.erase(it);
+            changed = true;
+        }
+        if (bisections.empty())
+            Bisections.erase(device);
+
+        if (changed) {
+            device->SetReadLimits(limits);
+            ResplitDeviceEntries(device);
+        }
+    }
+}
+
+void TSerialClient::ResplitDeviceEntries(PSerialDevice dev)
+{
+    // Read limits of the device have changed. Entries keep their
+    // registers and schedule, only the ranges are rebuilt.
+    for (const auto& entry: DeviceEntries[dev]) {
+        std::list<PRegister> regs;
+        for (const auto& range: entry->Ranges)
+            regs.insert(regs.end(), range->RegisterList().begin(), range->RegisterList().end());
+        entry->Ranges = dev->SplitRegisterList(regs);
+        for (const auto& range: entry->Ranges)
+            BindHandlers(range);
+        entry->UpdateDuration(DevicesList.size() > 1);
+        Plan->UpdateEntry(entry->Handle);
+    }
+}
+
+void TSerialClient::ProbeReadLimits(const TPollPlan::TTimePoint& deadline)
+{
+    for (const auto& dev: DevicesList) {
+        if (!dev->DeviceConfig()->AutoReadLimits || dev->GetIsDisconnected() ||
+            ProbeFailures[dev] >= MAX_PROBE_FAILURES)
+            continue;
+        for (;;) {
+            std::list<PRegisterRange> ranges;
+            for (const auto& entry: DeviceEntries[dev])
+                ranges.insert(ranges.end(), entry->Ranges.begin(), entry->Ranges.end());
+            auto probe = dev->NextReadLimitsProbe(ranges);
+            if (!probe)
+                break;
+            // probes only take the bus time nobody else needs, even
+            // if the device doesn't answer and the request times out
+            auto duration = dev->EstimateReadDuration(probe->Range) + Port->GetResponseTimeout();
+            if (dev != LastAccessedDevice)
+                duration += dev->DeviceConfig()->Delay;
+            if (Port->CurrentTime() + duration > deadline)
+                return;
+
+            PrepareToAccessDevice(dev);
+            dev->ReadRegisterRange(probe->Range);
+            bool rejected = probe->Range->IsRejected();
+            if (!rejected && probe->Range->GetStatus() != TRegisterRange::ST_OK) {
+                // no answer, try again during the next idle time
+                ++ProbeFailures[dev];
+                break;
+            }
+            ProbeFailures[dev] = 0;
+            if (Debug)
+                std::cerr << "device " << dev->ToString() << ": reading " <<
+                    probe->Range->RegisterList().size() << " " << probe->Range->TypeName() <<
+                    "(s) at once " << (rejected ? "is rejected" : "works") << std::endl;
+
+            auto limits = probe->Supported;
+            if (rejected) {
+                limits = dev->ReadLimits();
+                limits.Boundaries.insert(std::make_pair(probe->Range->Type(), probe->SplitAddress));
+            }
+            dev->SetReadLimits(limits);
+            ResplitDeviceEntries(dev);
+
+            // writes don't wait for probing
+            if (FlushNeeded->TryWait())
+                DoFlush();
+        }
+    }
 }
 
 void TSerialClient::MaybeUpdateErrorState(PRegister reg, TRegisterHandler::TErrorState state)
@@ -164,12 +573,94 @@ void TSerialClient::MaybeUpdateErrorState(PRegister reg, TRegisterHandler::TErro
 
 void TSerialClient::DoFlush()
 {
-    for (const auto& reg: RegList) {
-        auto handler = Handlers[reg];
+    FlushQueue->TakeAll(FlushItems);
+    // the held values were set before the ones just taken
+    size_t held_count = HeldWrites.size();
+    FlushItems.insert(FlushItems.begin(), HeldWrites.begin(), HeldWrites.end());
+    HeldWrites.clear();
+    HeldWritesEnd = TTimePoint::max();
+    auto time = Port->CurrentTime();
+
+    // group the writes by device, so a device may write
+    // adjacent registers with a single request
+    std::vector<TFlushGroup> groups;
+    for (size_t i = 0; i < FlushItems.size(); ++i) {
+        const auto& item = FlushItems[i];
+        // the register may have been removed after its value was set,
+        // a register that took its slot only flushes its own values
+        PRegisterHandler handler;
+        {
+            std::lock_guard<std::mutex> lock(HandlersMutex);
+            if (item.Id < Handlers.size())
+                handler = Handlers[item.Id];
+        }
+        if (!handler)
+            continue;
         if (!handler->NeedToFlush())
             continue;
-        PrepareToAccessDevice(handler->Device());
-        MaybeUpdateErrorState(reg, handler->Flush());
+        // written recently, values set meanwhile wait for the end of
+        // the conflation window replacing each other
+        if (time < handler->ConflationEnd()) {
+            if (i >= held_count)
+                ++ConflatedWriteCount;
+            HeldWrites.push_back(item);
+            HeldWritesEnd = std::min(HeldWritesEnd, handler->ConflationEnd());
+            continue;
+        }
+        auto dev = handler->Device();
+        // there are few devices on a port
+        auto it = std::find_if(groups.begin(), groups.end(),
+                               [&dev](const TFlushGroup& group) { return group.Device == dev; });
+        if (it == groups.end()) {
+            it = groups.emplace(groups.end());
+            it->Device = dev;
+        }
+        it->Handlers.push_back(handler);
+        it->SetTimes.push_back(item.Time);
+    }
+
+    for (const auto& group: groups) {
+        const auto& handlers = group.Handlers;
+        PrepareToAccessDevice(group.Device);
+        auto now = Port->CurrentTime();
+        for (const auto& set_time: group.SetTimes)
+            WriteLatency.Add(std::chrono::duration_cast<std::chrono::microseconds>(now - set_time));
+        for (const auto& handler: handlers)
+            handler->SetWriteTime(now);
+        WriteCount += handlers.size();
+        if (handlers.size() == 1) {
+            MaybeUpdateErrorState(handlers.front()->Register(), handlers.front()->Flush());
+        } else {
+            std::vector<TRegisterWrite> writes;
+            for (const auto& handler: handlers)
+                writes.push_back({ handler->Register(), handler->PrepareFlush(), "" });
+            group.Device->WriteRegisters(writes);
+            for (size_t i = 0; i < handlers.size(); ++i)
+                MaybeUpdateErrorState(handlers[i]->Register(), handlers[i]->FinishFlush(writes[i].Error));
+        }
+        ReadBack(group.Device, handlers);
+    }
+}
+
+void TSerialClient::ReadBack(PSerialDevice dev, const std::vector<PRegisterHandler>& handlers)
+{
+    std::list<PRegister> regs;
+    for (const auto& handler: handlers) {
+        // a newer value may have been set while writing
+        auto state = handler->CurrentErrorState();
+        if (handler->Register()->ReadBack && handler->NeedToPoll() &&
+            state != TRegisterHandler::WriteError && state != TRegisterHandler::ReadWriteError)
+            regs.push_back(handler->Register());
+    }
+    if (regs.empty())
+        return;
+    regs.sort([](const PRegister& a, const PRegister& b) {
+            return a->Type < b->Type || (a->Type == b->Type && a->Address < b->Address);
+        });
+    // only the written registers are read, not the whole poll ranges
+    for (const auto& range: dev->SplitRegisterList(regs, false)) {
+        BindHandlers(range);
+        PollRange(range);
     }
 }
 
@@ -182,9 +673,15 @@ void TSerialClient::WaitForPollAndFlush()
         return;
     }
     auto wait_until = Plan->GetNextPollTimePoint();
-    while (Port->Wait(FlushNeeded, wait_until)) {
+    ProbeReadLimits(wait_until);
+    // wake up for the held writes too, but don't wait if they are due
+    // already as the time may have passed while writing
+    while (HeldWritesDue() || Port->Wait(FlushNeeded, std::min(wait_until, HeldWritesEnd)) ||
+           HeldWritesDue()) {
         // Don't hold the lock while flushing
         DoFlush();
+        if (Stopping)
+            return;
         if (Plan->PollIsDue()) {
             MaybeFlushAvoidingPollStarvationButDontWait();
             return;
@@ -196,8 +693,28 @@ void TSerialClient::MaybeFlushAvoidingPollStarvationButDontWait()
 {
     // avoid poll starvation
     int flush_count_remaining = MAX_FLUSHES_WHEN_POLL_IS_DUE;
-    while (flush_count_remaining-- && FlushNeeded->TryWait())
+    while (flush_count_remaining-- && (FlushNeeded->TryWait() || HeldWritesDue()))
+        DoFlush();
+}
+
+bool TSerialClient::HeldWritesDue() const
+{
+    return Port->CurrentTime() >= HeldWritesEnd;
+}
+
+void TSerialClient::PreemptPollForWrites()
+{
+    TTimePoint oldest;
+    if (HeldWritesDue()) {
         DoFlush();
+        return;
+    }
+    if (!FlushQueue->OldestTime(oldest) || Port->CurrentTime() - oldest < MaxWriteLatency)
+        return;
+    // everything pushed before is taken by DoFlush(),
+    // pushes after it signal again
+    FlushNeeded->TryWait();
+    DoFlush();
 }
 
 void TSerialClient::PollRange(PRegisterRange range)
@@ -205,78 +722,123 @@ void TSerialClient::PollRange(PRegisterRange range)
     PSerialDevice dev = range->Device();
     PrepareToAccessDevice(dev);
     dev->ReadRegisterRange(range);
-    range->MapRange([this, &range](PRegister reg, uint64_t new_value) {
+    // handlers are bound when the range is created
+    const auto& handlers = range->Handlers();
+
+    // The device sent the same data as the last time and nothing was
+    // written since the values were passed to the handlers, so neither
+    // values nor error states can change. Only the unchanged reads are
+    // reported if the callback needs them.
+    if (range->IsUnchanged() && range->MappedWriteCount() == WriteCount) {
+        if (!ReportUnchanged)
+            return;
+        for (const auto& handler: handlers) {
+            if (handler->NeedToPoll() &&
+                handler->CurrentErrorState() != TRegisterHandler::ReadError &&
+                handler->CurrentErrorState() != TRegisterHandler::ReadWriteError)
+                ReadCallback(handler->Register(), false);
+        }
+        return;
+    }
+    range->SetMappedWriteCount(WriteCount);
+
+    range->ForEachValue([this, &handlers](size_t i, uint64_t new_value) {
             bool changed;
-            auto handler = Handlers[reg];
+            const auto& handler = handlers[i];
 
             if (handler->NeedToPoll()) {
-                MaybeUpdateErrorState(reg, handler->AcceptDeviceValue(new_value, true, &changed));
+                MaybeUpdateErrorState(handler->Register(), handler->AcceptDeviceValue(new_value, true, &changed));
                 // Note that handler->CurrentErrorState() is not the
                 // same as the value returned by handler->AcceptDeviceValue(...),
                 // because the latter may be ErrorStateUnchanged.
                 if (handler->CurrentErrorState() != TRegisterHandler::ReadError &&
                     handler->CurrentErrorState() != TRegisterHandler::ReadWriteError)
-                    ReadCallback(reg, changed);
+                    ReadCallback(handler->Register(), changed);
             }
-        }, [this, &range](PRegister reg) {
+        }, [this, &handlers](size_t i) {
             bool changed;
-            auto handler = Handlers[reg];
+            const auto& handler = handlers[i];
 
             if (handler->NeedToPoll())
                 // TBD: separate AcceptDeviceReadError method (changed is unused here)
-                MaybeUpdateErrorState(reg, handler->AcceptDeviceValue(0, false, &changed));
+                MaybeUpdateErrorState(handler->Register(), handler->AcceptDeviceValue(0, false, &changed));
         });
 }
 
 void TSerialClient::Cycle()
 {
     Connect();
+    UpdateChangedDevices();
 
     Port->CycleBegin();
 
     WaitForPollAndFlush();
+    if (Stopping)
+        return;
 
-    // devices whose registers were polled during this cycle and statues
-    std::map<PSerialDevice, std::set<TRegisterRange::EStatus>> devicesRangesStatuses;
-    // ranges that needs to split
-    std::set<PRegisterRange> rangesToSplit;
+    // ranges polled during this pass
+    std::list<PRegisterRange> polledRanges;
 
     Plan->ProcessPending([&](const PPollEntry& entry) {
         for (auto range: std::dynamic_pointer_cast<TSerialPollEntry>(entry)->Ranges) {
+            // the device is known to reject reading it
+            if (IsSingleUnavailable(range))
+                continue;
             auto device = range->Device();
-            auto & statuses = devicesRangesStatuses[device];
-
-            if (device->GetIsDisconnected()) {
-                // limited polling mode
-                if (statuses.empty()) {
-                    // First interaction with disconnected device within this cycle: Try to reconnect
-                    if (device->HasSetupItems()) {
-                        auto wrote = device->WriteSetupRegisters(false);
-                        statuses.insert(wrote ? TRegisterRange::ST_OK : TRegisterRange::ST_UNKNOWN_ERROR);
-                        if (!wrote) {
-                            continue;
-                        }
-                    }
-                } else {
-                    // Not first interaction with disconnected device that has only errors - still disconnected
-                    if (statuses.count(TRegisterRange::ST_UNKNOWN_ERROR) == statuses.size()) {
-                        continue;
-                    }
-                }
-            }
+            auto & statuses = CycleStatuses[device];
+            bool disconnected = device->GetIsDisconnected();
+            auto start = Port->CurrentTime();
 
-            PollRange(range);
-            statuses.insert(range->GetStatus());
-            if (range->NeedsSplit()) {
-                rangesToSplit.insert(range);
+            if (!disconnected || ProbeDisconnectedDevice(device, statuses)) {
+                PollRange(range);
+                statuses.insert(range->GetStatus());
+                polledRanges.push_back(range);
             }
+
+            if (disconnected)
+                DeadBusTimes[device] += std::chrono::duration_cast<std::chrono::microseconds>(
+                    Port->CurrentTime() - start);
+            // an entry may take long to poll, writes don't wait for its end
+            PreemptPollForWrites();
         }
         MaybeFlushAvoidingPollStarvationButDontWait();
     });
 
-    for (const auto & deviceRangesStatuses: devicesRangesStatuses) {
-        const auto & device = deviceRangesStatuses.first;
-        const auto & statuses = deviceRangesStatuses.second;
+    const auto& stats = Plan->GetLastPassStats();
+    SwitchesAvoided += stats.SwitchesAvoided;
+    SwitchTimeSaved += stats.SwitchTimeSaved;
+    if (Debug) {
+        if (stats.SwitchesAvoided)
+            std::cerr << "Poll cycle: device switches avoided: " << stats.SwitchesAvoided <<
+                ", sleep time saved: " <<
+                std::chrono::duration_cast<std::chrono::milliseconds>(stats.SwitchTimeSaved).count() <<
+                " ms" << std::endl;
+
+        for (int i = 0; i < PRIORITY_CLASS_COUNT; ++i) {
+            auto priority = static_cast<EPriorityClass>(i);
+            auto count = Plan->GetStarvationCount(priority);
+            if (count != ReportedStarvationCounts[i]) {
+                ReportedStarvationCounts[i] = count;
+                std::cerr << "Poll cycle: " << PriorityClassName(priority) <<
+                    " poll intervals missed: " << count << std::endl;
+            }
+        }
+    }
+
+    // A preempted pass is finished by the next one, the devices and the
+    // port are only told how the cycle went after the whole of it
+    if (stats.Preempted && ++PreemptedPasses < MAX_PREEMPTED_PASSES) {
+        BisectRejectedRanges(polledRanges);
+        return;
+    }
+    PreemptedPasses = 0;
+
+    // in the order of the devices, not of their addresses in memory
+    for (const auto & device: DevicesList) {
+        auto deviceRangesStatuses = CycleStatuses.find(device);
+        if (deviceRangesStatuses == CycleStatuses.end())
+            continue;
+        const auto & statuses = deviceRangesStatuses->second;
 
         if (statuses.empty()) {
             std::cerr << "invariant violation: statuses empty @ " << __func__ << std::endl;
@@ -292,9 +854,14 @@ void TSerialClient::Cycle()
         if (deviceWasDisconnected && !device->GetIsDisconnected()) {
             OnDeviceReconnect(device);
         }
+
+        if (device->GetIsDisconnected())
+            ScheduleReconnect(device);
     }
 
-    SplitRegisterRanges(std::move(rangesToSplit));
+    CycleStatuses.clear();
+
+    BisectRejectedRanges(polledRanges);
 
     for (const auto& p: DevicesList) {
         p->EndPollCycle();
@@ -310,6 +877,71 @@ void TSerialClient::Cycle()
     }
 }
 
+bool TSerialClient::ProbeDisconnectedDevice(PSerialDevice device, std::set<TRegisterRange::EStatus>& statuses)
+{
+    // limited polling mode
+    if (statuses.empty()) {
+        // First interaction with disconnected device within this cycle: Try to reconnect
+        if (device->HasSetupItems()) {
+            auto wrote = device->WriteSetupRegisters(false);
+            statuses.insert(wrote ? TRegisterRange::ST_OK : TRegisterRange::ST_UNKNOWN_ERROR);
+            return wrote;
+        }
+        return true;
+    }
+    // Not first interaction with disconnected device that has only errors - still disconnected
+    return statuses.count(TRegisterRange::ST_UNKNOWN_ERROR) != statuses.size();
+}
+
+void TSerialClient::ScheduleReconnect(PSerialDevice dev)
+{
+    auto config = dev->DeviceConfig();
+    if (config->ReconnectBackoff == std::chrono::milliseconds::zero())
+        return;
+
+    // The device has just failed to reconnect (or got disconnected),
+    // so keep its entries away from the bus for a while
+    auto it = ReconnectBackoffs.find(dev);
+    auto backoff = it == ReconnectBackoffs.end() ? config->ReconnectBackoff :
+        std::min(it->second * 2, config->ReconnectBackoffMax);
+    ReconnectBackoffs[dev] = backoff;
+
+    // Spread attempts of devices that got disconnected at once
+    auto delay = backoff;
+    if (config->ReconnectJitterPercent > 0) {
+        long long jitter = backoff.count() * config->ReconnectJitterPercent / 100;
+        delay += std::chrono::milliseconds(
+            std::uniform_int_distribution<long long>(-jitter, jitter)(Random));
+    }
+
+    if (Debug)
+        std::cerr << "device " << dev->ToString() << ": next reconnect attempt in " <<
+            delay.count() << " ms" << std::endl;
+    Plan->ParkGroup(dev.get(), Port->CurrentTime() + delay);
+}
+
+std::chrono::milliseconds TSerialClient::GetDeadBusTime(PSerialDevice dev) const
+{
+    auto it = DeadBusTimes.find(dev);
+    return it == DeadBusTimes.end() ? std::chrono::milliseconds::zero() :
+        std::chrono::duration_cast<std::chrono::milliseconds>(it->second);
+}
+
+TReadLimits TSerialClient::GetLearnedReadLimits(PSerialDevice dev) const
+{
+    auto limits = dev->ReadLimits();
+    auto it = Bisections.find(dev);
+    if (it == Bisections.end())
+        return limits;
+    for (const auto& bisection: it->second) {
+        for (int address: bisection.Added) {
+            if (!bisection.Permanent.count(address))
+                limits.Boundaries.erase(std::make_pair(bisection.Type, address));
+        }
+    }
+    return limits;
+}
+
 bool TSerialClient::WriteSetupRegisters(PSerialDevice dev)
 {
     Connect();
@@ -317,6 +949,12 @@ bool TSerialClient::WriteSetupRegisters(PSerialDevice dev)
     return dev->WriteSetupRegisters();
 }
 
+void TSerialClient::Stop()
+{
+    Stopping = true;
+    FlushNeeded->Signal();
+}
+
 void TSerialClient::SetTextValue(PRegister reg, const std::string& value)
 {
     GetHandler(reg)->SetTextValue(value);
@@ -337,6 +975,11 @@ void TSerialClient::SetReadCallback(const TSerialClient::TReadCallback& callback
     ReadCallback = callback;
 }
 
+void TSerialClient::SetReportUnchanged(bool report)
+{
+    ReportUnchanged = report;
+}
+
 void TSerialClient::SetErrorCallback(const TSerialClient::TErrorCallback& callback)
 {
     ErrorCallback = callback;
@@ -346,14 +989,74 @@ void TSerialClient::SetDebug(bool debug)
 {
     Debug = debug;
     Port->SetDebug(debug);
-    for (const auto& p: Handlers)
-        p.second->SetDebug(debug);
+    std::lock_guard<std::mutex> lock(HandlersMutex);
+    for (const auto& handler: Handlers) {
+        if (handler)
+            handler->SetDebug(debug);
+    }
 }
 
 bool TSerialClient::DebugEnabled() const {
     return Debug;
 }
 
+void TSerialClient::SetGridPolling(bool grid)
+{
+    Plan->SetGridScheduling(grid);
+}
+
+void TSerialClient::SetPriorityWeights(const std::vector<int>& weights)
+{
+    for (int i = 0; i < PRIORITY_CLASS_COUNT && i < (int)weights.size(); ++i)
+        Plan->SetClassWeight(static_cast<EPriorityClass>(i), weights[i]);
+}
+
+double TSerialClient::GetIntervalScale() const
+{
+    return Plan->GetIntervalScale();
+}
+
+long long TSerialClient::GetStarvationCount(EPriorityClass priority) const
+{
+    return Plan->GetStarvationCount(priority);
+}
+
+void TSerialClient::SetMaxWriteLatency(std::chrono::milliseconds latency)
+{
+    MaxWriteLatency = latency;
+}
+
+const TLatencyHistogram& TSerialClient::GetWriteLatency() const
+{
+    return WriteLatency;
+}
+
+uint64_t TSerialClient::GetDroppedWriteCount() const
+{
+    uint64_t count = 0;
+    std::lock_guard<std::mutex> lock(HandlersMutex);
+    for (const auto& handler: Handlers) {
+        if (handler)
+            count += handler->DroppedValueCount();
+    }
+    return count;
+}
+
+uint64_t TSerialClient::GetConflatedWriteCount() const
+{
+    return ConflatedWriteCount;
+}
+
+long long TSerialClient::GetSwitchesAvoided() const
+{
+    return SwitchesAvoided;
+}
+
+std::chrono::milliseconds TSerialClient::GetSwitchTimeSaved() const
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(SwitchTimeSaved);
+}
+
 void TSerialClient::NotifyFlushNeeded()
 {
     FlushNeeded->Signal();
@@ -361,10 +1064,10 @@ void TSerialClient::NotifyFlushNeeded()
 
 PRegisterHandler TSerialClient::GetHandler(PRegister reg) const
 {
-    auto it = Handlers.find(reg);
-    if (it == Handlers.end())
+    std::lock_guard<std::mutex> lock(HandlersMutex);
+    if (reg->Slot >= Handlers.size() || !Handlers[reg->Slot] || Handlers[reg->Slot]->Register() != reg)
         throw TSerialDeviceException("register not found");
-    return it->second;
+    return Handlers[reg->Slot];
 }
 
 void TSerialClient::PrepareToAccessDevice(PSerialDevice dev)
@@ -381,4 +1084,6 @@ void TSerialClient::OnDeviceReconnect(PSerialDevice dev)
 		std::cerr << "device " << dev->ToString() << " reconnected" << std::endl;
 	}
 	dev->ResetUnavailableAddresses();
+	ProbeFailures.erase(dev);
+	ReconnectBackoffs.erase(dev);
 }
@@ -1,18 +1,64 @@
 #pragma once
 
+#include <atomic>
 #include <list>
 #include <memory>
+#include <mutex>
 #include <functional>
 #include <unordered_map>
+#include <unordered_set>
+#include <random>
 
 #include "poll_plan.h"
 #include "serial_device.h"
 #include "register_handler.h"
 #include "binary_semaphore.h"
+#include "flush_queue.h"
+#include "latency_histogram.h"
+
+struct TSerialPollEntry;
+typedef std::shared_ptr<TSerialPollEntry> PSerialPollEntry;
+
+// Poll plan entry that holds register ranges of a single device
+// with the same poll interval and priority class
+struct TSerialPollEntry: public TPollEntry {
+    TSerialPollEntry(PRegisterRange range) {
+        Ranges.push_back(range);
+    }
+    std::chrono::milliseconds PollInterval() const {
+        return Ranges.front()->PollInterval();
+    }
+    std::chrono::microseconds PredictedDuration() const {
+        return Duration;
+    }
+    const void* Group() const {
+        return Ranges.front()->Device().get();
+    }
+    std::chrono::microseconds SwitchCost() const {
+        return Ranges.front()->Device()->DeviceConfig()->Delay;
+    }
+    EPriorityClass PriorityClass() const {
+        return Ranges.front()->Priority();
+    }
+    // Split registers of the device into ranges and group them into
+    // entries. shared_bus means that there are other devices on the
+    // port, so polling an entry includes a device switch.
+    static std::list<PSerialPollEntry> Create(PSerialDevice dev, std::list<PRegister> regs, bool shared_bus);
+    // Predict Duration of the entry after its ranges have changed
+    void UpdateDuration(bool shared_bus);
+
+    std::list<PRegisterRange> Ranges;
+    std::chrono::microseconds Duration = std::chrono::microseconds::zero();
+    TPollPlan::THandle Handle = nullptr;
+};
 
 class TSerialClient: public std::enable_shared_from_this<TSerialClient>
 {
 public:
+    // Share of bus time that may be spent on polling, the rest is
+    // left for writes and retries
+    static constexpr double MAX_BUS_LOAD = 0.9;
+
     typedef std::function<void(PRegister reg, bool changed)> TReadCallback;
     typedef std::function<void(PRegister reg, TRegisterHandler::TErrorState errorState)> TErrorCallback;
 
@@ -21,49 +67,178 @@ public:
     TSerialClient& operator=(const TSerialClient&) = delete;
     ~TSerialClient();
 
+    // Devices and registers may be added and removed from any thread,
+    // also while the client is active. The changes are queued and the
+    // poll plan is updated incrementally at the start of the next Cycle().
     PSerialDevice CreateDevice(PDeviceConfig device_config);
     void AddRegister(PRegister reg);
+    void RemoveDevice(PSerialDevice dev);
     void Connect();
     void Disconnect();
     void Cycle();
+    // Makes Cycle() return without polling once the pending writes
+    // are done, for shutting down. May be called from any thread.
+    void Stop();
     void SetTextValue(PRegister reg, const std::string& value);
     std::string GetTextValue(PRegister reg) const;
     bool DidRead(PRegister reg) const;
     void SetReadCallback(const TReadCallback& callback);
+    // Whether the read callback is called for the values that haven't
+    // changed, true by default
+    void SetReportUnchanged(bool report);
     void SetErrorCallback(const TErrorCallback& callback);
     void SetDebug(bool debug);
     bool DebugEnabled() const;
+    void SetGridPolling(bool grid);
+    void SetPriorityWeights(const std::vector<int>& weights);
+    // Factor the configured poll intervals are stretched by
+    // because the bus can't keep up with them
+    double GetIntervalScale() const;
+    // Number of whole poll intervals missed by channels
+    // of the priority class because of bus contention
+    long long GetStarvationCount(EPriorityClass priority) const;
+    // Pending writes that have waited for this long are written between
+    // the ranges of a poll entry instead of after the whole entry
+    void SetMaxWriteLatency(std::chrono::milliseconds latency);
+    // Time from setting values to starting to write them
+    const TLatencyHistogram& GetWriteLatency() const;
+    // Values replaced by newer ones before being written
+    uint64_t GetDroppedWriteCount() const;
+    // Writes held back by the conflation windows of the channels
+    uint64_t GetConflatedWriteCount() const;
+    // Device switches avoided by grouping poll entries of the same
+    // device and the bus time saved by that, since the start
+    long long GetSwitchesAvoided() const;
+    std::chrono::milliseconds GetSwitchTimeSaved() const;
     void NotifyFlushNeeded();
     bool WriteSetupRegisters(PSerialDevice dev);
+    // Bus time spent on accessing the device while it was disconnected
+    std::chrono::milliseconds GetDeadBusTime(PSerialDevice dev) const;
+    // Read limits of the device without the boundaries that only
+    // stay until the range bisections in progress are finished
+    TReadLimits GetLearnedReadLimits(PSerialDevice dev) const;
 
 private:
     void PrepareRegisterRanges();
+    void AddDeviceEntries(PSerialDevice dev, std::list<PRegister> regs);
+    void RemoveDeviceEntries(PSerialDevice dev);
+    // Predict durations of all entries anew, e.g. after the port got
+    // a second device or was left with a single one
+    void UpdateEntryDurations();
+    // Returns whether any devices were removed
+    bool ApplyPendingChanges();
+    void UpdateChangedDevices();
+    void AdmitPollIntervals();
     void DoFlush();
     void WaitForPollAndFlush();
     void MaybeFlushAvoidingPollStarvationButDontWait();
+    void PreemptPollForWrites();
+    // Read the written registers that ask for it right away, so the
+    // values taken by the device are reported before their next poll
+    void ReadBack(PSerialDevice dev, const std::vector<PRegisterHandler>& handlers);
+    bool HeldWritesDue() const;
+    void BindHandlers(PRegisterRange range) const;
     void PollRange(PRegisterRange range);
     PRegisterHandler GetHandler(PRegister) const;
     void MaybeUpdateErrorState(PRegister reg, TRegisterHandler::TErrorState state);
     void PrepareToAccessDevice(PSerialDevice dev);
     void OnDeviceReconnect(PSerialDevice dev);
-    void SplitRegisterRanges(std::set<PRegisterRange> &&);
+    void BisectRejectedRanges(const std::list<PRegisterRange>& polled);
+    void ResplitDeviceEntries(PSerialDevice dev);
+    void ProbeReadLimits(const TPollPlan::TTimePoint& deadline);
+    bool ProbeDisconnectedDevice(PSerialDevice dev, std::set<TRegisterRange::EStatus>& statuses);
+    void ScheduleReconnect(PSerialDevice dev);
 
     PPort Port;
     std::list<PRegister> RegList;
     std::list<PSerialDevice> DevicesList; /* for EndPollCycle */
-    std::unordered_map<PRegister, PRegisterHandler> Handlers;
+    // indexed by TRegister::Slot, null for free slots
+    std::vector<PRegisterHandler> Handlers;
+    // slots of the registers of removed devices
+    std::vector<uint32_t> FreeSlots;
+    // Handlers are added and removed by the threads that add
+    // and remove registers, so every access has to lock
+    mutable std::mutex HandlersMutex;
+    std::unordered_map<PSerialDevice, std::list<PSerialPollEntry>> DeviceEntries;
+    // devices whose registers were added while the client was active
+    std::unordered_set<PSerialDevice> ChangedDevices;
+    // Devices and registers added or removed since the last Cycle(),
+    // in the order of the calls
+    struct TDeviceChange {
+        enum EKind { DEVICE_CREATED, REGISTER_ADDED, DEVICE_REMOVED } Kind;
+        PSerialDevice Device;
+        PRegister Register;
+    };
+    std::mutex ChangesMutex;
+    std::vector<TDeviceChange> PendingChanges;
 
-    bool Active;
+    std::atomic<bool> Active;
+    std::atomic<bool> Stopping;
     int PollInterval;
     TReadCallback ReadCallback;
+    bool ReportUnchanged = true;
     TErrorCallback ErrorCallback;
+    // registers written so far, ranges read after a write
+    // are passed to the handlers even if their data is the same
+    uint64_t WriteCount = 0;
     bool Debug = false;
     PSerialDevice LastAccessedDevice = 0;
     PBinarySemaphore FlushNeeded;
+    // registers with values set since the last flush, so flushing
+    // doesn't have to look through all the registers
+    PFlushQueue FlushQueue;
+    std::vector<TFlushQueue::TItem> FlushItems;
+    // values to write to a device, see DoFlush()
+    struct TFlushGroup {
+        PSerialDevice Device;
+        std::vector<PRegisterHandler> Handlers;
+        // when the values were set
+        std::vector<TTimePoint> SetTimes;
+    };
+    std::chrono::milliseconds MaxWriteLatency = std::chrono::milliseconds::zero();
+    TLatencyHistogram WriteLatency;
+    // writes waiting for the end of the conflation windows
+    std::vector<TFlushQueue::TItem> HeldWrites;
+    TTimePoint HeldWritesEnd = TTimePoint::max();
+    uint64_t ConflatedWriteCount = 0;
+    long long SwitchesAvoided = 0;
+    std::chrono::microseconds SwitchTimeSaved = std::chrono::microseconds::zero();
     PPollPlan Plan;
+    // current reconnect backoff of disconnected devices
+    std::unordered_map<PSerialDevice, std::chrono::milliseconds> ReconnectBackoffs;
+    std::unordered_map<PSerialDevice, std::chrono::microseconds> DeadBusTimes;
+    // devices polled during the current poll cycle and statuses of their
+    // ranges, a cycle lasts until a poll pass isn't preempted
+    std::map<PSerialDevice, std::set<TRegisterRange::EStatus>> CycleStatuses;
+    // preempted passes in a row since the current cycle started
+    int PreemptedPasses = 0;
+    // Recovery of a range the device refused to read. The range is cut
+    // in parts until the addresses causing the error are isolated, the
+    // parts are polled as usual, so each step takes a poll cycle.
+    struct TRangeBisection {
+        int Type, Start, End;
+        std::set<PRegister> Registers;
+        // cut address -> results of reading the parts to the left and to
+        // the right of it as a whole: 1 fine, -1 rejected, 0 not known yet
+        std::map<int, std::pair<int, int>> Cuts;
+        // boundaries added to the read limits of the device
+        std::set<int> Added;
+        // boundaries around the registers found unavailable
+        std::set<int> Permanent;
+    };
+    std::unordered_map<PSerialDevice, std::list<TRangeBisection>> Bisections;
+    // read limits probes in a row that got no answer
+    std::unordered_map<PSerialDevice, int> ProbeFailures;
+    std::minstd_rand Random;
+    std::vector<long long> ReportedStarvationCounts = std::vector<long long>(PRIORITY_CLASS_COUNT);
 
     const int MAX_REGS = 65536;
     const int MAX_FLUSHES_WHEN_POLL_IS_DUE = 20;
+    // The cycle is closed after this many preempted passes even if
+    // some entries are still pending, otherwise sustained realtime load
+    // would keep disconnect detection and per-cycle caches from working
+    const int MAX_PREEMPTED_PASSES = 4;
+    const int MAX_PROBE_FAILURES = 3;
 };
 
 typedef std::shared_ptr<TSerialClient> PSerialClient;
@@ -152,7 +152,8 @@ PRegisterConfig TConfigParser::LoadRegisterConfig(PDeviceConfig device_config,
                                       string& default_type_str)
 {
     int address = GetInt(register_data, "address");
-    cout << "address: " << address << endl;
+    if (HandlerConfig->Debug)
+        cerr << "address: " << address << endl;
     string reg_type_str = register_data["reg_type"].asString();
     default_type_str = "text";
     auto it = device_config->TypeMap->find(reg_type_str);
@@ -238,7 +239,8 @@ void TConfigParser::MergeAndLoadChannels(PDeviceConfig device_config, const Json
                 const Json::Value & override_channel_data = device_channels[it->second];
 
                 for (auto it = override_channel_data.begin(); it != override_channel_data.end(); ++it) {
-                    cerr << "override property " << it.memberName() << endl;
+                    if (HandlerConfig->Debug)
+                        cerr << "override property " << it.memberName() << endl;
                     // Channel fields from current device config
                     // take precedence over template field values
                     channel_data[it.memberName()] = *it;
@@ -319,10 +321,34 @@ void TConfigParser::LoadChannel(PDeviceConfig device_config, const Json::Value&
     if (channel_data.isMember("max"))
         max = GetInt(channel_data, "max");
 
+    EPriorityClass priority = EPriorityClass::Normal;
+    if (channel_data.isMember("priority")) {
+        string priority_str = channel_data["priority"].asString();
+        if (priority_str != "realtime" && priority_str != "normal" && priority_str != "background")
+            throw TConfigParserException("invalid channel priority: '" + priority_str + "'");
+        priority = PriorityClassFromName(priority_str);
+    }
+    for (auto& reg: registers)
+        reg->Priority = priority;
+
+    if (channel_data.isMember("write_conflation_ms")) {
+        int write_conflation = GetInt(channel_data, "write_conflation_ms");
+        if (write_conflation < 0)
+            throw TConfigParserException("write_conflation_ms must not be negative");
+        for (auto& reg: registers)
+            reg->WriteConflation = chrono::milliseconds(write_conflation);
+    }
+
+    if (channel_data.isMember("read_back")) {
+        bool read_back = channel_data["read_back"].asBool();
+        for (auto& reg: registers)
+            reg->ReadBack = read_back;
+    }
+
     int order = device_config->NextOrderValue();
     PDeviceChannelConfig channel(new TDeviceChannelConfig(name, type_str, device_config->Id, order,
                                               on_value, max, registers[0]->ReadOnly,
-                                              registers));
+                                              registers, priority));
     device_config->AddChannel(channel);
 }
 
@@ -391,12 +417,20 @@ void TConfigParser::LoadDeviceTemplatableConfigPart(PDeviceConfig device_config,
         device_config->DeviceTimeout = chrono::milliseconds(GetInt(device_data, "device_timeout_ms"));
     if (device_data.isMember("device_max_fail_cycles"))
         device_config->DeviceMaxFailCycles = GetInt(device_data, "device_max_fail_cycles");
+    if (device_data.isMember("reconnect_backoff_ms"))
+        device_config->ReconnectBackoff = chrono::milliseconds(GetInt(device_data, "reconnect_backoff_ms"));
+    if (device_data.isMember("reconnect_backoff_max_ms"))
+        device_config->ReconnectBackoffMax = chrono::milliseconds(GetInt(device_data, "reconnect_backoff_max_ms"));
+    if (device_data.isMember("reconnect_jitter_percent"))
+        device_config->ReconnectJitterPercent = GetInt(device_data, "reconnect_jitter_percent");
     if (device_data.isMember("max_reg_hole"))
         device_config->MaxRegHole = GetInt(device_data, "max_reg_hole");
     if (device_data.isMember("max_bit_hole"))
         device_config->MaxBitHole = GetInt(device_data, "max_bit_hole");
     if (device_data.isMember("max_read_registers"))
         device_config->MaxReadRegisters = GetInt(device_data, "max_read_registers");
+    if (device_data.isMember("auto_read_limits"))
+        device_config->AutoReadLimits = device_data["auto_read_limits"].asBool();
     if (device_data.isMember("guard_interval_us"))
         device_config->GuardInterval = chrono::microseconds(GetInt(device_data, "guard_interval_us"));
     if (device_data.isMember("stride"))
@@ -618,9 +652,27 @@ void TConfigParser::LoadPort(const Json::Value& port_data,
     if (port_data.isMember("poll_interval"))
         port_config->PollInterval = chrono::milliseconds(GetInt(port_data, "poll_interval"));
 
+    if (port_data.isMember("grid_polling"))
+        port_config->GridPolling = port_data["grid_polling"].asBool();
+
+    if (port_data.isMember("priority_weights")) {
+        const Json::Value& weights = port_data["priority_weights"];
+        for (int i = 0; i < PRIORITY_CLASS_COUNT; ++i) {
+            const char* name = PriorityClassName(static_cast<EPriorityClass>(i));
+            if (weights.isMember(name)) {
+                port_config->PriorityWeights[i] = GetInt(weights, name);
+                if (port_config->PriorityWeights[i] <= 0)
+                    throw TConfigParserException(string("priority weight must be positive: ") + name);
+            }
+        }
+    }
+
     if (port_data.isMember("guard_interval_us"))
         port_config->GuardInterval = chrono::microseconds(GetInt(port_data, "guard_interval_us"));
 
+    if (port_data.isMember("max_write_latency_ms"))
+        port_config->MaxWriteLatency = chrono::milliseconds(GetInt(port_data, "max_write_latency_ms"));
+
     const Json::Value array = port_data["devices"];
     for(unsigned int index = 0; index < array.size(); ++index)
         LoadDevice(port_config, array[index], id_prefix + to_string(index));
@@ -642,6 +694,9 @@ void TConfigParser::LoadConfig()
     if (Root.isMember("max_unchanged_interval"))
         HandlerConfig->MaxUnchangedInterval = Root["max_unchanged_interval"].asInt();
 
+    if (Root.isMember("state_file"))
+        HandlerConfig->StateFile = Root["state_file"].asString();
+
     const Json::Value array = Root["ports"];
     for(unsigned int index = 0; index < array.size(); ++index)
         LoadPort(array[index], "wb-modbus-" + to_string(index) + "-"); // XXX old default prefix for compat
@@ -31,10 +31,11 @@ struct TDeviceChannelConfig {
                    std::string device_id = "", int order = 0,
                    std::string on_value = "", int max = - 1, bool read_only = false,
                    const std::vector<PRegisterConfig> regs =
-                       std::vector<PRegisterConfig>())
+                       std::vector<PRegisterConfig>(),
+                   EPriorityClass priority = EPriorityClass::Normal)
         : Name(name), Type(type), DeviceId(device_id),
           Order(order), OnValue(on_value), Max(max),
-          ReadOnly(read_only), RegisterConfigs(regs) {}
+          ReadOnly(read_only), RegisterConfigs(regs), Priority(priority) {}
     std::string Name;
     std::string Type;
     std::string DeviceId; // FIXME
@@ -43,6 +44,7 @@ struct TDeviceChannelConfig {
     int Max;
     bool ReadOnly;
     std::vector<PRegisterConfig> RegisterConfigs;
+    EPriorityClass Priority;
 };
 
 typedef std::shared_ptr<TDeviceChannelConfig> PDeviceChannelConfig;
@@ -61,6 +63,11 @@ const int DEFAULT_INTER_DEVICE_DELAY_MS = 100;
 const int DEFAULT_ACCESS_LEVEL = 1;
 const int DEFAULT_DEVICE_TIMEOUT_MS = 3000;
 const int DEFAULT_DEVICE_FAIL_CYCLES = 2;
+const int DEFAULT_RECONNECT_BACKOFF_MAX_MS = 60000;
+const int DEFAULT_RECONNECT_JITTER_PERCENT = 20;
+const int DEFAULT_REALTIME_WEIGHT = 8;
+const int DEFAULT_NORMAL_WEIGHT = 4;
+const int DEFAULT_BACKGROUND_WEIGHT = 1;
 
 struct TDeviceConfig {
     TDeviceConfig(std::string name = "", std::string slave_id = "", std::string protocol = "")
@@ -82,11 +89,20 @@ struct TDeviceConfig {
     std::chrono::milliseconds FrameTimeout = std::chrono::milliseconds(-1);
     int MaxRegHole = 0, MaxBitHole = 0;
     int MaxReadRegisters = 1;
+    // Learn the limits above by probing the device when the bus is
+    // idle, the configured values are the starting point
+    bool AutoReadLimits = false;
     int Stride = 0, Shift = 0;
     PRegisterTypeMap TypeMap = 0;
     std::chrono::microseconds GuardInterval = std::chrono::microseconds(0);
     std::chrono::milliseconds DeviceTimeout = std::chrono::milliseconds(DEFAULT_DEVICE_TIMEOUT_MS);
     int DeviceMaxFailCycles = DEFAULT_DEVICE_FAIL_CYCLES;
+    // Delay before the first reconnect attempt of a disconnected device,
+    // doubled after each failed attempt up to ReconnectBackoffMax.
+    // Zero means trying to reconnect on every poll of the device.
+    std::chrono::milliseconds ReconnectBackoff = std::chrono::milliseconds(0);
+    std::chrono::milliseconds ReconnectBackoffMax = std::chrono::milliseconds(DEFAULT_RECONNECT_BACKOFF_MAX_MS);
+    int ReconnectJitterPercent = DEFAULT_RECONNECT_JITTER_PERCENT;
 };
 
 typedef std::shared_ptr<TDeviceConfig> PDeviceConfig;
@@ -96,6 +112,11 @@ struct TPortConfig {
     PPortSettings ConnSettings;
     std::chrono::milliseconds PollInterval = std::chrono::milliseconds(20);
     std::chrono::microseconds GuardInterval = std::chrono::microseconds(0);
+    bool GridPolling = false;
+    // Shares of bus time for priority classes, indexed by EPriorityClass
+    std::vector<int> PriorityWeights = { DEFAULT_REALTIME_WEIGHT, DEFAULT_NORMAL_WEIGHT, DEFAULT_BACKGROUND_WEIGHT };
+    // see TSerialClient::SetMaxWriteLatency()
+    std::chrono::milliseconds MaxWriteLatency = std::chrono::milliseconds(0);
     bool Debug = false;
     int MaxUnchangedInterval;
     std::vector<PDeviceConfig> DeviceConfigs;
@@ -111,6 +132,9 @@ struct THandlerConfig {
     }
     bool Debug = false;
     int MaxUnchangedInterval = -1;
+    // File that keeps what is learned about the devices across
+    // restarts, see TLearnedState. Empty means nothing is kept.
+    std::string StateFile;
     std::vector<PPortConfig> PortConfigs;
 };
 
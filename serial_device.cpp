@@ -11,7 +11,11 @@ TSerialDevice::TSerialDevice(PDeviceConfig config, PPort port, PProtocol protoco
     , LastSuccessfulCycle()
     , IsDisconnected(false)
     , RemainingFailCycles(config->DeviceMaxFailCycles)
-{}
+{
+    Limits.MaxReadRegisters = config->MaxReadRegisters;
+    Limits.MaxRegHole = config->MaxRegHole;
+    Limits.MaxBitHole = config->MaxBitHole;
+}
 
 TSerialDevice::~TSerialDevice()
 {
@@ -31,37 +35,68 @@ std::list<PRegisterRange> TSerialDevice::SplitRegisterList(const std::list<PRegi
     return r;
 }
 
+PReadLimitsProbe TSerialDevice::NextReadLimitsProbe(const std::list<PRegisterRange>&) const
+{
+    // generic devices read registers one at a time
+    return nullptr;
+}
+
 void TSerialDevice::Prepare()
 {
-    Port()->Sleep(Delay);
+    Port()->SleepSinceLastInteraction(Delay);
+}
+
+void TSerialDevice::WriteRegisters(std::vector<TRegisterWrite>& writes)
+{
+    for (auto& write: writes) {
+        try {
+            WriteRegister(write.Register, write.Value);
+        } catch (const TSerialDeviceTransientErrorException& e) {
+            write.Error = e.what();
+        }
+    }
 }
 
 void TSerialDevice::EndPollCycle() {}
 
+std::chrono::microseconds TSerialDevice::EstimateReadDuration(PRegisterRange range) const
+{
+    // Generic devices read registers one at a time. Frame sizes vary
+    // between protocols, so assume a typical short request and response.
+    const int estimatedFrameSize = 8;
+
+    auto send_time = Port()->GetSendTime(2 * estimatedFrameSize);
+    if (send_time == std::chrono::microseconds::zero())
+        return send_time;
+    return (send_time + DeviceConfig()->GuardInterval) * range->RegisterList().size();
+}
+
 void TSerialDevice::ReadRegisterRange(PRegisterRange range)
 {
     PSimpleRegisterRange simple_range = std::dynamic_pointer_cast<TSimpleRegisterRange>(range);
     if (!simple_range)
         throw std::runtime_error("simple range expected");
     simple_range->Reset();
-    for (auto reg: simple_range->RegisterList()) {
+    const auto& regs = simple_range->RegisterList();
+    for (size_t i = 0; i < regs.size(); ++i) {
+        const auto& reg = regs[i];
         if (UnavailableAddresses.count(reg->Address)) {
         	continue;
         }
     	try {
             if (DeviceConfig()->GuardInterval.count()){
-                Port()->Sleep(DeviceConfig()->GuardInterval);
+                Port()->SleepSinceLastInteraction(DeviceConfig()->GuardInterval);
             }
-            simple_range->SetValue(reg, ReadRegister(reg));
+            simple_range->SetValue(i, ReadRegister(reg));
         } catch (const TSerialDeviceTransientErrorException& e) {
-            simple_range->SetError(reg);
+            simple_range->SetError(i);
             std::ios::fmtflags f(std::cerr.flags());
             std::cerr << "TSerialDevice::ReadRegisterRange(): warning: " << e.what() << " [slave_id is "
                       << reg->Device()->ToString() + "]" << std::endl;
             std::cerr.flags(f);
         } catch (const TSerialDevicePermanentRegisterException& e) {
         	UnavailableAddresses.insert(reg->Address);
-        	simple_range->SetError(reg);
+        	simple_range->SetError(i);
 			std::ios::fmtflags f(std::cerr.flags());
 			std::cerr << "TSerialDevice::ReadRegisterRange(): warning: " << e.what() << " [slave_id is "
 					  << reg->Device()->ToString() + "] Register " << reg->ToString() << " is now counts as unsupported" << std::endl;
@@ -144,6 +179,7 @@ bool TSerialDevice::WriteSetupRegisters(bool tryAll)
 
 std::unordered_map<std::string, PProtocol>
     *TSerialDeviceFactory::Protocols = 0;
+std::mutex TSerialDeviceFactory::DevicesMutex;
 
 void TSerialDeviceFactory::RegisterProtocol(PProtocol protocol)
 {
@@ -168,12 +204,14 @@ PProtocol TSerialDeviceFactory::GetProtocol(const std::string &name)
 
 PSerialDevice TSerialDeviceFactory::CreateDevice(PDeviceConfig device_config, PPort port)
 {
+    std::lock_guard<std::mutex> lock(DevicesMutex);
     return GetProtocolEntry(device_config)->CreateDevice(device_config, port);
 }
 
 void TSerialDeviceFactory::RemoveDevice(PSerialDevice device)
 {
     if (device) {
+        std::lock_guard<std::mutex> lock(DevicesMutex);
         device->Protocol()->RemoveDevice(device);
     } else {
         throw TSerialDeviceException("can't remove empty device");
@@ -182,6 +220,7 @@ void TSerialDeviceFactory::RemoveDevice(PSerialDevice device)
 
 PSerialDevice TSerialDeviceFactory::GetDevice(const std::string& slave_id, const std::string& protocol_name, PPort port)
 {
+    std::lock_guard<std::mutex> lock(DevicesMutex);
     return GetProtocol(protocol_name)->GetDevice(slave_id, port);
 }
 
@@ -6,6 +6,7 @@
 #include <unordered_map>
 #include <string>
 #include <memory>
+#include <mutex>
 #include <exception>
 #include <algorithm>
 #include <stdint.h>
@@ -62,6 +63,45 @@ namespace std
 }
 
 
+// Read limits of a device learned at runtime, see TDeviceConfig::AutoReadLimits
+struct TReadLimits {
+    int MaxReadRegisters = 1;
+    int MaxRegHole = 0, MaxBitHole = 0;
+    // (register type, address) pairs: a single request never reads
+    // registers below the address together with the ones from it on
+    std::set<std::pair<int, int>> Boundaries;
+    // (register type, address) of registers the device refuses to read
+    std::set<std::pair<int, int>> Unavailable;
+
+    // true if there's a boundary between the addresses (from < to)
+    bool Separates(int type, int from, int to) const
+    {
+        auto it = Boundaries.upper_bound(std::make_pair(type, from));
+        return it != Boundaries.end() && it->first == type && it->second <= to;
+    }
+};
+
+// A read request that tells whether the device may read two adjacent
+// ranges with a single request
+struct TReadLimitsProbe {
+    PRegisterRange Range;
+    // limits to use if the device reads the range fine
+    TReadLimits Supported;
+    // the boundary to add if the device rejects the request
+    // (the address of the first register of the second range)
+    int SplitAddress;
+};
+
+typedef std::shared_ptr<TReadLimitsProbe> PReadLimitsProbe;
+
+// A value to write, see TSerialDevice::WriteRegisters()
+struct TRegisterWrite {
+    PRegister Register;
+    uint64_t Value;
+    // why the value wasn't written, empty if it was
+    std::string Error;
+};
+
 class TSerialDevice: public std::enable_shared_from_this<TSerialDevice> {
 public:
     TSerialDevice(PDeviceConfig config, PPort port, PProtocol protocol);
@@ -70,16 +110,24 @@ public:
     virtual ~TSerialDevice();
     virtual std::list<PRegisterRange> SplitRegisterList(const std::list<PRegister> & reg_list, bool enableHoles = true) const;
 
-    // Prepare to access device (pauses for configured delay by default)
+    // Prepare to access device (by default makes sure the bus
+    // has been silent for configured delay)
     virtual void Prepare();
     // Read register value
     virtual uint64_t ReadRegister(PRegister reg) = 0;
     // Write register value
     virtual void WriteRegister(PRegister reg, uint64_t value) = 0;
+    // Write values of several registers, storing transient errors in
+    // the writes. Registers are written one by one unless the protocol
+    // can write adjacent ones with a single request.
+    virtual void WriteRegisters(std::vector<TRegisterWrite>& writes);
     // Handle end of poll cycle e.g. by resetting values caches
     virtual void EndPollCycle();
     // Read multiple registers
     virtual void ReadRegisterRange(PRegisterRange range);
+    // Predict bus time needed to read the range, not including Prepare()
+    // (zero if the port can't tell how long it takes to send data)
+    virtual std::chrono::microseconds EstimateReadDuration(PRegisterRange range) const;
 
     virtual std::string ToString() const;
 
@@ -96,6 +144,16 @@ public:
     bool GetIsDisconnected() const;
 
     void ResetUnavailableAddresses();
+    // Addresses found unsupported by ReadRegisterRange()
+    const std::set<int>& GetUnavailableAddresses() const { return UnavailableAddresses; }
+    void SetUnavailableAddresses(const std::set<int>& addresses) { UnavailableAddresses = addresses; }
+
+    const TReadLimits& ReadLimits() const { return Limits; }
+    void SetReadLimits(const TReadLimits& limits) { Limits = limits; }
+    // Request that tells whether the device can read more registers at
+    // once than its read limits allow, given the current ranges of the
+    // device. Returns nullptr when there's nothing left to learn.
+    virtual PReadLimitsProbe NextReadLimitsProbe(const std::list<PRegisterRange>& ranges) const;
 
 private:
     std::chrono::milliseconds Delay;
@@ -107,6 +165,7 @@ private:
     bool IsDisconnected;
     std::set<int> UnavailableAddresses;
     int RemainingFailCycles;
+    TReadLimits Limits;
 };
 
 typedef std::shared_ptr<TSerialDevice> PSerialDevice;
@@ -299,6 +358,9 @@ public:
 private:
     static const PProtocol GetProtocolEntry(PDeviceConfig device_config);
     static std::unordered_map<std::string, PProtocol> *Protocols;
+    // Devices of all ports are kept by the protocols, while the ports
+    // create and remove them from their own threads
+    static std::mutex DevicesMutex;
 };
 
 class TProtocolRegistrator
@@ -7,8 +7,14 @@ TMQTTSerialObserver::TMQTTSerialObserver(PMQTTClientBase mqtt_client,
                                          PHandlerConfig handler_config,
                                          PPort port_override)
     : MQTTClient(mqtt_client),
-      Config(handler_config)
+      Config(handler_config),
+      Stopped(false)
 {
+    if (!Config->StateFile.empty()) {
+        LearnedState = std::make_shared<TLearnedState>(Config->StateFile);
+        LearnedState->Load();
+    }
+
     for (const auto& port_config : Config->PortConfigs) {
         if (port_config->DeviceConfigs.empty()) {
             std::cerr << "Warning: no devices defined for port "
@@ -18,7 +24,7 @@ TMQTTSerialObserver::TMQTTSerialObserver(PMQTTClientBase mqtt_client,
         }
 
         PortDrivers.push_back(
-            std::make_shared<TSerialPortDriver>(mqtt_client, port_config, port_override));
+            std::make_shared<TSerialPortDriver>(mqtt_client, port_config, port_override, LearnedState));
     }
 }
 
@@ -68,8 +74,10 @@ void TMQTTSerialObserver::Loop()
 
     for (const auto& portDriver: PortDrivers) {
         port_loops.emplace_back(
-            [&portDriver](){
-                for (;;)  portDriver->Cycle();
+            [this, &portDriver](){
+                while (!Stopped)
+                    portDriver->Cycle();
+                portDriver->SaveLearnedState();
             }
         );
     }
@@ -79,6 +87,13 @@ void TMQTTSerialObserver::Loop()
     }
 }
 
+void TMQTTSerialObserver::Stop()
+{
+    Stopped = true;
+    for (const auto& portDriver: PortDrivers)
+        portDriver->Stop();
+}
+
 bool TMQTTSerialObserver::WriteInitValues()
 {
     bool did_write = false;
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <atomic>
 #include <vector>
 #include <memory>
 
@@ -21,13 +22,18 @@ public:
     void OnSubscribe(int mid, int qos_count, const int *granted_qos);
 
     void LoopOnce();
+    // Runs until Stop() is called, saving the learned state at the end
     void Loop();
+    // May be called from any thread
+    void Stop();
     bool WriteInitValues();
 
 private:
     PMQTTClientBase MQTTClient;
     PHandlerConfig Config;
     std::vector<PSerialPortDriver> PortDrivers;
+    PLearnedState LearnedState;
+    std::atomic<bool> Stopped;
 };
 
 typedef std::shared_ptr<TMQTTSerialObserver> PMQTTSerialObserver;
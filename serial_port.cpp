@@ -2,6 +2,7 @@
 #include "serial_exc.h"
 
 #include <map>
+#include <cmath>
 #include <string.h>
 #include <fcntl.h>
 #include <iostream>
@@ -122,3 +123,10 @@ void TSerialPort::Close()
     }
     Base::Close();
 }
+
+std::chrono::microseconds TSerialPort::GetSendTime(double bytesNumber) const
+{
+    // start bit + data bits + optional parity bit + stop bits
+    int bitsPerByte = 1 + Settings->DataBits + (Settings->Parity == 'N' ? 0 : 1) + Settings->StopBits;
+    return std::chrono::microseconds(static_cast<int64_t>(std::ceil(bytesNumber * bitsPerByte * 1000000 / Settings->BaudRate)));
+}
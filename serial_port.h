@@ -15,6 +15,7 @@ public:
 
     void Open() override;
     void Close() override;
+    std::chrono::microseconds GetSendTime(double bytesNumber) const override;
 
 private:
     PSerialPortSettings Settings;
@@ -10,9 +10,12 @@
 
 
 TSerialPortDriver::TSerialPortDriver(PMQTTClientBase mqtt_client, PPortConfig port_config,
-                                     PPort port_override)
+                                     PPort port_override, PLearnedState learned_state)
     : MQTTClient(mqtt_client)
     , Config(port_config)
+    , LearnedState(learned_state)
+    , LastStateSave(std::chrono::steady_clock::now())
+    , LastStatsPublish(std::chrono::steady_clock::now())
 {
     if (port_override) {
         Port = port_override;
@@ -27,9 +30,14 @@ TSerialPortDriver::TSerialPortDriver(PMQTTClientBase mqtt_client, PPortConfig po
     SerialClient = std::make_shared<TSerialClient>(Port);
 
     SerialClient->SetDebug(Config->Debug);
+    SerialClient->SetGridPolling(Config->GridPolling);
+    SerialClient->SetPriorityWeights(Config->PriorityWeights);
+    SerialClient->SetMaxWriteLatency(Config->MaxWriteLatency);
     SerialClient->SetReadCallback([this](PRegister reg, bool changed) {
             OnValueRead(reg, changed);
         });
+    // without max_unchanged_interval nothing is published for unchanged values
+    SerialClient->SetReportUnchanged(Config->MaxUnchangedInterval >= 0);
     SerialClient->SetErrorCallback(
         [this](PRegister reg, TRegisterHandler::TErrorState state) {
             UpdateError(reg, state);
@@ -41,6 +49,10 @@ TSerialPortDriver::TSerialPortDriver(PMQTTClientBase mqtt_client, PPortConfig po
     for (auto& device_config: Config->DeviceConfigs) {
         auto device = SerialClient->CreateDevice(device_config);
         Devices.push_back(device);
+        // registers are split into ranges on the first Cycle(),
+        // so the restored limits are used from the start
+        if (LearnedState && LearnedState->Restore(device, port_config->ConnSettings->ToString()) && Config->Debug)
+            std::cerr << "Restored learned state of device " << device->ToString() << std::endl;
 
         // init channels' registers
         for (auto& channel_config: device_config->DeviceChannelConfigs) {
@@ -61,14 +73,14 @@ TSerialPortDriver::TSerialPortDriver(PMQTTClientBase mqtt_client, PPortConfig po
 
 TSerialPortDriver::~TSerialPortDriver()
 {
+    SaveLearnedState();
 }
 
 void TSerialPortDriver::PubSubSetup()
 {
     for (auto device_config : Config->DeviceConfigs) {
         /* Only attempt to Subscribe on a successful connect. */
-        std::string id = device_config->Id.empty() ? MQTTClient->Id() : device_config->Id;
-        std::string prefix = std::string("/devices/") + id + "/";
+        std::string prefix = GetDeviceTopic(device_config);
         // Meta
         MQTTClient->Publish(NULL, prefix + "meta/name", device_config->Name, 0, true);
         for (const auto& channel : device_config->DeviceChannelConfigs) {
@@ -152,6 +164,12 @@ bool TSerialPortDriver::HandleMessage(const std::string& topic, const std::strin
     return true;
 }
 
+std::string TSerialPortDriver::GetDeviceTopic(PDeviceConfig device_config)
+{
+    std::string id = device_config->Id.empty() ? MQTTClient->Id() : device_config->Id;
+    return std::string("/devices/") + id + "/";
+}
+
 std::string TSerialPortDriver::GetChannelTopic(const TDeviceChannelConfig& channel)
 {
     std::string controls_prefix = std::string("/devices/") + channel.DeviceId + "/controls/";
@@ -285,12 +303,133 @@ void TSerialPortDriver::Cycle()
 {
     try {
         SerialClient->Cycle();
+        PublishDeviceStats();
+        if (std::chrono::steady_clock::now() - LastStatsPublish >= STATS_PUBLISH_INTERVAL) {
+            LastStatsPublish = std::chrono::steady_clock::now();
+            PublishWriteLatency();
+            PublishWriteConflation();
+            PublishPollStats();
+        }
+        if (std::chrono::steady_clock::now() - LastStateSave >= STATE_SAVE_INTERVAL)
+            SaveLearnedState();
     } catch (TSerialDeviceException& e) {
         std::cerr << "FATAL: " << e.what() << ". Stopping event loops." << std::endl;
+        SaveLearnedState();
         exit(1);
     }
 }
 
+void TSerialPortDriver::Stop()
+{
+    SerialClient->Stop();
+}
+
+void TSerialPortDriver::PublishDeviceStats()
+{
+    for (const auto& device: Devices) {
+        auto dead_bus_time = SerialClient->GetDeadBusTime(device);
+        auto it = PublishedDeadBusTimes.find(device);
+        if (it == PublishedDeadBusTimes.end() ? dead_bus_time.count() == 0 : it->second == dead_bus_time)
+            continue;
+        PublishedDeadBusTimes[device] = dead_bus_time;
+        MQTTClient->Publish(NULL, GetDeviceTopic(device->DeviceConfig()) + "meta/dead_bus_time_ms",
+                            std::to_string(dead_bus_time.count()), 0, true);
+    }
+}
+
+std::string TSerialPortDriver::GetPortTopic() const
+{
+    // serial ports are named after the device file, tcp ones after the address
+    std::string name;
+    if (auto serial_port_settings = std::dynamic_pointer_cast<TSerialPortSettings>(Config->ConnSettings)) {
+        name = serial_port_settings->Device;
+        if (name.compare(0, 5, "/dev/") == 0)
+            name.erase(0, 5);
+    } else if (auto tcp_port_settings = std::dynamic_pointer_cast<TTcpPortSettings>(Config->ConnSettings)) {
+        name = tcp_port_settings->Address + ":" + std::to_string(tcp_port_settings->Port);
+    }
+    std::replace(name.begin(), name.end(), '/', '_');
+    return "/wb-mqtt-serial/ports/" + name + "/";
+}
+
+// The histogram of the time from receiving values to starting to write
+// them, as {"le_ms": [bounds], "counts": [counts], "max_ms": max}. The
+// last count is for the latencies above all the bounds.
+void TSerialPortDriver::PublishWriteLatency()
+{
+    const auto& histogram = SerialClient->GetWriteLatency();
+    if (histogram.Count() == PublishedWriteCount)
+        return;
+    PublishedWriteCount = histogram.Count();
+
+    std::ostringstream payload;
+    payload << "{\"le_ms\": [";
+    const auto& bounds = TLatencyHistogram::Bounds();
+    for (size_t i = 0; i < bounds.size(); ++i)
+        payload << (i ? ", " : "") << bounds[i].count();
+    payload << "], \"counts\": [";
+    const auto& counts = histogram.BucketCounts();
+    for (size_t i = 0; i < counts.size(); ++i)
+        payload << (i ? ", " : "") << counts[i];
+    payload << "], \"max_ms\": " <<
+        std::chrono::duration_cast<std::chrono::milliseconds>(histogram.MaxLatency()).count() << "}";
+    MQTTClient->Publish(NULL, GetPortTopic() + "write_latency", payload.str(), 0, true);
+}
+
+// Values dropped because newer ones were set before writing them and
+// writes held back by conflation windows, as {"dropped": n, "conflated": n}
+void TSerialPortDriver::PublishWriteConflation()
+{
+    auto dropped = SerialClient->GetDroppedWriteCount();
+    auto conflated = SerialClient->GetConflatedWriteCount();
+    if (dropped == PublishedDroppedWriteCount && conflated == PublishedConflatedWriteCount)
+        return;
+    PublishedDroppedWriteCount = dropped;
+    PublishedConflatedWriteCount = conflated;
+    MQTTClient->Publish(NULL, GetPortTopic() + "write_conflation",
+                        "{\"dropped\": " + std::to_string(dropped) +
+                        ", \"conflated\": " + std::to_string(conflated) + "}", 0, true);
+}
+
+// Poll intervals missed by the channels of each priority class, as
+// {"realtime": n, "normal": n, "background": n}, and device switches
+// avoided by grouping, as {"avoided": n, "time_saved_ms": n}
+void TSerialPortDriver::PublishPollStats()
+{
+    std::array<long long, PRIORITY_CLASS_COUNT> counts;
+    for (int i = 0; i < PRIORITY_CLASS_COUNT; ++i)
+        counts[i] = SerialClient->GetStarvationCount(static_cast<EPriorityClass>(i));
+    if (counts != PublishedStarvationCounts) {
+        PublishedStarvationCounts = counts;
+        std::ostringstream payload;
+        payload << "{";
+        for (int i = 0; i < PRIORITY_CLASS_COUNT; ++i)
+            payload << (i ? ", " : "") << "\"" << PriorityClassName(static_cast<EPriorityClass>(i)) <<
+                "\": " << counts[i];
+        payload << "}";
+        MQTTClient->Publish(NULL, GetPortTopic() + "starvation", payload.str(), 0, true);
+    }
+
+    auto switches = SerialClient->GetSwitchesAvoided();
+    if (switches != PublishedSwitchesAvoided) {
+        PublishedSwitchesAvoided = switches;
+        MQTTClient->Publish(NULL, GetPortTopic() + "device_switches",
+                            "{\"avoided\": " + std::to_string(switches) +
+                            ", \"time_saved_ms\": " + std::to_string(SerialClient->GetSwitchTimeSaved().count()) +
+                            "}", 0, true);
+    }
+}
+
+void TSerialPortDriver::SaveLearnedState()
+{
+    LastStateSave = std::chrono::steady_clock::now();
+    if (!LearnedState)
+        return;
+    for (const auto& device: Devices)
+        LearnedState->Store(device, Config->ConnSettings->ToString(), SerialClient->GetLearnedReadLimits(device));
+    LearnedState->Save();
+}
+
 bool TSerialPortDriver::WriteInitValues()
 {
     bool did_write = false;
@@ -1,4 +1,5 @@
 #pragma once
+#include <array>
 #include <memory>
 #include <unordered_map>
 
@@ -6,6 +7,7 @@
 #include "serial_config.h"
 #include "serial_client.h"
 #include "register_handler.h"
+#include "learned_state.h"
 #include <chrono>
 
 
@@ -32,9 +34,14 @@ class TMQTTWrapper;
 class TSerialPortDriver
 {
 public:
-    TSerialPortDriver(PMQTTClientBase mqtt_client, PPortConfig port_config, PPort port_override = 0);
+    TSerialPortDriver(PMQTTClientBase mqtt_client, PPortConfig port_config, PPort port_override = 0,
+                      PLearnedState learned_state = 0);
     ~TSerialPortDriver();
     void Cycle();
+    // Makes Cycle() return quickly, may be called from any thread
+    void Stop();
+    // Must be called from the thread that runs Cycle()
+    void SaveLearnedState();
     void PubSubSetup();
     bool HandleMessage(const std::string& topic, const std::string& payload);
     std::string GetChannelTopic(const TDeviceChannelConfig& channel);
@@ -45,6 +52,12 @@ private:
     void OnValueRead(PRegister reg, bool changed);
     TRegisterHandler::TErrorState RegErrorState(PRegister reg);
     void UpdateError(PRegister reg, TRegisterHandler::TErrorState errorState);
+    void PublishDeviceStats();
+    void PublishWriteLatency();
+    void PublishWriteConflation();
+    void PublishPollStats();
+    std::string GetPortTopic() const;
+    std::string GetDeviceTopic(PDeviceConfig device_config);
 
     PMQTTClientBase MQTTClient;
     PPortConfig Config;
@@ -58,6 +71,18 @@ private:
     std::unordered_map<PRegister, std::chrono::time_point<std::chrono::steady_clock>> RegLastPublishTimeMap;
     std::unordered_map<std::string, std::string> PublishedErrorMap;
     std::unordered_map<std::string, PDeviceChannel> NameToChannelMap;
+    std::unordered_map<PSerialDevice, std::chrono::milliseconds> PublishedDeadBusTimes;
+    PLearnedState LearnedState;
+    std::chrono::steady_clock::time_point LastStateSave;
+    std::chrono::steady_clock::time_point LastStatsPublish;
+    uint64_t PublishedWriteCount = 0;
+    uint64_t PublishedDroppedWriteCount = 0;
+    uint64_t PublishedConflatedWriteCount = 0;
+    std::array<long long, PRIORITY_CLASS_COUNT> PublishedStarvationCounts = {};
+    long long PublishedSwitchesAvoided = 0;
+
+    const std::chrono::seconds STATE_SAVE_INTERVAL = std::chrono::seconds(60);
+    const std::chrono::seconds STATS_PUBLISH_INTERVAL = std::chrono::seconds(10);
 };
 
 typedef std::shared_ptr<TSerialPortDriver> PSerialPortDriver;
@@ -0,0 +1,80 @@
+#include <chrono>
+#include <iostream>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "crc16.h"
+
+namespace {
+    const int Bytes = 64 << 20;
+
+    // The byte at a time algorithm with separate tables for the two
+    // bytes of the CRC that CRC16::CalculateCRC16() used before
+    class TDualTableCRC16 {
+    public:
+        TDualTableCRC16()
+        {
+            for (int b = 0; b < 256; ++b) {
+                uint16_t crc = b;
+                for (int bit = 0; bit < 8; ++bit)
+                    crc = crc & 1 ? (crc >> 1) ^ 0xA001 : crc >> 1;
+                CrcHi[b] = crc & 0xFF;
+                CrcLo[b] = crc >> 8;
+            }
+        }
+
+        uint16_t Calculate(const uint8_t *buffer, uint16_t len) const
+        {
+            uint8_t crch = 0xff, crcl = 0xff;
+            while (len--) {
+                uint8_t i = crch ^ *buffer++;
+                crch = crcl ^ CrcHi[i];
+                crcl = CrcLo[i];
+            }
+            return crch << 8 | crcl;
+        }
+
+    private:
+        uint8_t CrcHi[256], CrcLo[256];
+    };
+
+    template<typename TFn> void Measure(const std::string& name, size_t frame_size, TFn crc_fn)
+    {
+        std::vector<uint8_t> frame(frame_size);
+        for (size_t i = 0; i < frame_size; ++i)
+            frame[i] = uint8_t(i * 131 + 7);
+
+        int count = Bytes / frame_size;
+        uint16_t sum = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < count; ++i) {
+            frame[0] = uint8_t(i);
+            sum += crc_fn(frame.data(), frame_size);
+        }
+        auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+        std::cout << name << ", " << frame_size << " byte frames: " << double(elapsed) / count << " ns/frame, " <<
+            double(elapsed) / Bytes << " ns/byte (checksum " << sum << ")" << std::endl;
+    }
+};
+
+// Checksums of Modbus request sized (8 bytes) and largest RTU (255 bytes)
+// frames with the old dual table algorithm and with the slice-by-8 one
+TEST(TCRC16Bench, Frames)
+{
+    TDualTableCRC16 dual_table;
+    for (size_t frame_size: { 8, 255 }) {
+        Measure("dual table", frame_size, [&dual_table](const uint8_t* data, size_t size) {
+                return dual_table.Calculate(data, size);
+            });
+        Measure("slice-by-8", frame_size, [](const uint8_t* data, size_t size) {
+                return CRC16::CalculateCRC16(data, size);
+            });
+        Measure("slice-by-8, 1 byte chunks", frame_size, [](const uint8_t* data, size_t size) {
+                CRC16::TCalculator crc;
+                for (size_t i = 0; i < size; ++i)
+                    crc.Update(data + i, 1);
+                return crc.Value();
+            });
+    }
+}
@@ -0,0 +1,81 @@
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "crc16.h"
+
+namespace {
+    // the bitwise algorithm from the protocol specification
+    uint16_t ReferenceCRC16(const uint8_t* data, size_t size)
+    {
+        uint16_t crc = 0xFFFF;
+        while (size--) {
+            crc ^= *data++;
+            for (int bit = 0; bit < 8; ++bit)
+                crc = crc & 1 ? (crc >> 1) ^ 0xA001 : crc >> 1;
+        }
+        return uint16_t(crc << 8 | crc >> 8);
+    }
+
+    std::vector<uint8_t> MakeData(size_t size)
+    {
+        std::vector<uint8_t> data(size);
+        for (size_t i = 0; i < size; ++i)
+            data[i] = uint8_t(i * 131 + 7);
+        return data;
+    }
+};
+
+TEST(TCRC16Test, KnownValues)
+{
+    const uint8_t request[] = { 0x01, 0x03, 0x00, 0x00, 0x00, 0x01 };
+    ASSERT_EQ(0x840A, CRC16::CalculateCRC16(request, sizeof(request)));
+    const uint8_t check[] = { '1', '2', '3', '4', '5', '6', '7', '8', '9' };
+    ASSERT_EQ(0x374B, CRC16::CalculateCRC16(check, sizeof(check))); // 0x4B37 sent low byte first
+    ASSERT_EQ(0xFFFF, CRC16::CalculateCRC16(check, 0));
+
+    for (size_t size = 0; size <= 300; ++size) {
+        auto data = MakeData(size);
+        ASSERT_EQ(ReferenceCRC16(data.data(), size), CRC16::CalculateCRC16(data.data(), size)) << size;
+    }
+}
+
+TEST(TCRC16Test, Incremental)
+{
+    auto data = MakeData(255);
+    uint16_t expected = CRC16::CalculateCRC16(data.data(), data.size());
+    for (size_t part = 1; part <= 17; ++part) {
+        CRC16::TCalculator crc;
+        for (size_t pos = 0; pos < data.size(); pos += part)
+            crc.Update(&data[pos], std::min(part, data.size() - pos));
+        ASSERT_EQ(expected, crc.Value()) << part;
+        ASSERT_FALSE(crc.IsValidFrame());
+
+        uint8_t tail[] = { uint8_t(expected >> 8), uint8_t(expected) };
+        crc.Update(tail, 2);
+        ASSERT_TRUE(crc.IsValidFrame());
+    }
+}
+
+TEST(TCRC16Test, ExpectValidFrame)
+{
+    auto frame = MakeData(20);
+    uint16_t crc = CRC16::CalculateCRC16(frame.data(), frame.size());
+    frame.push_back(crc >> 8);
+    frame.push_back(crc);
+
+    auto complete = CRC16::ExpectValidFrame(4);
+    ASSERT_FALSE(complete(frame.data(), 0));
+    ASSERT_FALSE(complete(frame.data(), 7));
+    ASSERT_FALSE(complete(frame.data(), 21));
+    ASSERT_TRUE(complete(frame.data(), 22));
+
+    // the next frame read into the same buffer
+    const uint8_t exception[] = { 0x01, 0x83, 0x02, 0xC0, 0xF1 };
+    std::copy(exception, exception + sizeof(exception), frame.begin());
+    ASSERT_FALSE(complete(frame.data(), 2));
+    ASSERT_TRUE(complete(frame.data(), 5));
+
+    // too short
+    auto short_complete = CRC16::ExpectValidFrame(6);
+    ASSERT_FALSE(short_complete(frame.data(), 5));
+}
@@ -115,6 +115,12 @@ void TFakeSerialDevice::OnCycleEnd(bool ok)
     }
 }
 
+void TFakeSerialDevice::EndPollCycle()
+{
+    ++EndPollCycleCount;
+    TSerialDevice::EndPollCycle();
+}
+
 void TFakeSerialDevice::BlockReadFor(int addr, bool block)
 {
     Blockings[addr].first = block;
@@ -16,6 +16,7 @@ public:
     uint64_t ReadRegister(PRegister reg) override;
     void WriteRegister(PRegister reg, uint64_t value) override;
     void OnCycleEnd(bool ok) override;
+    void EndPollCycle() override;
 
     void BlockReadFor(int addr, bool block);
     void BlockWriteFor(int addr, bool block);
@@ -24,6 +25,7 @@ public:
     ~TFakeSerialDevice();
 
     uint16_t Registers[256] {};
+    int EndPollCycleCount = 0;
 private:
     PFakeSerialPort FakePort;
     std::map<int, std::pair<bool, bool>> Blockings;
@@ -128,18 +128,29 @@ int TFakeSerialPort::ReadFrame(uint8_t* buf, int count,
         throw std::runtime_error("TFakeSerialPort::ReadFrame: bad timeout: " +
                                  std::to_string(timeout.count()) + " instead of " +
                                  std::to_string(ExpectedFrameTimeout.count()));
+    if (RespPos < Resp.size() && Resp[RespPos] == NO_RESPONSE) {
+        ++RespPos;
+        Time += ResponseTimeout;
+        Fixture.Emit() << "<< (no response)";
+        throw TSerialDeviceTransientErrorException("request timed out");
+    }
     int nread = 0;
     uint8_t* p = buf;
     for (; nread < count; ++nread) {
         if (RespPos == Resp.size())
             break;
         int b = Resp[RespPos++];
-        // TBD: after frame_ready arg is added,
-        // make sure the frame becomes 'ready' exactly on the boundary.
-        // Note though that frame_ready will be optional.
         if (b == FRAME_BOUNDARY)
             break;
         *p++ = (uint8_t)b;
+        // like a real port, stop reading as soon as the frame is
+        // complete, the rest is left for the next read
+        if (frame_complete && frame_complete(buf, nread + 1)) {
+            ++nread;
+            if (RespPos < Resp.size() && Resp[RespPos] == FRAME_BOUNDARY)
+                ++RespPos;
+            break;
+        }
     }
     if (frame_complete && !frame_complete(buf, nread))
         throw std::runtime_error("incomplete frame read");
@@ -176,6 +187,26 @@ TTimePoint TFakeSerialPort::CurrentTime() const
     return Time;
 }
 
+std::chrono::microseconds TFakeSerialPort::GetSendTime(double bytesNumber) const
+{
+    return std::chrono::microseconds(static_cast<long long>(ByteSendTime.count() * bytesNumber));
+}
+
+void TFakeSerialPort::SetByteSendTime(const std::chrono::microseconds& time)
+{
+    ByteSendTime = time;
+}
+
+std::chrono::milliseconds TFakeSerialPort::GetResponseTimeout() const
+{
+    return ResponseTimeout;
+}
+
+void TFakeSerialPort::SetResponseTimeout(const std::chrono::milliseconds& timeout)
+{
+    ResponseTimeout = timeout;
+}
+
 void TFakeSerialPort::CycleEnd(bool ok)
 {
     Fixture.Emit() << (ok ? "Port cycle OK" : "Port cycle FAIL");
@@ -189,6 +220,8 @@ void TFakeSerialPort::DumpWhatWasRead()
 
     std::vector<uint8_t> slice;
     for (; DumpPos < RespPos; ++DumpPos) {
+        if (Resp[DumpPos] == NO_RESPONSE)
+            continue;
         if (Resp[DumpPos] == FRAME_BOUNDARY) {
             if (slice.size() > 0)
                 Fixture.Emit() << "<< " << slice;
@@ -228,6 +261,11 @@ void TFakeSerialPort::Expect(const std::vector<int>& request, const std::vector<
     Resp.push_back(FRAME_BOUNDARY);
 }
 
+void TFakeSerialPort::ExpectTimeout(const std::vector<int>& request, const char* func)
+{
+    Expect(request, { NO_RESPONSE }, func);
+}
+
 void TFakeSerialPort::SkipFrameBoundary()
 {
     if (RespPos < Resp.size() && Resp[RespPos] == FRAME_BOUNDARY)
@@ -31,8 +31,16 @@ public:
     bool Wait(const PBinarySemaphore & semaphore, const TTimePoint & until) override;
     TTimePoint CurrentTime() const override;
     void CycleEnd(bool ok) override;
+    std::chrono::microseconds GetSendTime(double bytesNumber) const override;
+    std::chrono::milliseconds GetResponseTimeout() const override;
+    void SetResponseTimeout(const std::chrono::milliseconds& timeout);
+    // Pretend to know line settings, so the bus load can be predicted
+    void SetByteSendTime(const std::chrono::microseconds& time);
 
     void Expect(const std::vector<int>& request, const std::vector<int>& response, const char* func = 0);
+    // The device doesn't answer the request, reading the response
+    // times out taking the response timeout
+    void ExpectTimeout(const std::vector<int>& request, const char* func = 0);
     void DumpWhatWasRead();
     void Elapse(const std::chrono::milliseconds& ms);
     void SimulateDisconnect(bool simulate);
@@ -42,6 +50,7 @@ public:
 private:
     void SkipFrameBoundary();
     const int FRAME_BOUNDARY = -1;
+    const int NO_RESPONSE = -2;
 
     TLoggedFixture& Fixture;
     bool IsPortOpen;
@@ -51,6 +60,8 @@ private:
     std::vector<int> Resp;
     size_t ReqPos, RespPos, DumpPos;
     std::chrono::microseconds ExpectedFrameTimeout = std::chrono::microseconds(-1);
+    std::chrono::microseconds ByteSendTime = std::chrono::microseconds::zero();
+    std::chrono::milliseconds ResponseTimeout = std::chrono::milliseconds::zero();
     TPollPlan::TTimePoint Time = TPollPlan::TTimePoint(std::chrono::milliseconds(0));
 };
 
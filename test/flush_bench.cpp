@@ -0,0 +1,237 @@
+#include <algorithm>
+#include <chrono>
+#include <ctime>
+#include <iostream>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "serial_client.h"
+#include "modbus_common.h"
+#include "crc16.h"
+
+namespace {
+    const int DeviceCount = 10;
+    const int WriteCount = 20000;
+
+    // Answers Modbus RTU reads and writes of any slave right away.
+    // Port time passes only by the bus time of the requests at 9600 8N1,
+    // so after the first cycle no hourly polls are due and cycles only
+    // flush. Notes the time of the last write.
+    class TModbusWritePort: public TPort {
+    public:
+        void Open() override { IsPortOpen = true; }
+        void Close() override { IsPortOpen = false; }
+        bool IsOpen() const override { return IsPortOpen; }
+        void CheckPortOpen() const override {}
+        void SkipNoise() override {}
+        void SetDebug(bool debug) override {}
+        bool Debug() const override { return false; }
+        uint8_t ReadByte() override { throw std::runtime_error("ReadByte() is not supported"); }
+        void Sleep(const std::chrono::microseconds& us) override {}
+        bool Wait(const PBinarySemaphore& semaphore, const TTimePoint& until) override
+        {
+            return semaphore->TryWait();
+        }
+        TTimePoint CurrentTime() const override { return Now; }
+
+        void WriteBytes(const uint8_t* buf, int count) override
+        {
+            ++Requests;
+            Bytes += count;
+            if (buf[1] == 5 || buf[1] == 6 || buf[1] == 15 || buf[1] == 16) {
+                LastWrite = std::chrono::steady_clock::now();
+                LastWriteTime = Now;
+                if (buf[1] == 5 || buf[1] == 6) {
+                    Response.assign(buf, buf + count);
+                } else {
+                    Response.assign(buf, buf + 6);
+                    uint16_t crc = CRC16::CalculateCRC16(Response.data(), Response.size());
+                    Response.push_back(crc >> 8);
+                    Response.push_back(crc);
+                }
+                Bytes += Response.size();
+                AddBusTime(count + Response.size());
+                return;
+            }
+            Response.assign(buf, buf + 2);
+            int n = (buf[4] << 8) | buf[5];
+            // coils and discrete inputs are packed 8 per byte
+            int size = buf[1] == 1 || buf[1] == 2 ? (n + 7) / 8 : n * 2;
+            Response.push_back(size);
+            Response.insert(Response.end(), size, 0);
+            uint16_t crc = CRC16::CalculateCRC16(Response.data(), Response.size());
+            Response.push_back(crc >> 8);
+            Response.push_back(crc);
+            Bytes += Response.size();
+            AddBusTime(count + Response.size());
+        }
+
+        int ReadFrame(uint8_t* buf, int count, const std::chrono::microseconds& timeout,
+                      TFrameCompletePred frame_complete) override
+        {
+            int size = std::min(count, int(Response.size()));
+            std::copy(Response.begin(), Response.begin() + size, buf);
+            return size;
+        }
+
+        std::chrono::steady_clock::time_point LastWrite;
+        TTimePoint LastWriteTime;
+        // requests sent and bytes sent and received
+        long long Requests = 0, Bytes = 0;
+
+    private:
+        // the bytes and 3.5 characters of silence before each frame
+        void AddBusTime(int bytes)
+        {
+            Now += std::chrono::microseconds((bytes * 10 + 2 * 35) * 1000000LL / 9600);
+        }
+
+        TTimePoint Now;
+        bool IsPortOpen = false;
+        std::vector<uint8_t> Response;
+    };
+
+    // Sets values of WriteCount registers spread over the devices one
+    // by one, running a client cycle after each, and prints the time
+    // from setting the value to writing it to the port and the CPU time
+    // spent per write
+    void RunWrites(int register_count)
+    {
+        auto port = std::make_shared<TModbusWritePort>();
+        auto client = std::make_shared<TSerialClient>(port);
+        client->SetReadCallback([](PRegister, bool) {});
+        client->SetErrorCallback([](PRegister, TRegisterHandler::TErrorState) {});
+        std::vector<PRegister> regs;
+        for (int i = 0; i < DeviceCount; ++i) {
+            auto config = std::make_shared<TDeviceConfig>("bench" + std::to_string(i), std::to_string(i + 1), "modbus");
+            config->MaxReadRegisters = 125;
+            config->Delay = std::chrono::milliseconds(0);
+            auto device = client->CreateDevice(config);
+            for (int address = 0; address < register_count / DeviceCount; ++address) {
+                auto reg_config = TRegisterConfig::Create(Modbus::REG_HOLDING, address, U16, 1, 0, 0, true, false, "holding");
+                reg_config->PollInterval = std::chrono::hours(1);
+                regs.push_back(TRegister::Intern(device, reg_config));
+                client->AddRegister(regs.back());
+            }
+        }
+        client->Cycle();
+
+        std::vector<double> latencies;
+        latencies.reserve(WriteCount);
+        double start = double(std::clock()) / CLOCKS_PER_SEC;
+        for (int i = 0; i < WriteCount; ++i) {
+            const auto& reg = regs[(i * 7919L) % regs.size()];
+            auto set_time = std::chrono::steady_clock::now();
+            client->SetTextValue(reg, std::to_string(i & 0xFFFF));
+            client->Cycle();
+            ASSERT_GE(port->LastWrite, set_time);
+            latencies.push_back(std::chrono::duration<double, std::micro>(port->LastWrite - set_time).count());
+        }
+        double elapsed = double(std::clock()) / CLOCKS_PER_SEC - start;
+
+        std::sort(latencies.begin(), latencies.end());
+        std::cout << "registers: " << regs.size() << ", writes: " << WriteCount <<
+            ", latency median " << latencies[latencies.size() / 2] <<
+            " us, 99% " << latencies[latencies.size() * 99 / 100] <<
+            " us, cpu time " << elapsed * 1e6 / WriteCount << " us/write" << std::endl;
+
+        client.reset();
+        TRegister::DeleteIntern();
+    }
+};
+
+// Cost of flushing a single value set on a port with many registers
+TEST(TFlushBench, SingleWrites)
+{
+    RunWrites(1000);
+    RunWrites(5000);
+    RunWrites(20000);
+}
+
+// A scene that sets 16 coils and 8 holding registers of a device at
+// once. Bus time is estimated for 9600 8N1 with 3.5 characters of
+// silence before each frame, not counting response delays of the device.
+TEST(TFlushBench, Scene)
+{
+    const int scene_count = 1000;
+    auto port = std::make_shared<TModbusWritePort>();
+    auto client = std::make_shared<TSerialClient>(port);
+    client->SetReadCallback([](PRegister, bool) {});
+    client->SetErrorCallback([](PRegister, TRegisterHandler::TErrorState) {});
+    auto config = std::make_shared<TDeviceConfig>("bench", "1", "modbus");
+    config->Delay = std::chrono::milliseconds(0);
+    auto device = client->CreateDevice(config);
+    std::vector<PRegister> regs;
+    for (int address = 0; address < 16; ++address)
+        regs.push_back(TRegister::Intern(device, TRegisterConfig::Create(Modbus::REG_COIL, address, U8, 1, 0, 0, true, false, "coil")));
+    for (int address = 0; address < 8; ++address)
+        regs.push_back(TRegister::Intern(device, TRegisterConfig::Create(Modbus::REG_HOLDING, address, U16, 1, 0, 0, true, false, "holding")));
+    for (const auto& reg: regs) {
+        reg->PollInterval = std::chrono::hours(1);
+        client->AddRegister(reg);
+    }
+    client->Cycle();
+
+    port->Requests = port->Bytes = 0;
+    double start = double(std::clock()) / CLOCKS_PER_SEC;
+    for (int i = 0; i < scene_count; ++i) {
+        for (const auto& reg: regs)
+            client->SetTextValue(reg, std::to_string((i + reg->Address) & 1));
+        client->Cycle();
+    }
+    double elapsed = double(std::clock()) / CLOCKS_PER_SEC - start;
+
+    double char_time_us = 10 * 1e6 / 9600;
+    double bus_time_us = (port->Bytes + 2 * 3.5 * port->Requests) * char_time_us;
+    std::cout << "requests per scene: " << double(port->Requests) / scene_count <<
+        ", bus time: " << bus_time_us / scene_count / 1000 << " ms/scene, cpu time " <<
+        elapsed * 1e6 / scene_count << " us/scene" << std::endl;
+
+    client.reset();
+    TRegister::DeleteIntern();
+}
+
+// A value set while a device with 1000 holding registers read by 10
+// per request is polled. Prints the port time from setting the value
+// to writing it, depending on where in the poll pass it was set.
+TEST(TFlushBench, LongPoll)
+{
+    const int register_count = 1000;
+    auto port = std::make_shared<TModbusWritePort>();
+    auto client = std::make_shared<TSerialClient>(port);
+    client->SetErrorCallback([](PRegister, TRegisterHandler::TErrorState) {});
+    auto config = std::make_shared<TDeviceConfig>("bench", "1", "modbus");
+    config->MaxReadRegisters = 10;
+    config->Delay = std::chrono::milliseconds(0);
+    auto device = client->CreateDevice(config);
+    std::vector<PRegister> regs;
+    for (int address = 0; address < register_count; ++address) {
+        auto reg_config = TRegisterConfig::Create(Modbus::REG_HOLDING, address, U16, 1, 0, 0, true, false, "holding");
+        reg_config->PollInterval = std::chrono::milliseconds(10);
+        regs.push_back(TRegister::Intern(device, reg_config));
+        client->AddRegister(regs.back());
+    }
+    auto target = TRegister::Intern(device, TRegisterConfig::Create(Modbus::REG_HOLDING, register_count, U16, 1, 0, 0, true, false, "holding"));
+    target->PollInterval = std::chrono::hours(1);
+    client->AddRegister(target);
+    client->Cycle();
+
+    for (int at: { 10, 500, 990 }) {
+        TTimePoint set_time;
+        client->SetReadCallback([&](PRegister reg, bool) {
+                if (reg == regs[at]) {
+                    set_time = port->CurrentTime();
+                    client->SetTextValue(target, std::to_string(at));
+                }
+            });
+        port->LastWriteTime = TTimePoint();
+        client->Cycle();
+        ASSERT_GE(port->LastWriteTime, set_time);
+        std::cout << "set after reading register " << at << ": written in " <<
+            std::chrono::duration_cast<std::chrono::milliseconds>(port->LastWriteTime - set_time).count() <<
+            " ms" << std::endl;
+    }
+
+    client.reset();
+    TRegister::DeleteIntern();
+}
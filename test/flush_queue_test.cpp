@@ -0,0 +1,75 @@
+#include <thread>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "flush_queue.h"
+
+TEST(TFlushQueueTest, Order)
+{
+    auto flush_needed = std::make_shared<TBinarySemaphore>();
+    TFlushQueue queue(flush_needed);
+    std::vector<TFlushQueue::TItem> items;
+    TTimePoint oldest;
+    queue.TakeAll(items);
+    ASSERT_TRUE(items.empty());
+    ASSERT_FALSE(queue.OldestTime(oldest));
+    ASSERT_FALSE(flush_needed->TryWait());
+
+    queue.Push(3);
+    queue.Push(1);
+    queue.Push(2);
+    ASSERT_TRUE(flush_needed->TryWait());
+    ASSERT_TRUE(queue.OldestTime(oldest));
+    queue.TakeAll(items);
+    ASSERT_EQ(3, items.size());
+    ASSERT_EQ(3, items[0].Id);
+    ASSERT_EQ(1, items[1].Id);
+    ASSERT_EQ(2, items[2].Id);
+    ASSERT_EQ(oldest, items[0].Time);
+    ASSERT_LE(items[0].Time, items[2].Time);
+    queue.TakeAll(items);
+    ASSERT_TRUE(items.empty());
+
+    // left in the queue
+    queue.Push(4);
+}
+
+TEST(TFlushQueueTest, ConcurrentPush)
+{
+    const int producer_count = 4;
+    const uint32_t ids_per_producer = 50000;
+    auto flush_needed = std::make_shared<TBinarySemaphore>();
+    TFlushQueue queue(flush_needed);
+
+    std::vector<std::thread> producers;
+    for (int i = 0; i < producer_count; ++i) {
+        producers.emplace_back([&queue, i, ids_per_producer]() {
+            for (uint32_t n = 0; n < ids_per_producer; ++n)
+                queue.Push(i * ids_per_producer + n);
+        });
+    }
+
+    // each id is taken once, ids of each producer keep their order
+    std::vector<uint32_t> next(producer_count, 0);
+    std::vector<TFlushQueue::TItem> items;
+    uint32_t taken = 0;
+    auto take = [&]() {
+        queue.TakeAll(items);
+        for (const auto& item: items) {
+            uint32_t id = item.Id;
+            uint32_t producer = id / ids_per_producer;
+            ASSERT_LT(producer, uint32_t(producer_count));
+            ASSERT_EQ(next[producer], id % ids_per_producer);
+            ++next[producer];
+        }
+        taken += items.size();
+    };
+    while (taken < producer_count * ids_per_producer) {
+        flush_needed->Wait(std::chrono::steady_clock::now() + std::chrono::milliseconds(10));
+        take();
+    }
+    for (auto& producer: producers)
+        producer.join();
+    take();
+    ASSERT_EQ(producer_count * ids_per_producer, taken);
+}
@@ -0,0 +1,114 @@
+#include <cstdio>
+#include <fstream>
+#include <unistd.h>
+
+#include "fake_serial_port.h"
+#include "learned_state.h"
+#include "modbus_device.h"
+#include "modbus_common.h"
+
+using namespace std;
+
+
+class TLearnedStateTest: public TSerialDeviceTest
+{
+protected:
+    void SetUp();
+    void TearDown();
+    PDeviceConfig MakeDeviceConfig(int registers) const;
+    PSerialDevice MakeDevice(PDeviceConfig config) const;
+
+    string FileName;
+};
+
+void TLearnedStateTest::SetUp()
+{
+    TSerialDeviceTest::SetUp();
+    char fname[] = "/tmp/learned_state_test_XXXXXX";
+    int fd = mkstemp(fname);
+    ASSERT_GE(fd, 0);
+    close(fd);
+    FileName = fname;
+}
+
+void TLearnedStateTest::TearDown()
+{
+    unlink(FileName.c_str());
+    TSerialDeviceTest::TearDown();
+}
+
+PDeviceConfig TLearnedStateTest::MakeDeviceConfig(int registers) const
+{
+    auto config = make_shared<TDeviceConfig>("modbus", "1", "modbus");
+    config->AutoReadLimits = true;
+    vector<PRegisterConfig> regs;
+    for (int address = 0; address < registers; ++address)
+        regs.push_back(TRegisterConfig::Create(Modbus::REG_HOLDING, address, U16));
+    config->AddChannel(make_shared<TDeviceChannelConfig>("values", "text", "modbus", 0, "", -1, true, regs));
+    return config;
+}
+
+PSerialDevice TLearnedStateTest::MakeDevice(PDeviceConfig config) const
+{
+    return make_shared<TModbusDevice>(config, SerialPort, TSerialDeviceFactory::GetProtocol("modbus"));
+}
+
+TEST_F(TLearnedStateTest, SaveAndRestore)
+{
+    TReadLimits limits;
+    limits.MaxReadRegisters = 8;
+    limits.MaxRegHole = 2;
+    limits.Boundaries.insert(make_pair(int(Modbus::REG_HOLDING), 5));
+    limits.Unavailable.insert(make_pair(int(Modbus::REG_HOLDING), 3));
+    {
+        auto dev = MakeDevice(MakeDeviceConfig(8));
+        dev->SetUnavailableAddresses({ 7 });
+        TLearnedState state(FileName);
+        state.Store(dev, "port", limits);
+        state.Save();
+    }
+
+    TLearnedState state(FileName);
+    state.Load();
+    auto dev = MakeDevice(MakeDeviceConfig(8));
+    ASSERT_TRUE(state.Restore(dev, "port"));
+    ASSERT_EQ(8, dev->ReadLimits().MaxReadRegisters);
+    ASSERT_EQ(2, dev->ReadLimits().MaxRegHole);
+    ASSERT_EQ(limits.Boundaries, dev->ReadLimits().Boundaries);
+    ASSERT_EQ(limits.Unavailable, dev->ReadLimits().Unavailable);
+    ASSERT_EQ(set<int>({ 7 }), dev->GetUnavailableAddresses());
+
+    // another port or another register layout
+    ASSERT_FALSE(state.Restore(MakeDevice(MakeDeviceConfig(8)), "another port"));
+    auto changed = MakeDevice(MakeDeviceConfig(9));
+    ASSERT_FALSE(state.Restore(changed, "port"));
+    ASSERT_EQ(1, changed->ReadLimits().MaxReadRegisters);
+}
+
+TEST_F(TLearnedStateTest, IgnoreUnsupportedFile)
+{
+    {
+        auto dev = MakeDevice(MakeDeviceConfig(8));
+        TReadLimits limits;
+        limits.MaxReadRegisters = 8;
+        TLearnedState state(FileName);
+        state.Store(dev, "port", limits);
+        state.Save();
+    }
+    {
+        ifstream f(FileName);
+        string contents((istreambuf_iterator<char>(f)), istreambuf_iterator<char>());
+        auto pos = contents.find("\"version\":1");
+        ASSERT_NE(string::npos, pos);
+        contents.replace(pos, 11, "\"version\":2");
+        ofstream(FileName) << contents;
+    }
+
+    TLearnedState state(FileName);
+    state.Load();
+    ASSERT_FALSE(state.Restore(MakeDevice(MakeDeviceConfig(8)), "port"));
+
+    ofstream(FileName) << "{ \"version\": 1, \"devices\": [";
+    state.Load();
+    ASSERT_FALSE(state.Restore(MakeDevice(MakeDeviceConfig(8)), "port"));
+}
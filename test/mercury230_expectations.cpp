@@ -121,6 +121,41 @@ void TMercury230Expectations::EnqueueMercury230EnergyResponse2()
         }, __func__);
 }
 
+void TMercury230Expectations::EnqueueMercury230EnergyResponseWithCrcPrefix()
+{
+    Expector()->Expect(
+        {
+            0x00, // unit id (group)
+            0x05, // op
+            0x00, // addr
+            0x00, // addr
+            0x10, // crc
+            0x25  // crc
+        },
+        {
+            // Read response, the first 7 bytes end with their CRC
+            0x00, // unit id (group)
+            0x30, // A+
+            0x00, // A+
+            0x28, // A+
+            0xc5, // A+
+            0xf5, // A-
+            0x53, // A-
+            0xff, // A-
+            0xff, // A-
+            0x04, // R+
+            0x00, // R+
+            0x9c, // R+
+            0x95, // R+
+            0xff, // R-
+            0xff, // R-
+            0xff, // R-
+            0xff, // R-
+            0x61, // crc
+            0xe1  // crc
+        }, __func__);
+}
+
 void TMercury230Expectations::EnqueueMercury230PerPhaseEnergyResponse()
 {
     Expector()->Expect(
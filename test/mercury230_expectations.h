@@ -8,6 +8,7 @@ public:
 	void EnqueueMercury230AccessLevel2SessionSetupResponse();
 	void EnqueueMercury230EnergyResponse1();
 	void EnqueueMercury230EnergyResponse2();
+	void EnqueueMercury230EnergyResponseWithCrcPrefix();
 
 	void EnqueueMercury230U1Response();
 	void EnqueueMercury230U2Response();
@@ -123,6 +123,18 @@ TEST_F(TMercury230Test, ReadEnergy)
     SerialPort->Close();
 }
 
+TEST_F(TMercury230Test, ReadEnergyWithCrcPrefix)
+{
+    // a prefix of the response that ends with a valid CRC
+    // doesn't end the frame
+    EnqueueMercury230SessionSetupResponse();
+    EnqueueMercury230EnergyResponseWithCrcPrefix();
+    ASSERT_EQ(3196200, Mercury230Dev->ReadRegister(Mercury230TotalConsumptionReg));
+    ASSERT_EQ(300444, Mercury230Dev->ReadRegister(Mercury230TotalReactiveEnergyReg));
+    Mercury230Dev->EndPollCycle();
+    SerialPort->Close();
+}
+
 void TMercury230Test::VerifyParamQuery()
 {
     EnqueueMercury230U1Response();
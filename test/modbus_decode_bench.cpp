@@ -0,0 +1,121 @@
+#include <chrono>
+#include <iostream>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "serial_device.h"
+#include "modbus_common.h"
+#include "crc16.h"
+
+namespace {
+    const int ReadCount = 200000;
+
+    // Answers every request with one of two prepared responses in
+    // turn, so each read gets data different from the previous one
+    // and has to be decoded
+    class TCannedResponsePort: public TPort {
+    public:
+        TCannedResponsePort(const std::vector<uint8_t>& data_a, const std::vector<uint8_t>& data_b, uint8_t fn)
+            : Responses{ MakeResponse(data_a, fn), MakeResponse(data_b, fn) }
+        {}
+
+        void Open() override {}
+        void Close() override {}
+        bool IsOpen() const override { return true; }
+        void CheckPortOpen() const override {}
+        void SkipNoise() override {}
+        void SetDebug(bool debug) override {}
+        bool Debug() const override { return false; }
+        uint8_t ReadByte() override { throw std::runtime_error("ReadByte() is not supported"); }
+        void Sleep(const std::chrono::microseconds& us) override {}
+        bool Wait(const PBinarySemaphore& semaphore, const TTimePoint& until) override { return false; }
+        TTimePoint CurrentTime() const override { return TTimePoint(); }
+        void WriteBytes(const uint8_t* buf, int count) override { Next ^= 1; }
+
+        int ReadFrame(uint8_t* buf, int count, const std::chrono::microseconds& timeout,
+                      TFrameCompletePred frame_complete) override
+        {
+            const auto& response = Responses[Next];
+            int size = std::min(count, int(response.size()));
+            std::copy(response.begin(), response.begin() + size, buf);
+            return size;
+        }
+
+    private:
+        static std::vector<uint8_t> MakeResponse(const std::vector<uint8_t>& data, uint8_t fn)
+        {
+            std::vector<uint8_t> response = { 0x01, fn, uint8_t(data.size()) };
+            response.insert(response.end(), data.begin(), data.end());
+            uint16_t crc = CRC16::CalculateCRC16(response.data(), response.size());
+            response.push_back(crc >> 8);
+            response.push_back(crc);
+            return response;
+        }
+
+        std::vector<uint8_t> Responses[2];
+        int Next = 0;
+    };
+
+    std::vector<uint8_t> MakeData(size_t size, uint8_t seed)
+    {
+        std::vector<uint8_t> data(size);
+        for (size_t i = 0; i < size; ++i)
+            data[i] = uint8_t(i * 37 + seed);
+        return data;
+    }
+
+    // Reads the range of the registers ReadCount times and prints the time
+    // per read. Requests and checksums are included, they're the same for
+    // any way of decoding.
+    void RunReads(const std::string& name, int type, const std::vector<RegisterFormat>& formats,
+                  size_t data_size, uint8_t fn)
+    {
+        auto config = std::make_shared<TDeviceConfig>("bench", "1", "modbus");
+        config->MaxReadRegisters = 125;
+        auto port = std::make_shared<TCannedResponsePort>(MakeData(data_size, 1), MakeData(data_size, 2), fn);
+        auto device = TSerialDeviceFactory::CreateDevice(config, port);
+        std::list<PRegister> regs;
+        int address = 0;
+        for (auto format: formats) {
+            auto reg = TRegister::Intern(device, TRegisterConfig::Create(type, address, format));
+            address += reg->Width();
+            regs.push_back(reg);
+        }
+        auto ranges = device->SplitRegisterList(regs);
+        ASSERT_EQ(1, ranges.size());
+        auto range = ranges.front();
+
+        uint64_t sum = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < ReadCount; ++i) {
+            device->ReadRegisterRange(range);
+            range->ForEachValue([&sum](size_t, uint64_t value) { sum += value; }, [](size_t) {});
+        }
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        ASSERT_EQ(TRegisterRange::ST_OK, range->GetStatus());
+
+        std::cout << name << ": " << regs.size() << " registers, " <<
+            std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count() / ReadCount <<
+            " ns/read (checksum " << sum << ")" << std::endl;
+        TSerialDeviceFactory::RemoveDevice(device);
+        TRegister::DeleteIntern();
+    }
+};
+
+TEST(TModbusDecodeBench, HoldingRegisters)
+{
+    RunReads("125 u16", Modbus::REG_HOLDING, std::vector<RegisterFormat>(125, U16), 250, 0x03);
+    std::vector<RegisterFormat> mixed;
+    for (int i = 0; i < 17; ++i) {
+        mixed.push_back(U16);
+        mixed.push_back(U32);
+        mixed.push_back(U64);
+    }
+    mixed.insert(mixed.end(), 6, U16);
+    RunReads("125 words of mixed width", Modbus::REG_HOLDING, mixed, 250, 0x03);
+}
+
+TEST(TModbusDecodeBench, Coils)
+{
+    RunReads("2000 coils", Modbus::REG_COIL, std::vector<RegisterFormat>(2000, U8), 250, 0x01);
+}
@@ -723,6 +723,36 @@ void TModbusExpectations::EnqueueHoldingWriteS64Response(uint8_t exception)
 
 // write RGB register which consists of 3 holding
 void TModbusExpectations::EnqueueRGBWriteResponse(uint8_t exception)
+{
+    Expector()->Expect(
+    WrapPDU({
+        0x10,   //function code
+        0x00,   //starting address Hi
+        4,      //starting address Lo
+        0x00,   //quantity Hi
+        0x03,   //quantity Lo
+        0x06,   //byte count
+        0x00,   //R Hi
+        0x0a,   //R Lo
+        0x00,   //G Hi
+        0x14,   //G Lo
+        0x00,   //B Hi
+        0x1E,   //B Lo
+    }),
+    WrapPDU(exception == 0 ? std::vector<int> {
+        0x10,   //function code
+        0x00,   //starting address Hi
+        4,      //starting address Lo
+        0x00,   //quantity Hi
+        0x03,   //quantity Lo
+    } : std::vector<int> {
+        0x90,   //function code + 80
+        exception
+    }), __func__);
+}
+
+// RGB written register by register
+void TModbusExpectations::EnqueueRGBSingleWriteResponse(uint8_t exception)
 {
     // R
     Expector()->Expect(
@@ -740,7 +770,7 @@ void TModbusExpectations::EnqueueRGBWriteResponse(uint8_t exception)
         0x00,   //data Hi
         0x0a,   //data Lo
     } : std::vector<int> {
-        0x90,   //function code + 80
+        0x86,   //function code + 80
         exception
     }), __func__);
 
@@ -760,7 +790,7 @@ void TModbusExpectations::EnqueueRGBWriteResponse(uint8_t exception)
         0x00,   //data Hi
         0x14,   //data Lo
     } : std::vector<int> {
-        0x90,   //function code + 80
+        0x86,   //function code + 80
         exception
     }), __func__);
 
@@ -780,7 +810,7 @@ void TModbusExpectations::EnqueueRGBWriteResponse(uint8_t exception)
         0x00,   //data Hi
         0x1E,   //data Lo
     } : std::vector<int> {
-        0x90,   //function code + 80
+        0x86,   //function code + 80
         exception
     }), __func__);
 }
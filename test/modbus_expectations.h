@@ -35,6 +35,7 @@ public:
     void EnqueueHoldingWriteS64Response(uint8_t exception = 0);
 
     void EnqueueRGBWriteResponse(uint8_t exception = 0);
+    void EnqueueRGBSingleWriteResponse(uint8_t exception = 0);
 
     void Enqueue10CoilsReadResponse(uint8_t exception = 0);
 
@@ -2,6 +2,8 @@
 #include "modbus_expectations.h"
 #include "modbus_device.h"
 #include "modbus_common.h"
+#include "serial_port.h"
+#include "serial_client.h"
 
 using namespace std;
 
@@ -252,6 +254,443 @@ TEST_F(TModbusTest, WrongFunctionCodeWithExceptionWrite)
     SerialPort->Close();
 }
 
+TEST_F(TModbusTest, WriteRegisters)
+{
+    // adjacent coils are written with a single request,
+    // the holding register that is set first goes first
+    EnqueueHoldingWriteU16Response();
+    EnqueueCoilWriteMultipleResponse();
+
+    vector<TRegisterWrite> writes = {
+        { ModbusHolding, 3905, "" },
+        { ModbusCoil1, 0, "" },
+        { ModbusCoil0, 1, "" }
+    };
+    ModbusDev->WriteRegisters(writes);
+    for (const auto& write: writes)
+        EXPECT_EQ("", write.Error);
+
+    SerialPort->Close();
+}
+
+
+class TModbusSplitTest: public testing::Test
+{
+protected:
+    void SetUp();
+    list<PRegisterRange> Split(const list<int>& addresses, PPort port);
+
+    PDeviceConfig DeviceConfig;
+    PPort Port;
+};
+
+void TModbusSplitTest::SetUp()
+{
+    DeviceConfig = std::make_shared<TDeviceConfig>("modbus", std::to_string(0x01), "modbus");
+    DeviceConfig->MaxRegHole = 100;
+    DeviceConfig->MaxReadRegisters = 0;
+    Port = std::make_shared<TSerialPort>(std::make_shared<TSerialPortSettings>("/dev/ttyNSC0", 9600));
+}
+
+list<PRegisterRange> TModbusSplitTest::Split(const list<int>& addresses, PPort port)
+{
+    list<PRegister> regs;
+    for (auto address: addresses)
+        regs.push_back(std::make_shared<TRegister>(PSerialDevice(), TRegisterConfig::Create(
+            Modbus::REG_HOLDING, address, U16, 1, 0, 0, true, false, "holding")));
+    return Modbus::SplitRegisterList(regs, DeviceConfig, port, false, true);
+}
+
+TEST_F(TModbusSplitTest, CheapHolesAreRead)
+{
+    // reading a few extra registers is cheaper than another request
+    auto ranges = Split({ 0, 1, 5, 6 }, Port);
+    ASSERT_EQ(1u, ranges.size());
+    ASSERT_EQ(4u, ranges.front()->RegisterList().size());
+}
+
+TEST_F(TModbusSplitTest, ExpensiveHolesAreSkipped)
+{
+    // 50 registers of hole take much longer to read than
+    // the overhead of a separate request
+    auto ranges = Split({ 0, 1, 50, 51, 55 }, Port);
+    ASSERT_EQ(2u, ranges.size());
+    ASSERT_EQ(2u, ranges.front()->RegisterList().size());
+    ASSERT_EQ(3u, ranges.back()->RegisterList().size());
+
+    // without line settings registers are merged as much as allowed
+    ASSERT_EQ(1u, Split({ 0, 1, 50, 51, 55 }, PPort()).size());
+}
+
+TEST_F(TModbusSplitTest, LearnReadLimits)
+{
+    DeviceConfig->MaxRegHole = 0;
+    DeviceConfig->AutoReadLimits = true;
+    TReadLimits limits;
+
+    list<PRegister> regs;
+    for (int address = 0; address < 24; ++address) {
+        if (address < 16 || address > 20)
+            regs.push_back(std::make_shared<TRegister>(PSerialDevice(), TRegisterConfig::Create(
+                Modbus::REG_HOLDING, address, U16, 1, 0, 0, true, false, "holding")));
+    }
+    ASSERT_EQ(19u, Modbus::SplitRegisterList(regs, DeviceConfig, Port, false, true, limits).size());
+
+    int probes = 0;
+    list<PRegisterRange> ranges;
+    for (;;) {
+        ranges = Modbus::SplitRegisterList(regs, DeviceConfig, Port, false, true, limits);
+        auto probe = Modbus::NextReadLimitsProbe(ranges, DeviceConfig, Port, limits);
+        if (!probe)
+            break;
+        ASSERT_LT(++probes, 20);
+
+        // the device reads up to 8 registers at once and has no register 20
+        int start = probe->Range->RegisterList().front()->Address;
+        int end = probe->Range->RegisterList().back()->Address + 1;
+        if (end - start > 8 || (start <= 20 && end > 20))
+            limits.Boundaries.insert(std::make_pair(int(Modbus::REG_HOLDING), probe->SplitAddress));
+        else
+            limits = probe->Supported;
+    }
+
+    ASSERT_EQ(8, limits.MaxReadRegisters);
+    ASSERT_EQ(0, limits.MaxRegHole);
+    ASSERT_EQ(3u, ranges.size());
+    ASSERT_EQ(8u, ranges.front()->RegisterList().size());
+    ASSERT_EQ(3u, ranges.back()->RegisterList().size());
+}
+
+class TModbusBisectTest: public TSerialDeviceTest, public TModbusExpectations
+{
+protected:
+    void SetUp();
+    void TearDown();
+    void EnqueueHoldingRead(int start, int count, bool reject = false);
+
+    PSerialClient SerialClient;
+};
+
+void TModbusBisectTest::SetUp()
+{
+    SelectModbusType(MODBUS_RTU);
+    TSerialDeviceTest::SetUp();
+    SerialClient = std::make_shared<TSerialClient>(SerialPort);
+    auto config = std::make_shared<TDeviceConfig>("modbus", std::to_string(0x01), "modbus");
+    config->MaxReadRegisters = 0;
+    config->AutoReadLimits = true;
+    auto device = SerialClient->CreateDevice(config);
+    for (int address = 0; address < 8; ++address)
+        SerialClient->AddRegister(TRegister::Intern(device, TRegisterConfig::Create(
+            Modbus::REG_HOLDING, address, U16, 1, 0, 0, true, false, "holding")));
+}
+
+void TModbusBisectTest::TearDown()
+{
+    SerialClient.reset();
+    TSerialDeviceTest::TearDown();
+    TRegister::DeleteIntern();
+}
+
+void TModbusBisectTest::EnqueueHoldingRead(int start, int count, bool reject)
+{
+    std::vector<int> response = { 0x03, 2 * count };
+    for (int i = 0; i < count; ++i) {
+        response.push_back(0);
+        response.push_back(start + i);
+    }
+    Expector()->Expect(
+        WrapPDU({ 0x03, 0x00, start, 0x00, count }),
+        WrapPDU(reject ? std::vector<int> { 0x83, 0x02 } : response),
+        __func__);
+}
+
+TEST_F(TModbusBisectTest, IsolateUnavailableRegister)
+{
+    // holding register 5 doesn't exist
+    EnqueueHoldingRead(0, 8, true);
+    Note() << "Cycle()";
+    SerialClient->Cycle();
+
+    EnqueueHoldingRead(0, 4);
+    EnqueueHoldingRead(4, 4, true);
+    Note() << "Cycle()";
+    SerialClient->Cycle();
+
+    EnqueueHoldingRead(0, 4);
+    EnqueueHoldingRead(4, 2, true);
+    EnqueueHoldingRead(6, 2);
+    Note() << "Cycle()";
+    SerialClient->Cycle();
+
+    EnqueueHoldingRead(0, 4);
+    EnqueueHoldingRead(4, 1);
+    EnqueueHoldingRead(5, 1, true);
+    EnqueueHoldingRead(6, 2);
+    Note() << "Cycle()";
+    SerialClient->Cycle();
+
+    // only the necessary boundaries are left, register 5 isn't read anymore
+    EnqueueHoldingRead(0, 5);
+    EnqueueHoldingRead(6, 2);
+    Note() << "Cycle()";
+    SerialClient->Cycle();
+}
+
+class TModbusProbeTest: public TModbusBisectTest
+{
+protected:
+    void SetUp();
+    void EnqueueHoldingNoAnswer(int start, int count);
+
+    PSerialDevice Device;
+};
+
+void TModbusProbeTest::SetUp()
+{
+    SelectModbusType(MODBUS_RTU);
+    TSerialDeviceTest::SetUp();
+    SerialPort->SetResponseTimeout(std::chrono::milliseconds(20));
+    SerialClient = std::make_shared<TSerialClient>(SerialPort);
+    auto config = std::make_shared<TDeviceConfig>("modbus", std::to_string(0x01), "modbus");
+    config->MaxReadRegisters = 1;
+    config->AutoReadLimits = true;
+    Device = SerialClient->CreateDevice(config);
+    for (int address = 0; address < 2; ++address) {
+        auto reg = TRegister::Intern(Device, TRegisterConfig::Create(
+            Modbus::REG_HOLDING, address, U16, 1, 0, 0, true, false, "holding"));
+        reg->PollInterval = std::chrono::milliseconds(100);
+        SerialClient->AddRegister(reg);
+    }
+}
+
+void TModbusProbeTest::EnqueueHoldingNoAnswer(int start, int count)
+{
+    SerialPort->ExpectTimeout(WrapPDU({ 0x03, 0x00, start, 0x00, count }), __func__);
+}
+
+TEST_F(TModbusProbeTest, ProbeSucceeds)
+{
+    EnqueueHoldingRead(0, 1);
+    EnqueueHoldingRead(1, 1);
+    Note() << "Cycle()";
+    SerialClient->Cycle();
+
+    // the bus is idle until the next poll, so reading both
+    // registers at once is tried and works
+    EnqueueHoldingRead(0, 2);
+    EnqueueHoldingRead(0, 2);
+    Note() << "Cycle() [probe]";
+    SerialClient->Cycle();
+
+    EnqueueHoldingRead(0, 2);
+    Note() << "Cycle()";
+    SerialClient->Cycle();
+    EXPECT_EQ(2, SerialClient->GetLearnedReadLimits(Device).MaxReadRegisters);
+}
+
+TEST_F(TModbusProbeTest, ProbeFailsRepeatedly)
+{
+    EnqueueHoldingRead(0, 1);
+    EnqueueHoldingRead(1, 1);
+    Note() << "Cycle()";
+    SerialClient->Cycle();
+
+    // the device ignores the probes, they are given up after a few tries
+    for (int i = 0; i < 3; ++i) {
+        EnqueueHoldingNoAnswer(0, 2);
+        EnqueueHoldingRead(0, 1);
+        EnqueueHoldingRead(1, 1);
+        Note() << "Cycle() [probe]";
+        SerialClient->Cycle();
+    }
+
+    EnqueueHoldingRead(0, 1);
+    EnqueueHoldingRead(1, 1);
+    Note() << "Cycle() [no probe]";
+    SerialClient->Cycle();
+}
+
+TEST_F(TModbusProbeTest, ProbeWaitsForResponseTimeout)
+{
+    // an unanswered probe would delay the next poll
+    SerialPort->SetResponseTimeout(std::chrono::milliseconds(150));
+    for (int i = 0; i < 3; ++i) {
+        EnqueueHoldingRead(0, 1);
+        EnqueueHoldingRead(1, 1);
+        Note() << "Cycle() [no probe]";
+        SerialClient->Cycle();
+    }
+}
+
+class TModbusReconnectTest: public TModbusBisectTest
+{
+protected:
+    void SetUp();
+    void Cycle(bool answer);
+    long long NowMs() const;
+
+    PSerialDevice Device;
+};
+
+void TModbusReconnectTest::SetUp()
+{
+    SelectModbusType(MODBUS_RTU);
+    TSerialDeviceTest::SetUp();
+    SerialPort->SetResponseTimeout(std::chrono::milliseconds(20));
+    SerialClient = std::make_shared<TSerialClient>(SerialPort);
+    auto config = std::make_shared<TDeviceConfig>("modbus", std::to_string(0x01), "modbus");
+    // disconnected after the first failed cycle
+    config->DeviceTimeout = std::chrono::milliseconds(0);
+    config->DeviceMaxFailCycles = 1;
+    config->ReconnectBackoff = std::chrono::milliseconds(100);
+    config->ReconnectBackoffMax = std::chrono::milliseconds(400);
+    config->ReconnectJitterPercent = 0;
+    Device = SerialClient->CreateDevice(config);
+    auto reg = TRegister::Intern(Device, TRegisterConfig::Create(
+        Modbus::REG_HOLDING, 0, U16, 1, 0, 0, true, false, "holding"));
+    reg->PollInterval = std::chrono::milliseconds(10);
+    SerialClient->AddRegister(reg);
+}
+
+void TModbusReconnectTest::Cycle(bool answer)
+{
+    if (answer)
+        EnqueueHoldingRead(0, 1);
+    else
+        SerialPort->ExpectTimeout(WrapPDU({ 0x03, 0x00, 0x00, 0x00, 0x01 }), "EnqueueHoldingTimeout");
+    Note() << "Cycle()";
+    SerialClient->Cycle();
+}
+
+long long TModbusReconnectTest::NowMs() const
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        SerialPort->CurrentTime().time_since_epoch()).count();
+}
+
+TEST_F(TModbusReconnectTest, Backoff)
+{
+    // each failed request takes 20 ms, then the device
+    // is left alone for the backoff time
+    Cycle(false);
+    EXPECT_EQ(20, NowMs());
+    EXPECT_EQ(0, SerialClient->GetDeadBusTime(Device).count());
+
+    Cycle(false);
+    EXPECT_EQ(20 + 100 + 20, NowMs());
+    EXPECT_EQ(20, SerialClient->GetDeadBusTime(Device).count());
+
+    Cycle(false);
+    EXPECT_EQ(140 + 200 + 20, NowMs());
+    EXPECT_EQ(40, SerialClient->GetDeadBusTime(Device).count());
+
+    // the backoff is capped
+    Cycle(false);
+    EXPECT_EQ(360 + 400 + 20, NowMs());
+    Cycle(false);
+    EXPECT_EQ(780 + 400 + 20, NowMs());
+    EXPECT_EQ(80, SerialClient->GetDeadBusTime(Device).count());
+
+    // the device answers and is polled as usual again
+    Cycle(true);
+    EXPECT_EQ(1200 + 400, NowMs());
+    Cycle(true);
+    EXPECT_EQ(1600 + 10, NowMs());
+
+    // the backoff starts over after the device is lost again
+    Cycle(false);
+    EXPECT_EQ(1610 + 10 + 20, NowMs());
+    Cycle(false);
+    EXPECT_EQ(1640 + 100 + 20, NowMs());
+}
+
+class TModbusBlockChangeTest: public TSerialDeviceTest, public TModbusExpectations
+{
+protected:
+    void SetUp();
+    void TearDown();
+    void EnqueueHoldingRead(int first, int second);
+    void EnqueueHoldingWrite(int value);
+    void Cycle();
+
+    PSerialClient SerialClient;
+    PRegister Reg0;
+};
+
+void TModbusBlockChangeTest::SetUp()
+{
+    SelectModbusType(MODBUS_RTU);
+    TSerialDeviceTest::SetUp();
+    SerialClient = std::make_shared<TSerialClient>(SerialPort);
+    SerialClient->SetReadCallback([this](PRegister reg, bool changed) {
+            Emit() << "read " << reg->ToString() << (changed ? " changed: " : " unchanged: ") <<
+                SerialClient->GetTextValue(reg);
+        });
+    auto config = std::make_shared<TDeviceConfig>("modbus", std::to_string(0x01), "modbus");
+    config->MaxReadRegisters = 2;
+    auto device = SerialClient->CreateDevice(config);
+    for (int address = 0; address < 2; ++address) {
+        auto reg = TRegister::Intern(device, TRegisterConfig::Create(
+            Modbus::REG_HOLDING, address, U16, 1, 0, 0, true, false, "holding"));
+        if (!address)
+            Reg0 = reg;
+        SerialClient->AddRegister(reg);
+    }
+}
+
+void TModbusBlockChangeTest::TearDown()
+{
+    SerialClient.reset();
+    TSerialDeviceTest::TearDown();
+    TRegister::DeleteIntern();
+}
+
+void TModbusBlockChangeTest::EnqueueHoldingRead(int first, int second)
+{
+    Expector()->Expect(
+        WrapPDU({ 0x03, 0x00, 0x00, 0x00, 0x02 }),
+        WrapPDU({ 0x03, 0x04, 0x00, first, 0x00, second }),
+        __func__);
+}
+
+void TModbusBlockChangeTest::EnqueueHoldingWrite(int value)
+{
+    Expector()->Expect(
+        WrapPDU({ 0x06, 0x00, 0x00, 0x00, value }),
+        WrapPDU({ 0x06, 0x00, 0x00, 0x00, value }),
+        __func__);
+}
+
+void TModbusBlockChangeTest::Cycle()
+{
+    Note() << "Cycle()";
+    SerialClient->Cycle();
+}
+
+TEST_F(TModbusBlockChangeTest, SameData)
+{
+    EnqueueHoldingRead(1, 2);
+    Cycle();
+
+    // same data, the values are reported unchanged
+    EnqueueHoldingRead(1, 2);
+    Cycle();
+
+    // the device ignores the write, the same data must be
+    // mapped again to bring the register back to the device value
+    SerialClient->SetTextValue(Reg0, "5");
+    EnqueueHoldingWrite(5);
+    EnqueueHoldingRead(1, 2);
+    Cycle();
+
+    EnqueueHoldingRead(1, 3);
+    Cycle();
+
+    SerialClient->SetReportUnchanged(false);
+    EnqueueHoldingRead(1, 3);
+    Cycle();
+}
 
 class TModbusIntegrationTest: public TSerialDeviceIntegrationTest, public TModbusExpectations
 {
@@ -358,6 +797,42 @@ TEST_F(TModbusIntegrationTest, Write)
     Observer->LoopOnce();
 }
 
+TEST_F(TModbusIntegrationTest, WriteMultipleRejected)
+{
+    // the device doesn't support writing multiple registers,
+    // the driver falls back to writing them one by one
+    MQTTClient->Publish(nullptr, "/devices/modbus-sample/controls/RGB/on", "10;20;30");
+    EnqueueRGBWriteResponse(0x1);
+    EnqueueRGBSingleWriteResponse();
+    ExpectPollQueries();
+    Note() << "LoopOnce()";
+    Observer->LoopOnce();
+
+    MQTTClient->Publish(nullptr, "/devices/modbus-sample/controls/RGB/on", "10;20;30");
+    EnqueueRGBSingleWriteResponse();
+    ExpectPollQueries();
+    Note() << "LoopOnce()";
+    Observer->LoopOnce();
+}
+
+TEST_F(TModbusIntegrationTest, WriteMultipleBusy)
+{
+    // the device is busy, the registers are written one by one
+    // this time and with a single request the next time
+    MQTTClient->Publish(nullptr, "/devices/modbus-sample/controls/RGB/on", "10;20;30");
+    EnqueueRGBWriteResponse(0x6);
+    EnqueueRGBSingleWriteResponse();
+    ExpectPollQueries();
+    Note() << "LoopOnce()";
+    Observer->LoopOnce();
+
+    MQTTClient->Publish(nullptr, "/devices/modbus-sample/controls/RGB/on", "10;20;30");
+    EnqueueRGBWriteResponse();
+    ExpectPollQueries();
+    Note() << "LoopOnce()";
+    Observer->LoopOnce();
+}
+
 TEST_F(TModbusIntegrationTest, Errors)
 {
     MQTTClient->Publish(nullptr, "/devices/modbus-sample/controls/Coil 0/on", "1");
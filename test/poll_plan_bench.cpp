@@ -0,0 +1,57 @@
+#include <chrono>
+#include <vector>
+#include <iostream>
+#include <gtest/gtest.h>
+
+#include "poll_plan.h"
+
+namespace {
+    const int EntryCount = 10000;
+    const int CycleCount = 1000;
+
+    struct TBenchPollEntry: public TPollEntry {
+        TBenchPollEntry(int poll_interval): Interval(poll_interval) {}
+        std::chrono::milliseconds PollInterval() const { return Interval; }
+        std::chrono::milliseconds Interval;
+        int NumPolls = 0;
+    };
+};
+
+// Drives EntryCount entries with a mix of fast and slow poll intervals
+// through TPollPlan using virtual time. Each poll takes 1ms of virtual
+// time, so the plan is constantly overloaded, which is the worst case
+// for the pending set. The callback does nothing but advance the
+// virtual clock, so the measured time is dominated by the plan itself.
+TEST(TPollPlanBench, SchedulingOverhead)
+{
+    static const int intervals[] = { 0, 20, 50, 100, 250, 1000, 5000, 60000 };
+
+    TPollPlan::TTimePoint now;
+    TPollPlan plan([&now]() { return now; });
+    std::vector<std::shared_ptr<TBenchPollEntry>> entries;
+    for (int i = 0; i < EntryCount; ++i) {
+        entries.push_back(std::make_shared<TBenchPollEntry>(intervals[i % (sizeof(intervals) / sizeof(intervals[0]))]));
+        plan.AddEntry(entries.back());
+    }
+
+    long long polls = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < CycleCount; ++i) {
+        now = plan.GetNextPollTimePoint();
+        plan.ProcessPending([&](const PPollEntry& entry) {
+                static_cast<TBenchPollEntry*>(entry.get())->NumPolls++;
+                now += std::chrono::milliseconds(1);
+                ++polls;
+            });
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    auto elapsed_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+
+    std::cout << "entries: " << EntryCount << ", cycles: " << CycleCount << ", polls: " << polls << std::endl;
+    std::cout << "scheduling overhead: " << elapsed_ns / CycleCount << " ns/cycle, " <<
+        (polls ? elapsed_ns / polls : 0) << " ns/poll" << std::endl;
+
+    ASSERT_GT(polls, 0);
+    for (const auto& entry: entries)
+        ASSERT_GT(entry->NumPolls, 0);
+}
@@ -1,6 +1,8 @@
 #include <cmath>
 #include <string>
 #include <vector>
+#include <map>
+#include <algorithm>
 #include <gtest/gtest.h>
 
 #include "poll_plan.h"
@@ -10,10 +12,13 @@ namespace {
 };
 
 struct TFakePollEntry: public TPollEntry {
-    TFakePollEntry(const std::string& name, int poll_interval): Name(name), Interval(poll_interval) {}
+    TFakePollEntry(const std::string& name, int poll_interval, int predicted_duration = 0):
+        Name(name), Interval(poll_interval), Duration(predicted_duration) {}
     std::chrono::milliseconds PollInterval() const { return std::chrono::milliseconds(Interval); }
+    std::chrono::microseconds PredictedDuration() const { return std::chrono::milliseconds(Duration); }
     std::string Name;
     int Interval;
+    int Duration;
     int NumPolls = 0;
 };
 
@@ -120,3 +125,338 @@ TEST_F(TPollPlanTest, EntryWithZeroPollPeriod)
     VerifyPollPeriod(10000, -1, 1, true);
     ASSERT_EQ(10000, entry_with_no_period->NumPolls); // polled upon every iteration
 }
+
+TEST_F(TPollPlanTest, PredictedLoad)
+{
+    // entries without bus model don't contribute
+    ASSERT_DOUBLE_EQ(0, Plan->GetPredictedLoad());
+
+    Plan->Reset();
+    Entries = {
+        std::make_shared<TFakePollEntry>("50ms", 50, 20),
+        std::make_shared<TFakePollEntry>("100ms", 100, 20),
+        std::make_shared<TFakePollEntry>("200ms", 200, 40),
+        std::make_shared<TFakePollEntry>("no period", 0, 10)
+    };
+    for (auto entry: Entries)
+        Plan->AddEntry(entry);
+    ASSERT_DOUBLE_EQ(0.8, Plan->GetPredictedLoad());
+
+    // the load is predicted for the configured intervals,
+    // so the scale can be chosen from it again
+    Plan->SetIntervalScale(2);
+    ASSERT_DOUBLE_EQ(0.8, Plan->GetPredictedLoad());
+}
+
+TEST_F(TPollPlanTest, StretchIntervals)
+{
+    Plan->SetIntervalScale(4);
+    Plan->SetIntervalScale(2);
+    for (auto entry: Entries)
+        entry->Interval *= 2;
+    VerifyPollPeriod(10000, -1, 1);
+}
+
+TEST_F(TPollPlanTest, ResetIntervalScale)
+{
+    Plan->SetIntervalScale(2);
+    Plan->Reset();
+    ASSERT_DOUBLE_EQ(1, Plan->GetIntervalScale());
+    for (auto entry: Entries)
+        Plan->AddEntry(entry);
+    VerifyPollPeriod(10000, -1, 1);
+}
+
+TEST_F(TPollPlanTest, RemoveAndUpdateEntries)
+{
+    Plan->Reset();
+    auto a = std::make_shared<TFakePollEntry>("a", 100);
+    auto b = std::make_shared<TFakePollEntry>("b", 100);
+    auto c = std::make_shared<TFakePollEntry>("c", 100);
+    auto handle_a = Plan->AddEntry(a);
+    Plan->AddEntry(b);
+    auto handle_c = Plan->AddEntry(c);
+
+    std::vector<std::string> names;
+    auto poll = [&names](const PPollEntry& entry) {
+        names.push_back(std::dynamic_pointer_cast<TFakePollEntry>(entry)->Name);
+    };
+    Plan->ProcessPending(poll);
+    ASSERT_EQ(std::vector<std::string>({ "a", "b", "c" }), names);
+
+    Plan->RemoveEntry(handle_a);
+    c->Interval = 50;
+    Plan->UpdateEntry(handle_c);
+
+    // the next poll of c is moved to the new interval,
+    // a is not polled anymore
+    names.clear();
+    CurrentTime = Plan->GetNextPollTimePoint();
+    ASSERT_EQ(StartTime + std::chrono::milliseconds(50), CurrentTime);
+    Plan->ProcessPending(poll);
+    ASSERT_EQ(std::vector<std::string>({ "c" }), names);
+
+    names.clear();
+    CurrentTime = Plan->GetNextPollTimePoint();
+    ASSERT_EQ(StartTime + std::chrono::milliseconds(100), CurrentTime);
+    Plan->ProcessPending(poll);
+    ASSERT_EQ(std::vector<std::string>({ "b", "c" }), names);
+}
+
+class TPollPlanGridTest: public TPollPlanTest {
+protected:
+    void SetUp();
+    void Run(int count, int request_time);
+
+    std::map<std::string, std::vector<int>> PollTimes;
+};
+
+void TPollPlanGridTest::SetUp()
+{
+    TPollPlanTest::SetUp();
+    Plan->Reset();
+    Plan->SetGridScheduling(true);
+    Entries = {
+        std::make_shared<TFakePollEntry>("100ms-1", 100),
+        std::make_shared<TFakePollEntry>("100ms-2", 100),
+        std::make_shared<TFakePollEntry>("100ms-3", 100),
+        std::make_shared<TFakePollEntry>("100ms-4", 100),
+        std::make_shared<TFakePollEntry>("30ms", 30)
+    };
+    for (auto entry: Entries)
+        Plan->AddEntry(entry);
+}
+
+void TPollPlanGridTest::Run(int count, int request_time)
+{
+    for (int i = 0; i < count; ++i) {
+        CurrentTime = Plan->GetNextPollTimePoint();
+        Plan->ProcessPending([this, request_time](const PPollEntry& entry) {
+                auto fake_entry = std::dynamic_pointer_cast<TFakePollEntry>(entry);
+                fake_entry->NumPolls++;
+                PollTimes[fake_entry->Name].push_back(
+                    std::chrono::duration_cast<std::chrono::milliseconds>(CurrentTime - StartTime).count());
+                Elapse(request_time);
+            });
+    }
+}
+
+TEST_F(TPollPlanGridTest, Staggering)
+{
+    // polls at 0, 0 + 1, 25, 30, 50, 60, 75
+    Run(6, 1);
+    ASSERT_EQ(std::vector<int>({ 0 }), PollTimes["100ms-1"]);
+    ASSERT_EQ(std::vector<int>({ 25 }), PollTimes["100ms-2"]);
+    ASSERT_EQ(std::vector<int>({ 50 }), PollTimes["100ms-3"]);
+    ASSERT_EQ(std::vector<int>({ 75 }), PollTimes["100ms-4"]);
+}
+
+TEST_F(TPollPlanGridTest, NoDrift)
+{
+    // Each poll takes 7ms, so entries are often late because
+    // of each other, but the lateness must not accumulate
+    Run(10000, 7);
+    for (auto entry: Entries) {
+        const auto& times = PollTimes[entry->Name];
+        ASSERT_FALSE(times.empty());
+        int min_offset = times[0], max_offset = times[0];
+        for (size_t i = 1; i < times.size(); ++i) {
+            int offset = times[i] - entry->Interval * (int)i;
+            min_offset = std::min(min_offset, offset);
+            max_offset = std::max(max_offset, offset);
+        }
+        ASSERT_LT(max_offset - min_offset, entry->Interval) << entry->Name;
+    }
+    Verify();
+}
+
+TEST_F(TPollPlanGridTest, BoundedCatchUp)
+{
+    Plan->Reset();
+    Entries = { std::make_shared<TFakePollEntry>("100ms", 100) };
+    Plan->AddEntry(Entries[0]);
+
+    // first poll takes 350ms, so the poll for the slot at 100
+    // is late and slots at 200 and 300 are skipped
+    Run(1, 350);
+    Run(3, 1);
+    ASSERT_EQ(std::vector<int>({ 0, 350, 400, 500 }), PollTimes["100ms"]);
+}
+
+struct TGroupedPollEntry: public TFakePollEntry {
+    TGroupedPollEntry(const std::string& name, int poll_interval, const void* group, int switch_cost):
+        TFakePollEntry(name, poll_interval), GroupId(group), Cost(switch_cost) {}
+    const void* Group() const { return GroupId; }
+    std::chrono::microseconds SwitchCost() const { return std::chrono::milliseconds(Cost); }
+    const void* GroupId;
+    int Cost;
+};
+
+class TPollPlanGroupingTest: public TPollPlanTest {
+protected:
+    void SetUp();
+    std::vector<std::string> RunPass();
+
+    int GroupA, GroupB;
+};
+
+void TPollPlanGroupingTest::SetUp()
+{
+    TPollPlanTest::SetUp();
+    Plan->Reset();
+}
+
+std::vector<std::string> TPollPlanGroupingTest::RunPass()
+{
+    std::vector<std::string> names;
+    Plan->ProcessPending([&names](const PPollEntry& entry) {
+            names.push_back(std::dynamic_pointer_cast<TFakePollEntry>(entry)->Name);
+        });
+    return names;
+}
+
+TEST_F(TPollPlanGroupingTest, GroupsEqualPriorities)
+{
+    Plan->AddEntry(std::make_shared<TGroupedPollEntry>("A1", 100, &GroupA, 100));
+    Plan->AddEntry(std::make_shared<TGroupedPollEntry>("B1", 100, &GroupB, 50));
+    Plan->AddEntry(std::make_shared<TGroupedPollEntry>("A2", 100, &GroupA, 100));
+
+    ASSERT_EQ(std::vector<std::string>({ "A1", "A2", "B1" }), RunPass());
+    // A1 B1 A2 would need two switches, A1 A2 B1 needs only one
+    ASSERT_EQ(1, Plan->GetLastPassStats().SwitchesAvoided);
+    ASSERT_EQ(std::chrono::microseconds(std::chrono::milliseconds(100)),
+              Plan->GetLastPassStats().SwitchTimeSaved);
+}
+
+TEST_F(TPollPlanGroupingTest, PriorityTolerance)
+{
+    Plan->AddEntry(std::make_shared<TGroupedPollEntry>("A1", 10, &GroupA, 100));
+    Plan->AddEntry(std::make_shared<TGroupedPollEntry>("B1", 20, &GroupB, 100));
+    Plan->AddEntry(std::make_shared<TGroupedPollEntry>("A2", 1000, &GroupA, 100));
+
+    // make the entries overdue, so the 20ms one is much more
+    // important than the 1s one and can't be deferred
+    Elapse(100);
+    ASSERT_EQ(std::vector<std::string>({ "A1", "B1", "A2" }), RunPass());
+    ASSERT_EQ(0, Plan->GetLastPassStats().SwitchesAvoided);
+    ASSERT_EQ(std::chrono::microseconds::zero(), Plan->GetLastPassStats().SwitchTimeSaved);
+}
+
+TEST_F(TPollPlanGroupingTest, ParkGroup)
+{
+    Plan->AddEntry(std::make_shared<TGroupedPollEntry>("A1", 100, &GroupA, 100));
+    Plan->AddEntry(std::make_shared<TGroupedPollEntry>("B1", 100, &GroupB, 100));
+    Plan->AddEntry(std::make_shared<TGroupedPollEntry>("A2", 50, &GroupA, 100));
+
+    ASSERT_EQ(std::vector<std::string>({ "A1", "A2", "B1" }), RunPass());
+    Plan->ParkGroup(&GroupA, CurrentTime + std::chrono::milliseconds(250));
+
+    // parked entries are not polled even though they're due
+    CurrentTime = Plan->GetNextPollTimePoint();
+    ASSERT_EQ(StartTime + std::chrono::milliseconds(100), CurrentTime);
+    ASSERT_EQ(std::vector<std::string>({ "B1" }), RunPass());
+    CurrentTime = Plan->GetNextPollTimePoint();
+    ASSERT_EQ(StartTime + std::chrono::milliseconds(200), CurrentTime);
+    ASSERT_EQ(std::vector<std::string>({ "B1" }), RunPass());
+
+    // the parked entries wake up at once and are scheduled as usual after that
+    CurrentTime = Plan->GetNextPollTimePoint();
+    ASSERT_EQ(StartTime + std::chrono::milliseconds(250), CurrentTime);
+    ASSERT_EQ(std::vector<std::string>({ "A1", "A2" }), RunPass());
+    CurrentTime = Plan->GetNextPollTimePoint();
+    ASSERT_EQ(StartTime + std::chrono::milliseconds(300), CurrentTime);
+    ASSERT_EQ(std::vector<std::string>({ "B1", "A2" }), RunPass());
+}
+
+struct TClassPollEntry: public TFakePollEntry {
+    TClassPollEntry(const std::string& name, int poll_interval, EPriorityClass cls):
+        TFakePollEntry(name, poll_interval), Class(cls) {}
+    EPriorityClass PriorityClass() const { return Class; }
+    EPriorityClass Class;
+};
+
+class TPollPlanClassTest: public TPollPlanTest {
+protected:
+    void SetUp();
+    std::map<std::string, int> Run(int passes, int request_time);
+};
+
+void TPollPlanClassTest::SetUp()
+{
+    TPollPlanTest::SetUp();
+    Plan->Reset();
+}
+
+std::map<std::string, int> TPollPlanClassTest::Run(int passes, int request_time)
+{
+    std::map<std::string, int> polls;
+    for (int i = 0; i < passes; ++i) {
+        CurrentTime = Plan->GetNextPollTimePoint();
+        Plan->ProcessPending([&](const PPollEntry& entry) {
+                polls[std::dynamic_pointer_cast<TFakePollEntry>(entry)->Name]++;
+                Elapse(request_time);
+            });
+    }
+    return polls;
+}
+
+TEST_F(TPollPlanClassTest, WeightedSharing)
+{
+    Plan->SetClassWeight(EPriorityClass::Realtime, 2);
+    Plan->AddEntry(std::make_shared<TClassPollEntry>("realtime", 0, EPriorityClass::Realtime));
+    Plan->AddEntry(std::make_shared<TClassPollEntry>("normal", 0, EPriorityClass::Normal));
+
+    auto polls = Run(300, 1);
+    ASSERT_NEAR(2.0, double(polls["realtime"]) / polls["normal"], 0.05);
+}
+
+TEST_F(TPollPlanClassTest, RealtimePreemptsBackground)
+{
+    Plan->SetClassWeight(EPriorityClass::Background, 100);
+    Plan->AddEntry(std::make_shared<TClassPollEntry>("background", 10, EPriorityClass::Background));
+    Plan->AddEntry(std::make_shared<TClassPollEntry>("realtime", 0, EPriorityClass::Realtime));
+
+    // the realtime entry is always due, so the background one never
+    // gets the bus regardless of its weight
+    auto polls = Run(100, 1);
+    ASSERT_EQ(0, polls["background"]);
+    ASSERT_EQ(100, polls["realtime"]);
+    ASSERT_EQ(9, Plan->GetStarvationCount(EPriorityClass::Background));
+    ASSERT_EQ(0, Plan->GetStarvationCount(EPriorityClass::Realtime));
+}
+
+TEST_F(TPollPlanClassTest, PreemptedPass)
+{
+    Plan->AddEntry(std::make_shared<TClassPollEntry>("realtime", 30, EPriorityClass::Realtime));
+    Plan->AddEntry(std::make_shared<TClassPollEntry>("background1", 1000, EPriorityClass::Background));
+    Plan->AddEntry(std::make_shared<TClassPollEntry>("background2", 1000, EPriorityClass::Background));
+
+    auto run_pass = [this]() {
+        std::vector<std::string> names;
+        CurrentTime = Plan->GetNextPollTimePoint();
+        Plan->ProcessPending([&](const PPollEntry& entry) {
+                names.push_back(std::dynamic_pointer_cast<TFakePollEntry>(entry)->Name);
+                Elapse(20);
+            });
+        return names;
+    };
+
+    // the realtime entry becomes due while the first background one
+    // is polled, the second one is left for the next pass
+    ASSERT_EQ(std::vector<std::string>({ "realtime", "background1" }), run_pass());
+    ASSERT_TRUE(Plan->GetLastPassStats().Preempted);
+    ASSERT_EQ(std::vector<std::string>({ "realtime", "background2" }), run_pass());
+    ASSERT_FALSE(Plan->GetLastPassStats().Preempted);
+}
+
+TEST_F(TPollPlanClassTest, IdleClassGetsNoCredit)
+{
+    Plan->AddEntry(std::make_shared<TClassPollEntry>("normal", 0, EPriorityClass::Normal));
+    Run(100, 10);
+
+    // the realtime class was idle while the normal one was using
+    // the bus, it doesn't get the whole second back now
+    Plan->AddEntry(std::make_shared<TClassPollEntry>("realtime", 0, EPriorityClass::Realtime));
+    auto polls = Run(10, 10);
+    ASSERT_NEAR(polls["normal"], polls["realtime"], 1);
+}
@@ -0,0 +1,68 @@
+#include <gtest/gtest.h>
+
+#include "testlog.h"
+#include "poll_simulator.h"
+
+class TPollSimulatorTest: public ::testing::Test {
+protected:
+    void SetUp();
+    void TearDown();
+
+    PPortConfig PortConfig;
+};
+
+void TPollSimulatorTest::SetUp()
+{
+    TConfigParser parser(TLoggedFixture::GetDataFilePath("configs/config-plan-test.json"), false,
+                         TSerialDeviceFactory::GetRegisterTypes);
+    PortConfig = parser.Parse()->PortConfigs[0];
+}
+
+void TPollSimulatorTest::TearDown()
+{
+    TRegister::DeleteIntern();
+}
+
+TEST_F(TPollSimulatorTest, AchievedIntervals)
+{
+    TPollSimulator simulator(PortConfig);
+    TSimulatedDeviceModel model;
+    model.Latency = std::chrono::milliseconds(5);
+    simulator.SetDefaultModel(model);
+    auto report = simulator.Run(std::chrono::seconds(10));
+
+    ASSERT_EQ(std::chrono::seconds(10), report.Duration);
+    ASSERT_EQ(1, report.IntervalScale);
+    ASSERT_EQ(2u, report.Channels.size());
+
+    // each read takes 15 bytes at 9600 8N1 plus 5 ms of latency,
+    // ~20.6 ms in total, there's plenty of bus time for both channels
+    const auto& fast = report.Channels[0];
+    ASSERT_EQ("modbus-sample/Fast", fast.Name);
+    ASSERT_EQ(std::chrono::milliseconds(100), fast.DesiredInterval);
+    ASSERT_NEAR(100, fast.AchievedInterval.count() / 1000.0, 5);
+    ASSERT_LT(fast.MaxStaleness, std::chrono::milliseconds(150));
+
+    const auto& slow = report.Channels[1];
+    ASSERT_EQ("modbus-sample/Slow", slow.Name);
+    ASSERT_NEAR(1000, slow.AchievedInterval.count() / 1000.0, 50);
+
+    ASSERT_NEAR(0.23, report.Utilization, 0.02);
+}
+
+TEST_F(TPollSimulatorTest, Errors)
+{
+    TPollSimulator simulator(PortConfig);
+    TSimulatedDeviceModel model;
+    model.ErrorRate = 1;
+    simulator.SetDeviceModel("modbus-sample", model);
+    auto report = simulator.Run(std::chrono::seconds(10));
+
+    // failed requests take the whole response timeout
+    ASSERT_GT(report.Utilization, 0.9);
+    for (const auto& channel: report.Channels) {
+        ASSERT_EQ(0, channel.Polls);
+        ASSERT_EQ(std::chrono::microseconds::zero(), channel.AchievedInterval);
+        ASSERT_GE(channel.MaxStaleness, std::chrono::seconds(10));
+    }
+}
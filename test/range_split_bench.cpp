@@ -0,0 +1,144 @@
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <unistd.h>
+#include <gtest/gtest.h>
+
+#include "testlog.h"
+#include "serial_config.h"
+#include "serial_device.h"
+#include "serial_port.h"
+#include "modbus_common.h"
+
+namespace {
+    const int SplitRepeats = 100;
+
+    struct TSplitStats {
+        int Requests = 0;
+        int Bytes = 0;
+        double WireTime = 0; // us per poll cycle
+        long long SplitTime = 0; // ns per split
+    };
+
+    // requests and data that go through the bus to read all the ranges once
+    TSplitStats Measure(const std::list<PRegisterRange>& ranges, PPort port)
+    {
+        TSplitStats stats;
+        for (const auto& range: ranges) {
+            const auto& regs = range->RegisterList();
+            int count = regs.back()->Address + regs.back()->Width() - regs.front()->Address;
+            bool single_bit = regs.front()->Type == Modbus::REG_COIL || regs.front()->Type == Modbus::REG_DISCRETE;
+            int bytes = 8 + 5 + (single_bit ? (count + 7) / 8 : count * 2);
+            stats.Requests++;
+            stats.Bytes += bytes;
+            // 3.5 characters of silence before each frame
+            stats.WireTime += port->GetSendTime(bytes + 7).count() +
+                range->Device()->DeviceConfig()->GuardInterval.count();
+        }
+        return stats;
+    }
+
+    TSplitStats Split(const std::list<PRegister>& regs, PDeviceConfig config, PPort port, PPort cost_port)
+    {
+        std::list<PRegisterRange> ranges;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < SplitRepeats; ++i)
+            ranges = Modbus::SplitRegisterList(regs, config, port, false, true);
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        auto stats = Measure(ranges, cost_port);
+        stats.SplitTime = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count() / SplitRepeats;
+        return stats;
+    }
+};
+
+// Splits the registers of every bundled Modbus device template the way
+// TSerialClient does it and compares the old greedy splitter (which is
+// what SplitRegisterList does when the port has no line settings) with
+// the cost based one at 9600 8N1. None of the templates allow holes, so
+// the comparison is repeated with several max_reg_hole / max_bit_hole
+// values forced on all of them.
+TEST(TRangeSplitBench, GreedyVsOptimal)
+{
+    static const int hole_limits[][2] = { { 0, 0 }, { 10, 80 }, { 50, 400 }, { 100, 2000 } };
+
+    auto templates = TConfigTemplateParser(TLoggedFixture::GetDataFilePath("../wb-mqtt-serial-templates"), false).Parse();
+    auto port_settings = std::make_shared<TSerialPortSettings>("/dev/null", 9600, 'N', 8, 1,
+                                                               std::chrono::milliseconds(500));
+    auto port = std::make_shared<TSerialPort>(port_settings);
+
+    std::cout << std::left << std::setw(10) << "holes" << std::setw(10) << "splitter" << std::right <<
+        std::setw(10) << "devices" << std::setw(10) << "requests" << std::setw(10) << "bytes" <<
+        std::setw(16) << "wire ms/cycle" << std::setw(12) << "split us" << std::endl;
+    for (const auto& limits: hole_limits) {
+        TSplitStats greedy, optimal;
+        int devices = 0;
+        for (const auto& p: *templates) {
+            const auto& data = p.second->DeviceData;
+            if (data.isMember("protocol") && data["protocol"].asString() != "modbus")
+                continue;
+
+            char fname[] = "/tmp/range_split_bench_XXXXXX";
+            int fd = mkstemp(fname);
+            ASSERT_GE(fd, 0);
+            close(fd);
+            {
+                std::ofstream f(fname);
+                f << "{ \"ports\": [ { \"path\": \"/dev/null\", \"baud_rate\": 9600, \"parity\": \"N\", " <<
+                    "\"data_bits\": 8, \"stop_bits\": 1, \"devices\": [ { \"slave_id\": 1, " <<
+                    "\"device_type\": \"" << p.first << "\", \"max_reg_hole\": " << limits[0] <<
+                    ", \"max_bit_hole\": " << limits[1] << " } ] } ] }";
+            }
+            PHandlerConfig handler_config;
+            try {
+                handler_config = TConfigParser(fname, false, TSerialDeviceFactory::GetRegisterTypes, templates).Parse();
+            } catch (const TConfigParserException& e) {
+                unlink(fname);
+                std::cout << "skipping " << p.first << ": " << e.what() << std::endl;
+                continue;
+            }
+            unlink(fname);
+
+            auto device_config = handler_config->PortConfigs[0]->DeviceConfigs[0];
+            auto device = TSerialDeviceFactory::CreateDevice(device_config, port);
+            // TSerialClient splits the registers of a device sorted by type and address
+            std::list<PRegister> regs;
+            for (const auto& channel_config: device_config->DeviceChannelConfigs) {
+                for (const auto& reg_config: channel_config->RegisterConfigs)
+                    regs.push_back(TRegister::Intern(device, reg_config));
+            }
+            regs.sort([](const PRegister& a, const PRegister& b) {
+                    return a->Type < b->Type || (a->Type == b->Type && a->Address < b->Address);
+                });
+            regs.unique();
+
+            auto g = Split(regs, device_config, nullptr, port);
+            auto o = Split(regs, device_config, port, port);
+            ASSERT_LE(o.WireTime, g.WireTime + 1e-6) << p.first;
+            for (auto s: { std::make_pair(&greedy, &g), std::make_pair(&optimal, &o) }) {
+                s.first->Requests += s.second->Requests;
+                s.first->Bytes += s.second->Bytes;
+                s.first->WireTime += s.second->WireTime;
+                s.first->SplitTime += s.second->SplitTime;
+            }
+            ++devices;
+
+            TSerialDeviceFactory::RemoveDevice(device);
+            TRegister::DeleteIntern();
+        }
+
+        std::ostringstream holes;
+        holes << limits[0] << "/" << limits[1];
+        auto print = [&](const char* name, const TSplitStats& s) {
+            std::cout << std::left << std::setw(10) << holes.str() << std::setw(10) << name << std::right <<
+                std::setw(10) << devices << std::setw(10) << s.Requests << std::setw(10) << s.Bytes <<
+                std::setw(16) << std::fixed << std::setprecision(1) << s.WireTime / 1000 <<
+                std::setw(12) << std::setprecision(2) << s.SplitTime / 1000.0 << std::endl;
+        };
+        print("greedy", greedy);
+        print("dp", optimal);
+    }
+}
@@ -0,0 +1,156 @@
+#include <chrono>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <vector>
+#include <unistd.h>
+#include <gtest/gtest.h>
+
+#include "serial_client.h"
+#include "modbus_common.h"
+#include "crc16.h"
+
+namespace {
+    const int DeviceCount = 50;
+    const int HoldingsPerDevice = 80;
+    const int CoilsPerDevice = 20;
+    const int CycleCount = 2000;
+
+    // Answers Modbus RTU read requests of any slave right away, in
+    // virtual time. If count_requests is set, the first holding register
+    // of each device counts the requests, the rest keep their values.
+    class TModbusLoopbackPort: public TPort {
+    public:
+        TModbusLoopbackPort(bool count_requests): CountRequests(count_requests) {}
+        void Open() override { IsPortOpen = true; }
+        void Close() override { IsPortOpen = false; }
+        bool IsOpen() const override { return IsPortOpen; }
+        void CheckPortOpen() const override {}
+        void SkipNoise() override {}
+        void SetDebug(bool debug) override {}
+        bool Debug() const override { return false; }
+        uint8_t ReadByte() override { throw std::runtime_error("ReadByte() is not supported"); }
+        void Sleep(const std::chrono::microseconds& us) override { Time += us; }
+        bool Wait(const PBinarySemaphore& semaphore, const TTimePoint& until) override
+        {
+            if (semaphore->TryWait())
+                return true;
+            if (until > Time)
+                Time = until;
+            return false;
+        }
+        TTimePoint CurrentTime() const override { return Time; }
+
+        void WriteBytes(const uint8_t* buf, int count) override
+        {
+            Response.assign(buf, buf + 2);
+            int fn = buf[1], address = (buf[2] << 8) | buf[3], n = (buf[4] << 8) | buf[5];
+            if (fn == 1 || fn == 2) {
+                Response.push_back((n + 7) / 8);
+                for (int i = 0; i < (n + 7) / 8; ++i)
+                    Response.push_back(0x55);
+            } else {
+                Response.push_back(n * 2);
+                for (int i = 0; i < n; ++i) {
+                    uint16_t value = address + i || !CountRequests ? address + i : ++Requests;
+                    Response.push_back(value >> 8);
+                    Response.push_back(value);
+                }
+            }
+            uint16_t crc = CRC16::CalculateCRC16(Response.data(), Response.size());
+            Response.push_back(crc >> 8);
+            Response.push_back(crc);
+        }
+
+        int ReadFrame(uint8_t* buf, int count, const std::chrono::microseconds& timeout,
+                      TFrameCompletePred frame_complete) override
+        {
+            int size = std::min(count, int(Response.size()));
+            std::copy(Response.begin(), Response.begin() + size, buf);
+            return size;
+        }
+
+    private:
+        bool IsPortOpen = false;
+        bool CountRequests;
+        std::vector<uint8_t> Response;
+        uint16_t Requests = 0;
+        TTimePoint Time;
+    };
+
+    long ResidentKb()
+    {
+        long pages = 0, resident = 0;
+        std::ifstream("/proc/self/statm") >> pages >> resident;
+        return resident * (sysconf(_SC_PAGESIZE) / 1024);
+    }
+
+    double CpuSeconds()
+    {
+        return double(std::clock()) / CLOCKS_PER_SEC;
+    }
+
+    void RunPollCycles(bool changing_values, bool report_unchanged)
+    {
+        auto port = std::make_shared<TModbusLoopbackPort>(changing_values);
+        long rss_before = ResidentKb();
+
+        auto client = std::make_shared<TSerialClient>(port);
+        long long reads = 0;
+        client->SetReadCallback([&reads](PRegister, bool) { ++reads; });
+        client->SetErrorCallback([](PRegister, TRegisterHandler::TErrorState) {});
+        client->SetReportUnchanged(report_unchanged);
+        for (int i = 0; i < DeviceCount; ++i) {
+            auto config = std::make_shared<TDeviceConfig>("bench" + std::to_string(i), std::to_string(i + 1), "modbus");
+            config->MaxReadRegisters = 125;
+            config->Delay = std::chrono::milliseconds(0);
+            auto device = client->CreateDevice(config);
+            std::vector<PRegisterConfig> regs;
+            for (int address = 0; address < HoldingsPerDevice; ++address)
+                regs.push_back(TRegisterConfig::Create(Modbus::REG_HOLDING, address, U16, 1, 0, 0, true, true, "holding"));
+            for (int address = 0; address < CoilsPerDevice; ++address)
+                regs.push_back(TRegisterConfig::Create(Modbus::REG_COIL, address, U8, 1, 0, 0, true, true, "coil"));
+            for (auto& reg: regs) {
+                reg->PollInterval = std::chrono::milliseconds(100);
+                client->AddRegister(TRegister::Intern(device, reg));
+            }
+        }
+
+        client->Cycle();
+        long rss_after = ResidentKb();
+
+        reads = 0;
+        double start = CpuSeconds();
+        for (int i = 0; i < CycleCount; ++i)
+            client->Cycle();
+        double elapsed = CpuSeconds() - start;
+
+        long long polled = (long long)CycleCount * DeviceCount * (HoldingsPerDevice + CoilsPerDevice);
+        std::cout << "registers: " << DeviceCount * (HoldingsPerDevice + CoilsPerDevice) << ", cycles: " << CycleCount <<
+            ", reported register reads: " << reads << std::endl;
+        std::cout << "cpu time: " << elapsed * 1e6 / CycleCount << " us/cycle, " <<
+            elapsed * 1e9 / polled << " ns/register" << std::endl;
+        std::cout << "rss growth after setup and the first cycle: " << rss_after - rss_before << " KiB" << std::endl;
+        ASSERT_EQ(report_unchanged ? polled : 0, reads);
+
+        client.reset();
+        TRegister::DeleteIntern();
+    }
+};
+
+// Polls DeviceCount Modbus devices with HoldingsPerDevice holding
+// registers and CoilsPerDevice coils each (5000 registers in total)
+// through TSerialClient. The port answers at once in virtual time, so
+// the measured CPU time is spent on composing requests, parsing
+// responses and mapping the values to the registers.
+TEST(TRegisterStorageBench, PollCycle)
+{
+    RunPollCycles(true, true);
+}
+
+// Same with the values that never change after the first read and
+// unchanged reads not reported, as without max_unchanged_interval
+TEST(TRegisterStorageBench, PollCycleUnchanged)
+{
+    RunPollCycles(false, false);
+}
@@ -1,5 +1,6 @@
 #include <string>
 #include <map>
+#include <set>
 #include <memory>
 #include <algorithm>
 #include <cassert>
@@ -111,6 +112,229 @@ TEST_F(TSerialClientTest, Poll)
     EXPECT_EQ(to_string(42000), SerialClient->GetTextValue(reg33));
 }
 
+TEST_F(TSerialClientTest, AddRemoveDevice)
+{
+    PRegister reg0 = Reg(0);
+    SerialClient->AddRegister(reg0);
+
+    Note() << "Cycle()";
+    SerialClient->Cycle();
+
+    // the client is active now, devices are attached and
+    // detached without rebuilding the whole poll plan
+    auto config = std::make_shared<TDeviceConfig>("fake_sample2", std::to_string(2), "fake");
+    config->MaxReadRegisters = 0;
+    auto device2 = std::dynamic_pointer_cast<TFakeSerialDevice>(SerialClient->CreateDevice(config));
+    PRegister reg5 = TRegister::Intern(
+        device2, TRegisterConfig::Create(TFakeSerialDevice::REG_FAKE, 5, U16, 1, 0, 0, true, false, "fake", false, 0));
+    SerialClient->AddRegister(reg5);
+    device2->Registers[5] = 42;
+    Device->Registers[0] = 1;
+
+    Note() << "Cycle() [device added]";
+    SerialClient->Cycle();
+    EXPECT_EQ(to_string(1), SerialClient->GetTextValue(reg0));
+    EXPECT_EQ(to_string(42), SerialClient->GetTextValue(reg5));
+
+    SerialClient->RemoveDevice(device2);
+    EXPECT_THROW(SerialClient->GetTextValue(reg5), TSerialDeviceException);
+    device2->Registers[5] = 43;
+    Device->Registers[0] = 2;
+
+    Note() << "Cycle() [device removed]";
+    SerialClient->Cycle();
+    EXPECT_EQ(to_string(2), SerialClient->GetTextValue(reg0));
+}
+
+TEST_F(TSerialClientTest, RemoveDeviceRestoresIntervals)
+{
+    // 16 ms per register (see TSerialDevice::EstimateReadDuration())
+    Port->SetByteSendTime(std::chrono::milliseconds(1));
+    PRegister reg0 = Reg(0);
+    reg0->PollInterval = std::chrono::milliseconds(100);
+    SerialClient->AddRegister(reg0);
+
+    Note() << "Cycle()";
+    SerialClient->Cycle();
+    EXPECT_DOUBLE_EQ(1, SerialClient->GetIntervalScale());
+
+    auto config = std::make_shared<TDeviceConfig>("fake_sample2", std::to_string(2), "fake");
+    config->MaxReadRegisters = 0;
+    auto device2 = SerialClient->CreateDevice(config);
+    for (int addr = 0; addr < 5; ++addr) {
+        PRegister reg = TRegister::Intern(
+            device2, TRegisterConfig::Create(TFakeSerialDevice::REG_FAKE, addr, U16, 1, 0, 0, true, false, "fake", false, 0));
+        reg->PollInterval = std::chrono::milliseconds(100);
+        SerialClient->AddRegister(reg);
+    }
+
+    // the changes are applied by the next cycle
+    EXPECT_DOUBLE_EQ(1, SerialClient->GetIntervalScale());
+    Note() << "Cycle() [device added]";
+    SerialClient->Cycle();
+    EXPECT_GT(SerialClient->GetIntervalScale(), 1);
+
+    SerialClient->RemoveDevice(device2);
+    Note() << "Cycle() [device removed]";
+    SerialClient->Cycle();
+    EXPECT_DOUBLE_EQ(1, SerialClient->GetIntervalScale());
+}
+
+TEST_F(TSerialClientTest, SharedBusChangesDurations)
+{
+    // 16 ms per register (see TSerialDevice::EstimateReadDuration()),
+    // and 80 ms more for a device switch once the bus is shared
+    Port->SetByteSendTime(std::chrono::milliseconds(1));
+    Device->DeviceConfig()->Delay = std::chrono::milliseconds(80);
+    PRegister reg0 = Reg(0);
+    reg0->PollInterval = std::chrono::milliseconds(100);
+    SerialClient->AddRegister(reg0);
+
+    Note() << "Cycle()";
+    SerialClient->Cycle();
+    EXPECT_DOUBLE_EQ(1, SerialClient->GetIntervalScale());
+
+    auto config = std::make_shared<TDeviceConfig>("fake_sample2", std::to_string(2), "fake");
+    config->MaxReadRegisters = 0;
+    auto device2 = SerialClient->CreateDevice(config);
+    PRegister reg = TRegister::Intern(
+        device2, TRegisterConfig::Create(TFakeSerialDevice::REG_FAKE, 0, U16, 1, 0, 0, true, false, "fake", false, 0));
+    reg->PollInterval = std::chrono::milliseconds(10000);
+    SerialClient->AddRegister(reg);
+
+    // polling reg0 now takes a device switch, so the bus is overloaded
+    Note() << "Cycle() [device added]";
+    SerialClient->Cycle();
+    EXPECT_GT(SerialClient->GetIntervalScale(), 1);
+
+    SerialClient->RemoveDevice(device2);
+    Note() << "Cycle() [device removed]";
+    SerialClient->Cycle();
+    EXPECT_DOUBLE_EQ(1, SerialClient->GetIntervalScale());
+}
+
+TEST_F(TSerialClientTest, RemovedDeviceSlotsAreReused)
+{
+    SerialClient->AddRegister(Reg(0));
+    auto add_device = [this](int id) {
+        auto config = std::make_shared<TDeviceConfig>("fake_sample" + std::to_string(id), std::to_string(id), "fake");
+        config->MaxReadRegisters = 0;
+        auto device = std::dynamic_pointer_cast<TFakeSerialDevice>(SerialClient->CreateDevice(config));
+        std::vector<PRegister> regs;
+        for (int addr = 0; addr < 2; ++addr) {
+            regs.push_back(TRegister::Intern(
+                device, TRegisterConfig::Create(TFakeSerialDevice::REG_FAKE, addr, U16, 1, 0, 0, true, false, "fake", false, 0)));
+            SerialClient->AddRegister(regs.back());
+        }
+        return std::make_pair(device, regs);
+    };
+
+    auto device2 = add_device(2);
+    Note() << "Cycle()";
+    SerialClient->Cycle();
+    std::set<uint32_t> slots = { device2.second[0]->Slot, device2.second[1]->Slot };
+    EXPECT_EQ(std::set<uint32_t>({ 1, 2 }), slots);
+
+    SerialClient->RemoveDevice(device2.first);
+    Note() << "Cycle() [device removed]";
+    SerialClient->Cycle();
+
+    // the new registers take the slots of the removed ones
+    auto device3 = add_device(3);
+    slots = { device3.second[0]->Slot, device3.second[1]->Slot };
+    EXPECT_EQ(std::set<uint32_t>({ 1, 2 }), slots);
+    EXPECT_THROW(SerialClient->GetTextValue(device2.second[0]), TSerialDeviceException);
+
+    device3.first->Registers[1] = 42;
+    SerialClient->SetTextValue(device3.second[0], "7");
+    Note() << "Cycle() [device added]";
+    SerialClient->Cycle();
+    EXPECT_EQ(7, device3.first->Registers[0]);
+    EXPECT_EQ("42", SerialClient->GetTextValue(device3.second[1]));
+}
+
+TEST_F(TSerialClientTest, PreemptedPass)
+{
+    PRegister reg0 = Reg(0);
+    reg0->PollInterval = std::chrono::milliseconds(30);
+    reg0->Priority = EPriorityClass::Realtime;
+    SerialClient->AddRegister(reg0);
+    PRegister reg1 = Reg(1);
+    reg1->PollInterval = std::chrono::milliseconds(1000);
+    reg1->Priority = EPriorityClass::Background;
+    SerialClient->AddRegister(reg1);
+
+    auto config = std::make_shared<TDeviceConfig>("fake_sample2", std::to_string(2), "fake");
+    config->MaxReadRegisters = 0;
+    auto device2 = SerialClient->CreateDevice(config);
+    PRegister reg2 = TRegister::Intern(
+        device2, TRegisterConfig::Create(TFakeSerialDevice::REG_FAKE, 0, U16, 1, 0, 0, true, false, "fake", false, 0));
+    reg2->PollInterval = std::chrono::milliseconds(1000);
+    reg2->Priority = EPriorityClass::Background;
+    SerialClient->AddRegister(reg2);
+
+    // each read takes 20 ms
+    SerialClient->SetReadCallback([this](PRegister reg, bool changed) {
+            Emit() << "Read Callback: " << reg->ToString() << " becomes " <<
+                SerialClient->GetTextValue(reg) << (changed ? "" : " [unchanged]");
+            Port->Elapse(std::chrono::milliseconds(20));
+        });
+
+    // the realtime register becomes due while reg1 is read, so the
+    // pass ends before reg2 and neither the devices nor the port
+    // get the cycle results yet
+    Note() << "Cycle() [preempted]";
+    SerialClient->Cycle();
+
+    Device->Registers[0] = 1;
+    Note() << "Cycle()";
+    SerialClient->Cycle();
+}
+
+TEST_F(TSerialClientTest, SustainedPreemption)
+{
+    auto config = std::make_shared<TDeviceConfig>("fake_sample2", std::to_string(2), "fake");
+    config->MaxReadRegisters = 0;
+    config->DeviceTimeout = std::chrono::milliseconds(0);
+    config->DeviceMaxFailCycles = 1;
+    auto device = std::dynamic_pointer_cast<TFakeSerialDevice>(SerialClient->CreateDevice(config));
+    auto reg = [&device](int addr, int poll_interval, EPriorityClass priority) {
+        PRegister reg = TRegister::Intern(
+            device, TRegisterConfig::Create(TFakeSerialDevice::REG_FAKE, addr, U16, 1, 0, 0, true, false, "fake", false, 0));
+        reg->PollInterval = std::chrono::milliseconds(poll_interval);
+        reg->Priority = priority;
+        return reg;
+    };
+    // the realtime register is always due, so the background one never
+    // gets the bus and every pass is preempted
+    SerialClient->AddRegister(reg(0, 0, EPriorityClass::Realtime));
+    SerialClient->AddRegister(reg(1, 1000, EPriorityClass::Background));
+
+    device->BlockReadFor(0, true);
+    for (int i = 0; i < 3; ++i) {
+        Note() << "Cycle() [preempted]";
+        SerialClient->Cycle();
+        EXPECT_EQ(0, device->EndPollCycleCount);
+        EXPECT_FALSE(device->GetIsDisconnected());
+    }
+    // the cycle is closed after 4 preempted passes in a row anyway
+    Note() << "Cycle() [preempted, closes the cycle]";
+    SerialClient->Cycle();
+    EXPECT_EQ(1, device->EndPollCycleCount);
+    EXPECT_TRUE(device->GetIsDisconnected());
+
+    device->BlockReadFor(0, false);
+    for (int i = 0; i < 3; ++i) {
+        Note() << "Cycle() [preempted]";
+        SerialClient->Cycle();
+        EXPECT_EQ(1, device->EndPollCycleCount);
+    }
+    Note() << "Cycle() [preempted, closes the cycle]";
+    SerialClient->Cycle();
+    EXPECT_EQ(2, device->EndPollCycleCount);
+    EXPECT_FALSE(device->GetIsDisconnected());
+}
+
 TEST_F(TSerialClientTest, Write)
 {
     PRegister reg1 = Reg(1);
@@ -135,6 +359,80 @@ TEST_F(TSerialClientTest, Write)
     }
 }
 
+TEST_F(TSerialClientTest, WriteConflation)
+{
+    PRegister reg1 = Reg(1);
+    reg1->WriteConflation = std::chrono::milliseconds(100);
+    reg1->PollInterval = std::chrono::milliseconds(20);
+    SerialClient->AddRegister(reg1);
+
+    Note() << "Cycle()";
+    SerialClient->Cycle();
+
+    // the first value is written right away, the ones set
+    // within 100 ms after it replace each other
+    for (int i = 1; i <= 4; ++i) {
+        SerialClient->SetTextValue(reg1, to_string(i));
+        Note() << "Cycle()";
+        SerialClient->Cycle();
+    }
+    EXPECT_EQ(1, Device->Registers[1]);
+
+    for (int i = 0; i < 6; ++i) {
+        Note() << "Cycle()";
+        SerialClient->Cycle();
+    }
+    EXPECT_EQ(4, Device->Registers[1]);
+    EXPECT_EQ(2, SerialClient->GetDroppedWriteCount());
+    EXPECT_EQ(1, SerialClient->GetConflatedWriteCount());
+
+    // values set together replace each other without the window too
+    SerialClient->SetTextValue(reg1, "5");
+    SerialClient->SetTextValue(reg1, "6");
+    for (int i = 0; i < 6; ++i) {
+        Note() << "Cycle()";
+        SerialClient->Cycle();
+    }
+    EXPECT_EQ(6, Device->Registers[1]);
+    EXPECT_EQ(3, SerialClient->GetDroppedWriteCount());
+}
+
+TEST_F(TSerialClientTest, ReadBack)
+{
+    PRegister reg1 = Reg(1);
+    PRegister reg2 = Reg(2);
+    PRegister reg20 = Reg(20);
+    for (const auto& reg: { reg1, reg2, reg20 })
+        reg->PollInterval = std::chrono::hours(1);
+    reg1->ReadBack = true;
+    reg2->ReadBack = true;
+    SerialClient->AddRegister(reg1);
+    SerialClient->AddRegister(reg2);
+    SerialClient->AddRegister(reg20);
+
+    Note() << "Cycle()";
+    SerialClient->Cycle();
+
+    // reg1 and reg2 are read right after the write, reg20 isn't
+    SerialClient->SetTextValue(reg1, "1");
+    SerialClient->SetTextValue(reg2, "2");
+    SerialClient->SetTextValue(reg20, "4242");
+    Note() << "Cycle()";
+    SerialClient->Cycle();
+
+    // registers that failed to be written aren't read back
+    Device->BlockWriteFor(1, true);
+    SerialClient->SetTextValue(reg1, "10");
+    SerialClient->SetTextValue(reg2, "20");
+    Note() << "Cycle()";
+    SerialClient->Cycle();
+    Device->BlockWriteFor(1, false);
+
+    EXPECT_EQ(1, Device->Registers[1]);
+    EXPECT_EQ(20, Device->Registers[2]);
+    EXPECT_EQ(4242, Device->Registers[20]);
+}
+
 TEST_F(TSerialClientTest, S8)
 {
     PRegister reg20 = Reg(20, S8);